@@ -48,23 +48,23 @@ public:
 		p[3] = 1;
 	};
 
-	Point& operator= (const Point v) {
+	Point& operator= (const Point& v) {
 		p[0] = v[0];
 		p[1] = v[1];
 		p[2] = v[2];
 		p[3] = 1;
 		return *this;
 	};
-    bool operator< (const Point& rhs) {
+    bool operator< (const Point& rhs) const {
         /* do actual comparison */ 
         return p[0] < rhs[0] && p[1] < rhs[1] && p[2] < rhs[2];
     };
 
 
-    bool operator> ( Point& rhs){ return rhs < *this; };
-    bool operator<=( Point& rhs){ return !(*this > rhs); };
-    bool operator>=( Point& rhs){ return !(*this < rhs); };
-    bool operator!= (const Point v) {
+    bool operator> (const Point& rhs) const { return rhs < *this; };
+    bool operator<=(const Point& rhs) const { return !(*this > rhs); };
+    bool operator>=(const Point& rhs) const { return !(*this < rhs); };
+    bool operator!= (const Point& v) const {
         //if ((p[0] != v[0]) || (p[1] != v[1]) || (p[2] != v[2])) {
         //	return 1;
         //}
@@ -75,7 +75,7 @@ public:
         return false;
     };
 
-    bool operator== (const Point v) {
+    bool operator== (const Point& v) const {
         //if ((p[0] == v[0]) && (p[1] == v[1]) && (p[2] == v[2])) {
         //	return 1;
         //}
@@ -176,7 +176,7 @@ class Vector {
         }
 
 
-        Vector& operator= (const Vector v) {
+        Vector& operator= (const Vector& v) {
             p[0] = v[0];
             p[1] = v[1];
             p[2] = v[2];
@@ -184,7 +184,7 @@ class Vector {
             return *this;
         };
 
-        bool operator!= (const Vector v) {
+        bool operator!= (const Vector& v) const {
             //if ((p[0] != v[0]) || (p[1] != v[1]) || (p[2] != v[2])) {
             //	return 1;
             //}
@@ -195,7 +195,7 @@ class Vector {
             return false;
         };
 
-        bool operator== (const Vector v) {
+        bool operator== (const Vector& v) const {
             //if ((p[0] == v[0]) && (p[1] == v[1]) && (p[2] == v[2])) {
             //	return 1;
             //	}
@@ -222,7 +222,7 @@ class Vector {
             return p[i];
         }
 
-        double length() {
+        double length() const {
             double d = (p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
             return sqrt(d < 0 ? 0 : d);
         };
@@ -284,7 +284,7 @@ class Matrix {
             p[12] = m[12]; p[13] = m[13]; p[14] = m[14]; p[15] = m[15];
         }
 
-        Matrix(double* m) {
+        Matrix(const double* m) {
             p[0] = m[0]; p[1] = m[1]; p[2] = m[2]; p[3] = m[3];
             p[4] = m[4]; p[5] = m[5]; p[6] = m[6]; p[7] = m[7];
             p[8] = m[8]; p[9] = m[9]; p[10] = m[10]; p[11] = m[11];
@@ -305,7 +305,7 @@ class Matrix {
             return p;
         }
 
-        bool operator==(const Matrix m) const {
+        bool operator==(const Matrix& m) const {
             if ((p[0] == m[0]) && (p[1] == m[1]) && (p[2] == m[2]) && (p[3] == m[3]) &&
                     (p[4] == m[4]) && (p[5] == m[5]) && (p[6] == m[6]) && (p[7] == m[7]) &&
                     (p[8] == m[8]) && (p[9] == m[9]) && (p[10] == m[10]) && (p[11] == m[11]) &&
@@ -314,7 +314,7 @@ class Matrix {
             return 0;
         };
 
-        bool operator!=(const Matrix m) const {
+        bool operator!=(const Matrix& m) const {
             if ((p[0] != m[0]) || (p[1] != m[1]) || (p[2] != m[2]) || (p[3] != m[3]) ||
                     (p[4] != m[4]) || (p[5] != m[5]) || (p[6] != m[6]) || (p[7] != m[7]) ||
                     (p[8] != m[8]) || (p[9] != m[9]) || (p[10] != m[10]) || (p[11] != m[11]) ||
@@ -323,7 +323,7 @@ class Matrix {
             return 0;
         };
 
-        Matrix& operator=(const Matrix m) {
+        Matrix& operator=(const Matrix& m) {
             p[0] = m[0];  p[1] = m[1]; p[2] = m[2]; p[3] = m[3];
             p[4] = m[4];  p[5] = m[5]; p[6] = m[6]; p[7] = m[7];
             p[8] = m[8];  p[9] = m[9]; p[10] = m[10]; p[11] = m[11];
@@ -485,7 +485,7 @@ inline Vector operator*(const double s, const Vector &v) {
 };
 
 // This does the same.
-inline Vector operator*(Vector& v, const double s) {
+inline Vector operator*(const Vector& v, const double s) {
     Vector t;
     t[0] = v[0] * s;  t[1] = v[1] * s;  t[2] = v[2] * s;  t[3] = 0;
     return t;
@@ -576,7 +576,7 @@ inline Vector cross(const Vector& u, const Vector& v) {
 // --- Unit length vector pointing in the same direction
 
 // Returns the normalized vector
-inline Vector normalize(Vector& v) {
+inline Vector normalize(const Vector& v) {
     Vector t(v);
     t.normalize();
     return t;
@@ -647,7 +647,7 @@ inline Matrix rotZ_mat(double radians) {
 // Returns a rotation matrix effecting a rotation around the given vector and
 // point, by the specified number of radians.
 
-inline Matrix rot_mat(Vector &v, double a){
+inline Matrix rot_mat(const Vector &v, double a){
     Vector nv = normalize(v);
 
     return (
@@ -678,7 +678,7 @@ inline Matrix rot_mat(Vector &v, double a){
                     );
 };
 
-inline Matrix rot_mat(Point  &p, Vector &v, double a){
+inline Matrix rot_mat(const Point &p, const Vector &v, double a){
     Vector nv = normalize(v);
 
     return (trans_mat(Vector(p[0], p[1], p[2])) *
@@ -836,7 +836,7 @@ inline Matrix invert(const Matrix& matrix) {
 }
 
 // Returns the inverse matrix of rot_mat()
-inline Matrix inv_rot_mat(Point &p, Vector &v, double a){
+inline Matrix inv_rot_mat(const Point &p, const Vector &v, double a){
     Matrix m = rot_mat(p, v, a);
     return (invert(m));
 };
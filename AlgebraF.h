@@ -0,0 +1,272 @@
+#ifndef ALGEBRAF_H
+#define ALGEBRAF_H
+
+/*  =================== File Information =================
+        File Name: AlgebraF.h
+        Description: Single precision Point, Vector and Matrix
+        Author:
+
+        Purpose: The mesh keeps its data in floats, so the physics and
+                 mesh code work in Pointf / Vectorf / Matrixf instead of
+                 the double types of Algebra.h and stop converting every
+                 value both ways.  Each type is four (or sixteen) floats
+                 on a 16 byte boundary and trivially copyable, so one
+                 fits an SSE / NEON register (a matrix, one per column)
+                 and vectors of them can be memcpy'd.  Every operation
+                 evaluates the same float expression, in the same order,
+                 as the scalar fallback, so results do not depend on the
+                 instruction set.  Conversions to and from the double types are
+                 explicit (Vectorf(v), toVector, ...), so mixed
+                 expressions do not silently pick one precision.
+        ===================================================== */
+
+#include <math.h>
+#include "Algebra.h"
+
+#if defined(__SSE__)
+#define ALGEBRAF_SSE 1
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#define ALGEBRAF_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*  ============== Lanes ==============
+	Four floats in a register, and the handful of operations the
+	types below are built from.  The types keep their value in a
+	lanes member rather than a float array, so it stays in a
+	register between operations instead of going through memory.
+	=================================== */
+namespace algebraf {
+#if defined(ALGEBRAF_SSE)
+typedef __m128 lanes;
+inline lanes load(const float* p) { return _mm_load_ps(p); }
+inline void store(float* p, lanes a) { _mm_store_ps(p, a); }
+inline lanes splat(float s) { return _mm_set1_ps(s); }
+inline lanes add(lanes a, lanes b) { return _mm_add_ps(a, b); }
+inline lanes sub(lanes a, lanes b) { return _mm_sub_ps(a, b); }
+inline lanes mul(lanes a, lanes b) { return _mm_mul_ps(a, b); }
+inline lanes div(lanes a, lanes b) { return _mm_div_ps(a, b); }
+#elif defined(ALGEBRAF_NEON)
+typedef float32x4_t lanes;
+inline lanes load(const float* p) { return vld1q_f32(p); }
+inline void store(float* p, lanes a) { vst1q_f32(p, a); }
+inline lanes splat(float s) { return vdupq_n_f32(s); }
+inline lanes add(lanes a, lanes b) { return vaddq_f32(a, b); }
+inline lanes sub(lanes a, lanes b) { return vsubq_f32(a, b); }
+inline lanes mul(lanes a, lanes b) { return vmulq_f32(a, b); }
+inline lanes div(lanes a, lanes b) { return vdivq_f32(a, b); }
+#else
+struct lanes {
+	float v[4];
+	float operator[] (int i) const { return v[i]; }
+};
+inline lanes load(const float* p) { lanes a = {{ p[0], p[1], p[2], p[3] }}; return a; }
+inline void store(float* p, lanes a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+inline lanes splat(float s) { lanes a = {{ s, s, s, s }}; return a; }
+inline lanes add(lanes a, lanes b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+inline lanes sub(lanes a, lanes b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+inline lanes mul(lanes a, lanes b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+inline lanes div(lanes a, lanes b) { for (int i = 0; i < 4; i++) a.v[i] /= b.v[i]; return a; }
+#endif
+}
+
+class alignas(16) Pointf {
+public:
+	constexpr Pointf() : v{ 0, 0, 0, 1 } {}
+	constexpr Pointf(float x, float y, float z) : v{ x, y, z, 1 } {}
+	explicit Pointf(algebraf::lanes a) : v(a) {}
+	explicit Pointf(const Point& p) : v{ (float)p[0], (float)p[1], (float)p[2], 1 } {}
+
+	Point toPoint() const { return Point(v[0], v[1], v[2]); }
+
+	float operator[] (int i) const { return v[i]; }
+	float& operator[] (int i) { return ((float*)&v)[i]; }
+	algebraf::lanes lanes() const { return v; }
+
+private:
+	algebraf::lanes v;
+};
+
+class alignas(16) Vectorf {
+public:
+	constexpr Vectorf() : v{ 0, 0, 0, 0 } {}
+	constexpr Vectorf(float x, float y, float z) : v{ x, y, z, 0 } {}
+	explicit Vectorf(algebraf::lanes a) : v(a) {}
+	explicit Vectorf(const Vector& d) : v{ (float)d[0], (float)d[1], (float)d[2], 0 } {}
+
+	Vector toVector() const { return Vector(v[0], v[1], v[2]); }
+
+	float operator[] (int i) const { return v[i]; }
+	float& operator[] (int i) { return ((float*)&v)[i]; }
+	algebraf::lanes lanes() const { return v; }
+
+	float length() const {
+		float d = v[0] * v[0] + v[1] * v[1];
+		d = d + v[2] * v[2];
+		return sqrtf(d);
+	}
+	// leaves a zero vector alone, like Vector::normalize
+	void normalize() {
+		float l = length();
+		if (l != 0) v = algebraf::div(v, algebraf::splat(l));
+	}
+	void negate() {
+		v = algebraf::sub(algebraf::splat(0), v);
+	}
+
+private:
+	algebraf::lanes v;
+};
+
+/*  ============== Matrixf ==============
+	Column major like Matrix: m(i, j) is row i of column j, and the
+	sixteen argument constructor takes the rows in reading order
+	===================================== */
+class alignas(16) Matrixf {
+public:
+	constexpr Matrixf() : p{ 1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  0, 0, 0, 1 } {}
+	constexpr Matrixf(float a, float b, float c, float d,
+	                  float e, float f, float g, float h,
+	                  float i, float j, float k, float l,
+	                  float m, float n, float o, float q)
+		: p{ a, e, i, m,  b, f, j, n,  c, g, k, o,  d, h, l, q } {}
+	explicit Matrixf(const Matrix& m) : p{} {
+		for (int i = 0; i < 16; i++) p[i] = (float)m[i];
+	}
+
+	Matrix toMatrix() const {
+		double m[16];
+		for (int i = 0; i < 16; i++) m[i] = p[i];
+		return Matrix(m);
+	}
+
+	constexpr float operator[] (int i) const { return p[i]; }
+	float& operator[] (int i) { return p[i]; }
+	constexpr float operator() (int i, int j) const { return p[j * 4 + i]; }
+	float& operator() (int i, int j) { return p[j * 4 + i]; }
+	const float* unpack() const { return p; }
+
+	algebraf::lanes column(int j) const { return algebraf::load(p + 4 * j); }
+
+private:
+	float p[16];
+};
+
+// ======================================================================
+//
+// Functions for Arithmetic Operators
+//
+// ======================================================================
+
+// --- Vectors and Points
+
+inline Pointf operator+(const Pointf& p, const Vectorf& v) {
+	return Pointf(algebraf::add(p.lanes(), v.lanes()));
+}
+
+inline Pointf operator+(const Vectorf& v, const Pointf& p) {
+	return Pointf(algebraf::add(p.lanes(), v.lanes()));
+}
+
+inline Vectorf operator+(const Vectorf& v1, const Vectorf& v2) {
+	return Vectorf(algebraf::add(v1.lanes(), v2.lanes()));
+}
+
+inline Pointf operator-(const Pointf& p, const Vectorf& v) {
+	return Pointf(algebraf::sub(p.lanes(), v.lanes()));
+}
+
+// the vector spanning point 2 to point 1
+inline Vectorf operator-(const Pointf& p1, const Pointf& p2) {
+	return Vectorf(algebraf::sub(p1.lanes(), p2.lanes()));
+}
+
+inline Vectorf operator-(const Vectorf& v1, const Vectorf& v2) {
+	return Vectorf(algebraf::sub(v1.lanes(), v2.lanes()));
+}
+
+inline Vectorf operator-(const Vectorf& v) {
+	return Vectorf(algebraf::sub(algebraf::splat(0), v.lanes()));
+}
+
+// --- Scalars
+
+inline Vectorf operator*(const Vectorf& v, float s) {
+	return Vectorf(algebraf::mul(v.lanes(), algebraf::splat(s)));
+}
+
+inline Vectorf operator*(float s, const Vectorf& v) {
+	return Vectorf(algebraf::mul(v.lanes(), algebraf::splat(s)));
+}
+
+inline Vectorf operator/(const Vectorf& v, float s) {
+	return Vectorf(algebraf::div(v.lanes(), algebraf::splat(s)));
+}
+
+// --- Matrix Operator
+
+// Applies the matrix to a point, returns the new point
+inline Pointf operator*(const Matrixf& m, const Pointf& p) {
+	algebraf::lanes t = algebraf::mul(m.column(0), algebraf::splat(p[0]));
+	t = algebraf::add(t, algebraf::mul(m.column(1), algebraf::splat(p[1])));
+	t = algebraf::add(t, algebraf::mul(m.column(2), algebraf::splat(p[2])));
+	t = algebraf::add(t, algebraf::mul(m.column(3), algebraf::splat(p[3])));
+	return Pointf(t);
+}
+
+// Applies the matrix to the vector, returns the new vector
+inline Vectorf operator*(const Matrixf& m, const Vectorf& v) {
+	algebraf::lanes t = algebraf::mul(m.column(0), algebraf::splat(v[0]));
+	t = algebraf::add(t, algebraf::mul(m.column(1), algebraf::splat(v[1])));
+	t = algebraf::add(t, algebraf::mul(m.column(2), algebraf::splat(v[2])));
+	Vectorf r(t);
+	r[3] = 0;
+	return r;
+}
+
+// Multiplies two matrices together, returns the resultant matrix
+inline Matrixf operator*(const Matrixf& m1, const Matrixf& m2) {
+	Matrixf t;
+	for (int j = 0; j < 4; j++) {
+		algebraf::lanes c = algebraf::mul(m1.column(0), algebraf::splat(m2(0, j)));
+		c = algebraf::add(c, algebraf::mul(m1.column(1), algebraf::splat(m2(1, j))));
+		c = algebraf::add(c, algebraf::mul(m1.column(2), algebraf::splat(m2(2, j))));
+		c = algebraf::add(c, algebraf::mul(m1.column(3), algebraf::splat(m2(3, j))));
+		algebraf::store(&t(0, j), c);
+	}
+	return t;
+}
+
+inline Matrixf transpose(const Matrixf& m) {
+	return Matrixf(m(0, 0), m(1, 0), m(2, 0), m(3, 0),
+	               m(0, 1), m(1, 1), m(2, 1), m(3, 1),
+	               m(0, 2), m(1, 2), m(2, 2), m(3, 2),
+	               m(0, 3), m(1, 3), m(2, 3), m(3, 3));
+}
+
+// --- Length, dot and cross products
+
+inline float length(const Vectorf& v) {
+	return v.length();
+}
+
+// (x * x' + y * y') + z * z', in that order on every instruction set
+inline float dot(const Vectorf& u, const Vectorf& v) {
+	float d = u[0] * v[0] + u[1] * v[1];
+	return d + u[2] * v[2];
+}
+
+inline Vectorf cross(const Vectorf& u, const Vectorf& v) {
+	return Vectorf(u[1] * v[2] - u[2] * v[1],
+	               u[2] * v[0] - u[0] * v[2],
+	               u[0] * v[1] - u[1] * v[0]);
+}
+
+inline Vectorf normalize(const Vectorf& v) {
+	Vectorf t(v);
+	t.normalize();
+	return t;
+}
+
+#endif
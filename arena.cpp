@@ -0,0 +1,86 @@
+/*  =================== File Information =================
+        File Name: arena.cpp
+        Description: Bump allocator for the storage of one mesh
+        Author:
+        ===================================================== */
+#include "arena.h"
+#include <stdlib.h>
+
+// a block more than this many times the reserve is given back
+#define ARENA_SHRINK_FACTOR 4
+
+std::atomic<long> MeshArena::blocks(0);
+std::atomic<size_t> MeshArena::live(0);
+
+MeshArena::MeshArena(){
+	base = NULL;
+	size = 0;
+	offset = 0;
+	overflowUsed = 0;
+}
+
+MeshArena::~MeshArena(){
+	release();
+}
+
+char* MeshArena::newBlock(size_t bytes){
+	void* block;
+	if (posix_memalign(&block, ARENA_ALIGN, bytes) != 0) return NULL;
+	blocks++;
+	live += bytes;
+	return (char*)block;
+}
+
+void MeshArena::freeBlock(char* block, size_t bytes){
+	if (block == NULL) return;
+	free(block);
+	live -= bytes;
+}
+
+void MeshArena::release(){
+	for (size_t i = 0; i < overflow.size(); i++) {
+		freeBlock(overflow[i].block, overflow[i].size);
+	}
+	overflow.clear();
+	overflowUsed = 0;
+	freeBlock(base, size);
+	base = NULL;
+	size = 0;
+	offset = 0;
+}
+
+void MeshArena::reserve(size_t bytes){
+	// the last generation did not fit: size this one for all of it
+	size_t needed = used();
+	if (!overflow.empty() && needed > bytes) bytes = needed;
+	bytes = bytesFor<char>(bytes);
+
+	for (size_t i = 0; i < overflow.size(); i++) {
+		freeBlock(overflow[i].block, overflow[i].size);
+	}
+	overflow.clear();
+	overflowUsed = 0;
+	offset = 0;
+
+	if (base != NULL && size >= bytes && size / ARENA_SHRINK_FACTOR <= bytes) return;
+	freeBlock(base, size);
+	size = 0;
+	base = bytes > 0 ? newBlock(bytes) : NULL;
+	if (base != NULL) size = bytes;
+}
+
+void* MeshArena::allocateBytes(size_t bytes){
+	if (base != NULL && size - offset >= bytes) {
+		void* p = base + offset;
+		offset += bytes;
+		return p;
+	}
+	// zero sized blocks are not portable, keep at least one line
+	Overflow extra;
+	extra.size = bytes > 0 ? bytes : ARENA_ALIGN;
+	extra.block = newBlock(extra.size);
+	if (extra.block == NULL) return NULL;
+	overflow.push_back(extra);
+	overflowUsed += extra.size;
+	return extra.block;
+}
@@ -0,0 +1,96 @@
+/*  =================== File Information =================
+        File Name: arena.h
+        Description: Bump allocator for the storage of one mesh
+        Author:
+
+        Purpose: Everything a loaded mesh owns (vertices, faces, edges,
+                 adjacency, the pick grid and the normal tables) is
+                 carved out of one arena, so loading a new mesh is a
+                 single reserve and dropping the old one is a single
+                 release, however many arrays the mesh has.
+
+                 reserve starts a new generation: every pointer handed
+                 out before it is invalid afterwards.  The block is
+                 reused when it is big enough (and not far too big), so
+                 reloading the same file makes no system allocation at
+                 all.  If a generation outgrows its block, the extra
+                 requests get blocks of their own and the next reserve
+                 folds them back into one block of the size that was
+                 actually needed.
+
+                 The counters cover every arena in the process, so a
+                 caller can check that repeated reloads reach a steady
+                 state instead of growing.
+        ===================================================== */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+
+// every allocation starts on a cache line
+#define ARENA_ALIGN 64
+
+class MeshArena{
+
+public:
+	MeshArena();
+	~MeshArena();
+
+	// bytes allocate<T>(count) takes out of the arena, padding included,
+	// for adding up what to reserve
+	template <typename T>
+	static size_t bytesFor(size_t count) {
+		return (count * sizeof(T) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	}
+
+	/*  ===============================================
+	      Desc: Starts a new generation with room for at least bytes
+	      Postcondition: nothing allocated before is valid any more;
+	            at most one block is held
+	    =============================================== */
+	void reserve(size_t bytes);
+	// Frees every block
+	void release();
+
+	/*  ===============================================
+	      Desc: count uninitialized Ts, 64 byte aligned
+	      Returns: NULL only if the system is out of memory
+	    =============================================== */
+	template <typename T>
+	T* allocate(size_t count) {
+		return (T*)allocateBytes(bytesFor<T>(count));
+	}
+
+	// bytes handed out in this generation, and held in blocks
+	size_t used() const { return offset + overflowUsed; }
+	size_t capacity() const { return size + overflowUsed; }
+
+	// Blocks ever obtained from the system by any arena
+	static long blockCount() { return blocks; }
+	// Bytes currently held in blocks by all arenas
+	static size_t liveBytes() { return live; }
+
+private:
+	// not copyable, the blocks have exactly one owner
+	MeshArena(const MeshArena&);
+	MeshArena& operator=(const MeshArena&);
+
+	void* allocateBytes(size_t bytes);
+	static char* newBlock(size_t bytes);
+	static void freeBlock(char* block, size_t bytes);
+
+	char* base;
+	size_t size;
+	size_t offset;
+	// blocks of the requests that did not fit, one each
+	struct Overflow { char* block; size_t size; };
+	std::vector<Overflow> overflow;
+	size_t overflowUsed;
+
+	static std::atomic<long> blocks;
+	static std::atomic<size_t> live;
+};
+
+#endif
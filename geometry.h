@@ -1,42 +1,252 @@
 #ifndef GEOMETRY_H
 #define GEOMETRY_H
 
-#include "Algebra.h"
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include "AlgebraF.h"
+#include "arena.h"
+#include "pick.h"
+#include "grid.h"
 
 /*  ============== Vertex ==============
-	Purpose: Stores properties of each vertex
-	Use: Used in face structure
+	Purpose: Stores properties of a single vertex
+	Use: Used for one-off points such as the mesh center; the mesh
+	itself keeps its vertices in a VertexStore
 	==================================== */  
 
 class vertex{
 public:
 	float x,y,z;		// position in 3D space
     float centerLen;
-    Vector velocity;
+    Vectorf velocity;
 	float confidence;
 	float intensity;
 	float r,g,b;		// Color values
 };
-class face{
+
+/*  ============== VertexStore ==============
+	Purpose: Stores every vertex of the mesh as a structure of arrays
+	Use: Each property is its own array, indexed by vertex number, so
+	the per-frame loops (picking, integration, centering) only stream
+	the few arrays they touch and can be vectorized.  All arrays come
+	from one allocation in the mesh's arena and each starts on a 64
+	byte boundary; the arena owns the memory.
+	==================================== */
+class VertexStore{
 public:
-	int vertexCount;  // assuming 3 for this
-	int* vertexList;  // assuming this has size 3
-  
-        //normal vector
-        float normX, normY, normZ;
-        //dot of normal and look
-        float dotProd;
-
-        // Default constructor
-	face(){
-		vertexCount = 0;
+	int count;
+	float *px, *py, *pz;	// position in 3D space
+	float *vx, *vy, *vz;	// velocity
+	float *fx, *fy, *fz;	// force accumulated by the spring solver
+	float *centerLen;		// rest distance to the mesh center
+	float *confidence;
+	float *intensity;
+	float *r, *g, *b;		// Color values
+	float *nx, *ny, *nz;	// smooth normal, kept by ply when enabled
+
+	VertexStore() {
+		clear();
+	}
+
+	// arena bytes allocate takes for vertexCount vertices
+	static size_t bytesFor(int vertexCount) {
+		return MeshArena::bytesFor<float>(arrayStride(vertexCount) * arrayCount);
+	}
+
+	// allocates zeroed arrays for vertexCount vertices from arena
+	void allocate(int vertexCount, MeshArena& arena) {
+		release();
+		size_t stride = arrayStride(vertexCount);
+		float* block = arena.allocate<float>(stride * arrayCount);
+		if (block == NULL) return;
+		memset(block, 0, stride * arrayCount * sizeof(float));
+		float *arrays[arrayCount];
+		for (int k = 0; k < arrayCount; k++) {
+			arrays[k] = block + k * stride;
+		}
+		px = arrays[0];  py = arrays[1];  pz = arrays[2];
+		vx = arrays[3];  vy = arrays[4];  vz = arrays[5];
+		fx = arrays[6];  fy = arrays[7];  fz = arrays[8];
+		centerLen = arrays[9];
+		confidence = arrays[10];
+		intensity = arrays[11];
+		r = arrays[12];  g = arrays[13];  b = arrays[14];
+		nx = arrays[15]; ny = arrays[16]; nz = arrays[17];
+		count = vertexCount;
 	}
 
+	// forgets the arrays, the arena frees them
+	void release() {
+		clear();
+	}
+
+	Pointf position(int i) const { return Pointf(px[i], py[i], pz[i]); }
+	void setPosition(int i, float x, float y, float z) { px[i] = x; py[i] = y; pz[i] = z; }
+	void move(int i, float dx, float dy, float dz) { px[i] += dx; py[i] += dy; pz[i] += dz; }
+	Vectorf velocity(int i) const { return Vectorf(vx[i], vy[i], vz[i]); }
+	void setVelocity(int i, const Vectorf &v) { vx[i] = v[0]; vy[i] = v[1]; vz[i] = v[2]; }
+
+	// copies vertex i out into a single record
+	vertex get(int i) const {
+		vertex v;
+		v.x = px[i]; v.y = py[i]; v.z = pz[i];
+		v.centerLen = centerLen[i];
+		v.velocity = velocity(i);
+		v.confidence = confidence[i];
+		v.intensity = intensity[i];
+		v.r = r[i]; v.g = g[i]; v.b = b[i];
+		return v;
+	}
+
+private:
+	static const int arrayCount = 18;
+
+	// every array rounded up to a whole number of 64 byte lines
+	static size_t arrayStride(int vertexCount) {
+		return ((size_t)vertexCount + 15) & ~(size_t)15;
+	}
+
+	void clear() {
+		count = 0;
+		px = py = pz = NULL;
+		vx = vy = vz = NULL;
+		fx = fy = fz = NULL;
+		centerLen = confidence = intensity = NULL;
+		r = g = b = NULL;
+		nx = ny = nz = NULL;
+	}
+
+	// not copyable, the arrays have exactly one owner
+	VertexStore(const VertexStore&);
+	VertexStore& operator=(const VertexStore&);
 };
+
+/*  ============== FaceList ==============
+	Purpose: Stores every face of the mesh in flat arrays
+	Use: The vertex indices of all faces are packed back to back in
+	indices.  While every face is a triangle, face i starts at 3 * i and
+	offsets stays NULL; as soon as a polygon is added, offsets (count + 1
+	entries) gives where each face starts.  The per-face normal is kept
+	in parallel arrays.  The arrays come from the mesh's arena, which
+	owns the memory.
+	==================================== */
+class FaceList{
+public:
+	int count;          // number of faces
+	int indexCount;     // number of indices in use
+	int* indices;
+	int* offsets;       // NULL while all faces are triangles
+
+	//normal vector of each face
+	float *normX, *normY, *normZ;
+
+	FaceList() {
+		arena = NULL;
+		release();
+	}
+
+	// first index and number of vertices of face i
+	int start(int i) const { return offsets ? offsets[i] : 3 * i; }
+	int size(int i) const { return offsets ? offsets[i + 1] - offsets[i] : 3; }
+	const int* vertices(int i) const { return indices + start(i); }
+
+	// arena bytes allocate takes for faceCount triangles; polygons
+	// take more, from the arena as they are added
+	static size_t bytesFor(int faceCount) {
+		return MeshArena::bytesFor<int>(3 * (size_t)faceCount)
+			+ 3 * MeshArena::bytesFor<float>(faceCount);
+	}
+
+	// makes room for faceCount faces from _arena, assuming triangles
+	void allocate(int faceCount, MeshArena& _arena) {
+		release();
+		arena = &_arena;
+		count = faceCount;
+		capacity = 3 * faceCount;
+		indices = arena->allocate<int>(capacity);
+		normX = arena->allocate<float>(faceCount);
+		normY = arena->allocate<float>(faceCount);
+		normZ = arena->allocate<float>(faceCount);
+	}
+
+	// Uses finished arrays kept elsewhere (a mapped mesh cache) that
+	// live as long as the mesh; no faces can be added afterwards
+	void attach(int faceCount, int _indexCount, int* _indices, int* _offsets,
+	            float* _normX, float* _normY, float* _normZ) {
+		release();
+		arena = NULL;
+		count = faceCount;
+		indexCount = _indexCount;
+		capacity = _indexCount;
+		indices = _indices;
+		offsets = _offsets;
+		normX = _normX;
+		normY = _normY;
+		normZ = _normZ;
+	}
+
+	// Appends face i (faces are added in order) with n vertices and
+	// returns where its n indices should be written
+	int* addFace(int i, int n) {
+		if (offsets == NULL && n == 3) {
+			indexCount = 3 * i + 3;
+			return indices + 3 * i;
+		}
+		if (offsets == NULL) {
+			// first polygon: switch to explicit offsets
+			offsets = arena->allocate<int>(count + 1);
+			for (int j = 0; j <= i; j++) {
+				offsets[j] = 3 * j;
+			}
+		}
+		if (indexCount + n > capacity) {
+			grow(indexCount + n);
+		}
+		offsets[i] = indexCount;
+		indexCount += n;
+		offsets[i + 1] = indexCount;
+		return indices + offsets[i];
+	}
+
+	// forgets the arrays, the arena frees them
+	void release() {
+		indices = NULL;
+		offsets = NULL;
+		normX = normY = normZ = NULL;
+		count = 0;
+		indexCount = 0;
+		capacity = 0;
+	}
+
+private:
+	int capacity;
+	MeshArena* arena;
+
+	// the outgrown array stays in the arena until the next reload
+	void grow(int needed) {
+		int newCapacity = capacity * 2 > needed ? capacity * 2 : needed;
+		int* bigger = arena->allocate<int>(newCapacity);
+		for (int j = 0; j < indexCount; j++) {
+			bigger[j] = indices[j];
+		}
+		indices = bigger;
+		capacity = newCapacity;
+	}
+
+	// not copyable, the arrays have exactly one owner
+	FaceList(const FaceList&);
+	FaceList& operator=(const FaceList&);
+};
+
 class edge{
 public:
         int vertices[2];
         int faces[2];
+        //number of faces sharing this edge:
+        //1 is a boundary edge, more than 2 is non-manifold
+        int faceCount;
         float len;
 
         //default constructor
@@ -46,109 +256,291 @@ public:
 			vertices[1] = -1;
             faces[0] = -1;
             faces[1] = -1;
+            faceCount = 0;
         }
 };
 
-struct VertexNode {
+/*  ============== VertexGraph ==============
+	Purpose: Vertex adjacency in compressed sparse row (CSR) form
+	Use: The neighbors of vertex v are neighbors[neighborStart[v]] up to
+	neighbors[neighborStart[v + 1]], and neighborEdges holds the index into
+	edgeList of the edge behind each of those slots.  Both arrays are built
+	from edgeList and live in one contiguous block each, in the mesh's
+	arena together with the pick grid.
+	==================================== */
+class VertexGraph{
+private:
+    int nodeCount;
+    int *neighborStart;  // nodeCount + 1 offsets into neighbors
+    int *neighbors;      // 2 * edgeCount vertex indices
+    int *neighborEdges;  // edge index for every neighbor slot
+    int *hitBuffer;      // output of pickVerts, room for every vertex
+    int *frontier;       // BFS queue of deform, room for every vertex
+    int *origin;         // the source each frontier slot was reached from
+    unsigned *visited;   // epoch of the last deform that reached a vertex
+    unsigned epoch;
+    int reached;         // vertices moved by the last deform, first in frontier
+    VertexStore *vertexList;
+    VertexGrid grid;     // spatial index used by pickVerts
 
-    VertexNode() {
-        nextNodes.reserve(10);
+    void allocateBuffers(MeshArena &arena) {
+        hitBuffer = arena.allocate<int>(nodeCount);
+        frontier = arena.allocate<int>(nodeCount);
+        origin = arena.allocate<int>(nodeCount);
+        visited = arena.allocate<unsigned>(nodeCount);
+        epoch = 0;
     };
+    // deform, with the force of source s at forces[s * forceStride];
+    // with a stride the forces of a repeated source are summed
+    void spread(const int *sources, Vectorf *forces, int forceStride,
+                int sourceCount, int maxDepth) {
+        reached = 0;
+        if (nodeCount == 0) return;
+        // a new epoch unmarks every vertex without touching them
+        if (++epoch == 0) {
+            memset(visited, 0, nodeCount * sizeof(unsigned));
+            epoch = 1;
+        }
+        // hitBuffer holds the frontier slot of every source, so the
+        // force of a repeat is added to its first listing
+        int tail = 0;
+        for (int i = 0; i < sourceCount; i++) {
+            int v = sources[i] % nodeCount;
+            if (visited[v] != epoch) {
+                visited[v] = epoch;
+                if (forceStride) hitBuffer[v] = tail;
+                origin[tail] = i * forceStride;
+                frontier[tail++] = v;
+            } else if (forceStride) {
+                Vectorf &first = forces[origin[hitBuffer[v]]];
+                first = first + forces[i];
+            }
+        }
 
-    int vertex;
-    std::vector<VertexNode *> nextNodes;
-    bool marked;
-    void addNext(VertexNode *v) {
-        nextNodes.push_back(v);
+        int head = 0;
+        float scale = 1;
+        for (int d = 0; d <= maxDepth && head < tail; d++) {
+            int ringEnd = tail;
+            for (; head < ringEnd; head++) {
+                int v = frontier[head];
+                const Vectorf &force = forces[origin[head]];
+                vertexList->move(v, force[0] * scale, force[1] * scale, force[2] * scale);
+                grid.update(v);
+                if (d == maxDepth) continue;
+                for (int k = neighborStart[v]; k < neighborStart[v + 1]; k++) {
+                    int n = neighbors[k];
+                    if (visited[n] != epoch) {
+                        visited[n] = epoch;
+                        origin[tail] = origin[head];
+                        frontier[tail++] = n;
+                    }
+                }
+            }
+            scale = scale / 2;
+        }
+        reached = tail;
+    };
+    void buildGrid(const edge *edgeList, int edgeCount, MeshArena &arena) {
+        // cells about eight edges wide keep both the number of cells a
+        // projectile overlaps and the vertices per cell small
+        double totalLen = 0;
+        for (int i = 0; i < edgeCount; i++) {
+            totalLen += edgeList[i].len;
+        }
+        float cellSize = edgeCount > 0 ? 8 * totalLen / edgeCount : 1;
+        grid.build(vertexList, cellSize, arena);
     };
-};
 
-class VertexGraph{
-private:
-    VertexNode *nodes;
-    int nodeCount;
-    vertex *vertexList;
+    // forgets the arrays, the arena frees them
+    void release() {
+        neighborStart = NULL;
+        neighbors = NULL;
+        neighborEdges = NULL;
+        hitBuffer = NULL;
+        frontier = NULL;
+        origin = NULL;
+        visited = NULL;
+        nodeCount = 0;
+        reached = 0;
+    };
 public:
-    void construct(vertex *vertexList, edge *edgeList, int vertexCount, int edgeCount) {
-        nodes = new VertexNode[vertexCount];
+    VertexGraph() {
+        nodeCount = 0;
+        neighborStart = NULL;
+        neighbors = NULL;
+        neighborEdges = NULL;
+        hitBuffer = NULL;
+        frontier = NULL;
+        origin = NULL;
+        visited = NULL;
+        epoch = 0;
+        reached = 0;
+        vertexList = NULL;
+    };
+
+    // arena bytes attach takes: the query buffers and the grid
+    static size_t attachBytesFor(int vertexCount) {
+        return 3 * MeshArena::bytesFor<int>(vertexCount)
+            + MeshArena::bytesFor<unsigned>(vertexCount)
+            + VertexGrid::bytesFor(vertexCount);
+    };
+    // arena bytes construct takes, grid included
+    static size_t bytesFor(int vertexCount, int edgeCount) {
+        return MeshArena::bytesFor<int>(vertexCount + 1)
+            + 2 * MeshArena::bytesFor<int>(2 * (size_t)edgeCount)
+            + attachBytesFor(vertexCount);
+    };
+
+    void construct(VertexStore *vertexList, edge *edgeList, int vertexCount, int edgeCount,
+                   MeshArena &arena) {
+        release();
         nodeCount = vertexCount;
         this->vertexList = vertexList;
+        neighborStart = arena.allocate<int>(vertexCount + 1);
+        neighbors = arena.allocate<int>(2 * (size_t)edgeCount);
+        neighborEdges = arena.allocate<int>(2 * (size_t)edgeCount);
+        allocateBuffers(arena);
+
+        // count the degree of every vertex, then turn the counts into offsets
+        for (int i = 0; i <= vertexCount; i++) {
+            neighborStart[i] = 0;
+        }
+        for (int i = 0; i < edgeCount; i++) {
+            neighborStart[edgeList[i].vertices[0] + 1]++;
+            neighborStart[edgeList[i].vertices[1] + 1]++;
+        }
         for (int i = 0; i < vertexCount; i++) {
-            nodes[i].vertex = i;
-            nodes[i].marked = false;
+            neighborStart[i + 1] += neighborStart[i];
+            visited[i] = 0;
         }
-        std::cerr << "Start constructing " << edgeCount << std::endl;
 
+        // scatter both directions of every edge into its slot, with
+        // hitBuffer as the fill pointer of every vertex
+        int *slot = hitBuffer;
+        memcpy(slot, neighborStart, vertexCount * sizeof(int));
         for (int i = 0; i < edgeCount; i++) {
             int v1 = edgeList[i].vertices[0];
             int v2 = edgeList[i].vertices[1];
 
-            nodes[v1].addNext(&nodes[v2]);
-            nodes[v2].addNext(&nodes[v1]);
-
-        }
-        std::cerr << "Done constructing" << std::endl;
-
-    };
-    void deform(int source, Vector force, int depth) {
-        source = source % nodeCount;
-        if (depth > 0 || !nodes[source].marked) {
-            nodes[source].marked = true;
-            vertexList[source].x += force[0];
-            vertexList[source].y += force[1];
-            vertexList[source].z += force[2];
-            for (auto &node : nodes[source].nextNodes) {
-                deform(node->vertex, force / 2, depth-1);
-            }
+            neighbors[slot[v1]] = v2;
+            neighborEdges[slot[v1]++] = i;
+            neighbors[slot[v2]] = v1;
+            neighborEdges[slot[v2]++] = i;
         }
+
+        buildGrid(edgeList, edgeCount, arena);
+    };
+
+    /*  ===============================================
+          Desc: Takes the adjacency arrays and grid of an earlier
+                construct over the same mesh (from a mapped mesh
+                cache) instead of building them again
+          Precondition: the adjacency arrays live as long as the
+                graph; the grid's are copied
+        =============================================== */
+    void attach(VertexStore *vertexList, int vertexCount,
+                int *_neighborStart, int *_neighbors, int *_neighborEdges,
+                const VertexGridArrays &savedGrid, MeshArena &arena) {
+        release();
+        nodeCount = vertexCount;
+        this->vertexList = vertexList;
+        neighborStart = _neighborStart;
+        neighbors = _neighbors;
+        neighborEdges = _neighborEdges;
+        allocateBuffers(arena);
+        memset(visited, 0, vertexCount * sizeof(unsigned));
+        grid.restore(vertexList, savedGrid, arena);
+    };
+
+    // the adjacency arrays and grid, for saving them with the mesh
+    const int* neighborOffsets() const { return neighborStart; };
+    const int* neighborArray() const { return neighbors; };
+    const int* neighborEdgeArray() const { return neighborEdges; };
+    const VertexGrid& getGrid() const { return grid; };
+
+    // call after moving vertices without going through deform
+    void refit() {
+        grid.refit();
+    };
+
+    int size() const { return nodeCount; };
+    // neighbor slots of v are [firstNeighbor(v), lastNeighbor(v))
+    int firstNeighbor(int v) const { return neighborStart[v]; };
+    int lastNeighbor(int v) const { return neighborStart[v + 1]; };
+    int neighbor(int slot) const { return neighbors[slot]; };
+    int neighborEdge(int slot) const { return neighborEdges[slot]; };
+
+    // bytes held by the adjacency arrays
+    size_t memoryBytes() const {
+        if (nodeCount == 0) return 0;
+        return sizeof(int) * (nodeCount + 1)
+            + 2 * sizeof(int) * neighborStart[nodeCount]
+            + sizeof(unsigned) * nodeCount;
     };
 
+    /*  ===============================================
+          Desc: Pushes the mesh away from a set of vertices, each with
+                its own force.  A breadth first search from all sources
+                at once moves every vertex within maxDepth edges of them
+                exactly once, by forces[s] / 2^d where s is the nearest
+                source and d its edge distance to it; of sources equally
+                near, the one listed first wins.  A vertex listed more
+                than once moves by the sum of its forces, which are
+                added into its first listing.
+          Precondition: construct has been called; sources is not
+                hits(), which this overwrites
+          Postcondition: the moved vertices are filed again in the grid
+                and listed in deformed(); the cost is linear in the
+                number of sources and vertices reached
+        =============================================== */
+    void deform(const int *sources, Vectorf *forces, int sourceCount, int maxDepth) {
+        spread(sources, forces, 1, sourceCount, maxDepth);
+    };
+    // The same with one force for every source
+    void deform(const int *sources, int sourceCount, Vectorf force, int maxDepth) {
+        spread(sources, &force, 0, sourceCount, maxDepth);
+    };
+    void deform(int source, Vectorf force, int maxDepth) {
+        deform(&source, 1, force, maxDepth);
+    };
+    // the vertices moved by the last deform, deformedCount() of them
+    const int* deformed() const { return frontier; };
+    int deformedCount() const { return reached; };
+
     int pickVert(float x, float y) {
         float minDist = 1;
         int index = -1;
         for (int i = 0; i < nodeCount; i++) {
-            Point p(x, y, 0);
-            Point vp(vertexList[i].x, vertexList[i].y, vertexList[i].z);
-            Vector v = vp - p;
+            Pointf p(x, y, 0);
+            Pointf vp = vertexList->position(i);
+            Vectorf v = vp - p;
             if (v.length() < minDist) {
                 minDist = v.length();
                 index = i;
             }
-            nodes[i].marked = false;
         }
         return index;
     };
-    std::vector<int> pickVerts(Point p, float radius) { //return all vertices within radius of p
-        std::vector<int> verts;
-        for (int i = 0; i < nodeCount; i++) {
-            Point vp(vertexList[i].x, vertexList[i].y, vertexList[i].z);
-            Vector v = vp - p;
-            if (v.length() < radius) {
-                verts.push_back(i);
-            }
-            nodes[i].marked = false;
-        }
-        return verts;
+    // Finds every vertex within radius of p.  The hits are left in
+    // hits() in ascending order; returns how many there are.
+    // Small queries go through the grid, large ones scan every vertex.
+    int pickVerts(const Pointf& p, float radius) {
+        int n = grid.querySphere(p[0], p[1], p[2], radius, hitBuffer);
+        if (n >= 0) return n;
+        return pickSphere(vertexList->px, vertexList->py, vertexList->pz, nodeCount,
+                          p[0], p[1], p[2], radius * radius, hitBuffer);
     };
-    std::vector<int> pickVerts(Point p1, Point p2) { //return all vertices within radius of p
-        std::vector<int> verts;
-        for (int i = 0; i < nodeCount; i++) {
-            Point vp(vertexList[i].x, vertexList[i].y, vertexList[i].z);
-            if (vp > p1 && vp < p2) {
-                verts.push_back(i);
-            }
-            nodes[i].marked = false;
-        }
-        return verts;
+    // Finds every vertex strictly inside the box p1 - p2, like above
+    int pickVerts(const Pointf& p1, const Pointf& p2) {
+        int n = grid.queryBox(p1[0], p1[1], p1[2], p2[0], p2[1], p2[2], hitBuffer);
+        if (n >= 0) return n;
+        return pickBox(vertexList->px, vertexList->py, vertexList->pz, nodeCount,
+                       p1[0], p1[1], p1[2], p2[0], p2[1], p2[2], hitBuffer);
     };
+    // the vertices found by the last pickVerts call
+    const int* hits() const { return hitBuffer; };
 };
 
-/*  ============== Face ==============
-Purpose: Store list of vertices that make up a polygon.
-In modern versions of OpenGL this value will always be 3(a triangle)
-Use: Used in Shape data structure.
-==================================== */  
-
 /* Edge: Connects two vertices, and two faces. 
 */
 
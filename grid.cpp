@@ -0,0 +1,353 @@
+/*  =================== File Information =================
+        File Name: grid.cpp
+        Description: Uniform hash grid over the vertex positions
+        Author:
+        ===================================================== */
+#include "grid.h"
+#include "geometry.h"
+#include "arena.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+// The tests below have to round exactly like the pick.h kernels.
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+// cell coordinates are clamped to 21 bits each so they pack into a key
+#define GRID_COORD_LIMIT ((1 << 20) - 1)
+
+// slot key of a vertex that moved to the overflow; real keys use 63 bits
+#define GRID_STALE (~(uint64_t)0)
+
+// what cellRange found: no vertex can be in the box, the cells to
+// walk, or too many cells to be worth walking
+#define GRID_EMPTY 0
+#define GRID_CELLS 1
+#define GRID_SCAN  2
+
+VertexGrid::VertexGrid(){
+	store = NULL;
+	vertexCount = 0;
+	cellSize = 1;
+	invCellSize = 1;
+	bucketBits = 0;
+	bucketStart = NULL;
+	order = NULL;
+	slotKey = NULL;
+	sx = sy = sz = NULL;
+	slot = NULL;
+	moved = NULL;
+	movedCount = 0;
+	scratch = NULL;
+}
+
+// at least as many buckets as vertices, as a power of two
+static int bucketBitsFor(int vertexCount){
+	int bits = 4;
+	while ((1 << bits) < vertexCount) bits++;
+	return bits;
+}
+
+int VertexGrid::bucketCountFor(int vertexCount){
+	return 1 << bucketBitsFor(vertexCount);
+}
+
+size_t VertexGrid::bytesFor(int vertexCount){
+	return MeshArena::bytesFor<int>(bucketCountFor(vertexCount) + 1)
+		+ MeshArena::bytesFor<uint64_t>(vertexCount)
+		+ 3 * MeshArena::bytesFor<float>(vertexCount)
+		+ 4 * MeshArena::bytesFor<int>(vertexCount);
+}
+
+// forgets the arrays, the arena frees them
+void VertexGrid::release(){
+	bucketStart = NULL;
+	order = NULL;
+	slotKey = NULL;
+	sx = sy = sz = NULL;
+	slot = NULL;
+	moved = NULL;
+	scratch = NULL;
+	movedCount = 0;
+	vertexCount = 0;
+	bucketBits = 0;
+}
+
+void VertexGrid::build(const VertexStore* _store, float _cellSize, MeshArena& arena){
+	allocate(_store, _cellSize, arena);
+	refit();
+}
+
+void VertexGrid::restore(const VertexStore* _store, const VertexGridArrays& saved, MeshArena& arena){
+	allocate(_store, saved.cellSize, arena);
+	memcpy(bucketStart, saved.bucketStart, ((1 << bucketBits) + 1) * sizeof(int));
+	memcpy(order, saved.order, vertexCount * sizeof(int));
+	memcpy(slotKey, saved.slotKey, vertexCount * sizeof(uint64_t));
+	memcpy(sx, saved.sx, vertexCount * sizeof(float));
+	memcpy(sy, saved.sy, vertexCount * sizeof(float));
+	memcpy(sz, saved.sz, vertexCount * sizeof(float));
+	memcpy(slot, saved.slot, vertexCount * sizeof(int));
+	movedCount = 0;
+	findBounds();
+}
+
+VertexGridArrays VertexGrid::arrays() const{
+	VertexGridArrays saved;
+	saved.cellSize = cellSize;
+	saved.bucketStart = bucketStart;
+	saved.order = order;
+	saved.slotKey = slotKey;
+	saved.sx = sx;
+	saved.sy = sy;
+	saved.sz = sz;
+	saved.slot = slot;
+	return saved;
+}
+
+void VertexGrid::allocate(const VertexStore* _store, float _cellSize, MeshArena& arena){
+	release();
+	store = _store;
+	vertexCount = store->count;
+	cellSize = _cellSize > 0 ? _cellSize : 1;
+	invCellSize = 1 / cellSize;
+	bucketBits = bucketBitsFor(vertexCount);
+
+	bucketStart = arena.allocate<int>((1 << bucketBits) + 1);
+	order   = arena.allocate<int>(vertexCount);
+	slotKey = arena.allocate<uint64_t>(vertexCount);
+	sx      = arena.allocate<float>(vertexCount);
+	sy      = arena.allocate<float>(vertexCount);
+	sz      = arena.allocate<float>(vertexCount);
+	slot    = arena.allocate<int>(vertexCount);
+	moved   = arena.allocate<int>(vertexCount);
+	scratch = arena.allocate<int>(vertexCount);
+}
+
+int VertexGrid::cellCoord(float p) const{
+	float c = floorf(p * invCellSize);
+	// NaN lands in cell 0, far away points in the outermost cell
+	if (!(c == c)) return 0;
+	if (c > GRID_COORD_LIMIT) return GRID_COORD_LIMIT;
+	if (c < -GRID_COORD_LIMIT) return -GRID_COORD_LIMIT;
+	return (int)c;
+}
+
+uint64_t VertexGrid::cellKey(int x, int y, int z) const{
+	const uint64_t mask = (1 << 21) - 1;
+	return (((uint64_t)x & mask) << 42) | (((uint64_t)y & mask) << 21) | ((uint64_t)z & mask);
+}
+
+uint64_t VertexGrid::vertexKey(int v) const{
+	return cellKey(cellCoord(store->px[v]), cellCoord(store->py[v]), cellCoord(store->pz[v]));
+}
+
+int VertexGrid::bucketOf(uint64_t k) const{
+	// Fibonacci hashing spreads neighboring cells over the table
+	return (int)((k * 0x9E3779B97F4A7C15ull) >> (64 - bucketBits));
+}
+
+void VertexGrid::refit(){
+	int bucketCount = 1 << bucketBits;
+	std::fill(bucketStart, bucketStart + bucketCount + 1, 0);
+	for (int v = 0; v < vertexCount; v++) {
+		scratch[v] = bucketOf(vertexKey(v));
+		bucketStart[scratch[v] + 1]++;
+	}
+	for (int b = 0; b < bucketCount; b++) {
+		bucketStart[b + 1] += bucketStart[b];
+	}
+
+	// stable scatter, so every bucket lists its vertices in index order;
+	// it leaves bucketStart[b] at the end of bucket b
+	for (int v = 0; v < vertexCount; v++) {
+		int s = bucketStart[scratch[v]]++;
+		order[s] = v;
+		slotKey[s] = vertexKey(v);
+		sx[s] = store->px[v];
+		sy[s] = store->py[v];
+		sz[s] = store->pz[v];
+		slot[v] = s;
+	}
+	for (int b = bucketCount; b > 0; b--) {
+		bucketStart[b] = bucketStart[b - 1];
+	}
+	bucketStart[0] = 0;
+	movedCount = 0;
+	findBounds();
+}
+
+void VertexGrid::findBounds(){
+	for (int a = 0; a < 3; a++) {
+		cellMin[a] = GRID_COORD_LIMIT;
+		cellMax[a] = -GRID_COORD_LIMIT;
+	}
+	for (int v = 0; v < vertexCount; v++) {
+		growBounds(v);
+	}
+}
+
+void VertexGrid::growBounds(int v){
+	int c[3] = { cellCoord(store->px[v]), cellCoord(store->py[v]), cellCoord(store->pz[v]) };
+	for (int a = 0; a < 3; a++) {
+		if (c[a] < cellMin[a]) cellMin[a] = c[a];
+		if (c[a] > cellMax[a]) cellMax[a] = c[a];
+	}
+}
+
+void VertexGrid::update(int v){
+	int s = slot[v];
+	// overflow vertices are always tested at their live position,
+	// which the bounds have to keep covering
+	if (s < 0) {
+		growBounds(v);
+		return;
+	}
+	if (vertexKey(v) == slotKey[s]) {
+		sx[s] = store->px[v];
+		sy[s] = store->py[v];
+		sz[s] = store->pz[v];
+		return;
+	}
+	slotKey[s] = GRID_STALE;
+	slot[v] = -1;
+	moved[movedCount++] = v;
+	growBounds(v);
+
+	// every query scans the overflow, so fold it back once it gets long
+	if (movedCount > 256 + vertexCount / 64) refit();
+}
+
+void VertexGrid::sortHits(int* hits, int n){
+	if (n < 256) {
+		std::sort(hits, hits + n);
+		return;
+	}
+	// LSD radix sort on 11 bit digits, only as many passes as the
+	// vertex indices need
+	int count[1 << 11];
+	int* src = hits;
+	int* dst = scratch;
+	for (int shift = 0; shift < 31 && (vertexCount - 1) >> shift; shift += 11) {
+		std::fill(count, count + (1 << 11), 0);
+		for (int i = 0; i < n; i++) count[(src[i] >> shift) & 2047]++;
+		int sum = 0;
+		for (int d = 0; d < (1 << 11); d++) {
+			int c = count[d];
+			count[d] = sum;
+			sum += c;
+		}
+		for (int i = 0; i < n; i++) dst[count[(src[i] >> shift) & 2047]++] = src[i];
+		std::swap(src, dst);
+	}
+	if (src != hits) std::copy(src, src + n, hits);
+}
+
+int VertexGrid::cellRange(float minX, float minY, float minZ,
+                          float maxX, float maxY, float maxZ, int range[6]) const{
+	if (vertexCount == 0) return GRID_EMPTY;
+	range[0] = cellCoord(minX); range[1] = cellCoord(maxX);
+	range[2] = cellCoord(minY); range[3] = cellCoord(maxY);
+	range[4] = cellCoord(minZ); range[5] = cellCoord(maxZ);
+	// cells outside the bounds are empty, a flat mesh only spans one
+	// layer of cells along its thin axis
+	for (int a = 0; a < 3; a++) {
+		if (range[2 * a] < cellMin[a]) range[2 * a] = cellMin[a];
+		if (range[2 * a + 1] > cellMax[a]) range[2 * a + 1] = cellMax[a];
+	}
+	if (range[0] > range[1] || range[2] > range[3] || range[4] > range[5]) return GRID_EMPTY;
+
+	// past one cell per bucket, walking cells costs more than scanning
+	double cells = (double)(range[1] - range[0] + 1)
+	             * (range[3] - range[2] + 1) * (range[5] - range[4] + 1);
+	return cells <= (double)(1 << bucketBits) / 4 ? GRID_CELLS : GRID_SCAN;
+}
+
+bool VertexGrid::bounds(float lo[3], float hi[3]) const{
+	if (vertexCount == 0) return false;
+	for (int a = 0; a < 3; a++) {
+		// the outermost cells also hold everything clamped into them
+		lo[a] = cellMin[a] <= -GRID_COORD_LIMIT ? -INFINITY : cellMin[a] * cellSize;
+		hi[a] = cellMax[a] >= GRID_COORD_LIMIT ? INFINITY : (cellMax[a] + 1) * cellSize;
+	}
+	return true;
+}
+
+int VertexGrid::querySphere(float cx, float cy, float cz, float radius, int* hits){
+	// widen the cell range a little so rounding in the distance test
+	// can never accept a vertex from a cell that was not visited
+	float reach = radius + radius * 1e-4f + 1e-6f;
+	int range[6];
+	int cover = cellRange(cx - reach, cy - reach, cz - reach,
+	                      cx + reach, cy + reach, cz + reach, range);
+	if (cover != GRID_CELLS) return cover == GRID_EMPTY ? 0 : -1;
+	float radius2 = radius * radius;
+
+	int n = 0;
+	for (int x = range[0]; x <= range[1]; x++) {
+		for (int y = range[2]; y <= range[3]; y++) {
+			for (int z = range[4]; z <= range[5]; z++) {
+				uint64_t k = cellKey(x, y, z);
+				int b = bucketOf(k);
+				for (int s = bucketStart[b]; s < bucketStart[b + 1]; s++) {
+					// the bucket may also hold other cells
+					if (slotKey[s] != k) continue;
+					float dx = sx[s] - cx;
+					float dy = sy[s] - cy;
+					float dz = sz[s] - cz;
+					float d2 = dx * dx + dy * dy;
+					d2 = d2 + dz * dz;
+					if (d2 < radius2) hits[n++] = order[s];
+				}
+			}
+		}
+	}
+	const float *px = store->px, *py = store->py, *pz = store->pz;
+	for (int i = 0; i < movedCount; i++) {
+		int v = moved[i];
+		float dx = px[v] - cx;
+		float dy = py[v] - cy;
+		float dz = pz[v] - cz;
+		float d2 = dx * dx + dy * dy;
+		d2 = d2 + dz * dz;
+		if (d2 < radius2) hits[n++] = v;
+	}
+	sortHits(hits, n);
+	return n;
+}
+
+int VertexGrid::queryBox(float minX, float minY, float minZ,
+                         float maxX, float maxY, float maxZ, int* hits){
+	int range[6];
+	int cover = cellRange(minX, minY, minZ, maxX, maxY, maxZ, range);
+	if (cover != GRID_CELLS) return cover == GRID_EMPTY ? 0 : -1;
+	int n = 0;
+	for (int x = range[0]; x <= range[1]; x++) {
+		for (int y = range[2]; y <= range[3]; y++) {
+			for (int z = range[4]; z <= range[5]; z++) {
+				uint64_t k = cellKey(x, y, z);
+				int b = bucketOf(k);
+				for (int s = bucketStart[b]; s < bucketStart[b + 1]; s++) {
+					if (slotKey[s] != k) continue;
+					if (sx[s] > minX && sy[s] > minY && sz[s] > minZ &&
+					    sx[s] < maxX && sy[s] < maxY && sz[s] < maxZ) {
+						hits[n++] = order[s];
+					}
+				}
+			}
+		}
+	}
+	const float *px = store->px, *py = store->py, *pz = store->pz;
+	for (int i = 0; i < movedCount; i++) {
+		int v = moved[i];
+		if (px[v] > minX && py[v] > minY && pz[v] > minZ &&
+		    px[v] < maxX && py[v] < maxY && pz[v] < maxZ) {
+			hits[n++] = v;
+		}
+	}
+	sortHits(hits, n);
+	return n;
+}
@@ -0,0 +1,108 @@
+/*  =================== File Information =================
+        File Name: grid.h
+        Description: Uniform hash grid over the vertex positions
+        Author:
+
+        Purpose: Answers the same sphere and box queries as pick.h while
+                 only looking at the vertices in the cells the query
+                 overlaps.  Vertices are counting-sorted by cell bucket
+                 with a copy of their positions, so a cell is one
+                 contiguous run.  A vertex that leaves its cell moves to a
+                 small overflow list that every query also scans; the
+                 list is folded back in by the next rebuild.
+        ===================================================== */
+#ifndef GRID_H
+#define GRID_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class VertexStore;
+class MeshArena;
+
+// The sorted arrays of a grid with nothing in the overflow, as saved
+// with a mesh (see meshcache.h)
+struct VertexGridArrays {
+	float cellSize;
+	const int* bucketStart;   // bucketCountFor(vertexCount) + 1
+	const int* order;
+	const uint64_t* slotKey;
+	const float *sx, *sy, *sz;
+	const int* slot;
+};
+
+class VertexGrid{
+
+public:
+	VertexGrid();
+
+	// arena bytes build takes for vertexCount vertices
+	static size_t bytesFor(int vertexCount);
+	// Puts every vertex of store into cells of the given size; the
+	// arrays come from arena, which owns them
+	void build(const VertexStore* store, float cellSize, MeshArena& arena);
+	// Same as build, but copies the sorted arrays a build over the
+	// same positions made instead of sorting again
+	void restore(const VertexStore* store, const VertexGridArrays& saved, MeshArena& arena);
+	// Arrays for restore; precondition: no vertex is in the overflow
+	VertexGridArrays arrays() const;
+	static int bucketCountFor(int vertexCount);
+	void release();
+
+	// Follows vertex v after it moved, O(1)
+	void update(int v);
+	// Re-sorts every vertex, after the whole mesh moved
+	void refit();
+
+	/*  ===============================================
+	      Desc: Sphere / open box queries with the exact tests used by
+	            pickSphere / pickBox, hits in ascending order
+	      Returns: the number of hits (0 at once for a query outside
+	            the bounds), or -1 when the query spans so many cells
+	            that a linear scan is cheaper (hits untouched)
+	    =============================================== */
+	int querySphere(float cx, float cy, float cz, float radius, int* hits);
+	int queryBox(float minX, float minY, float minZ,
+	             float maxX, float maxY, float maxZ, int* hits);
+
+	float getCellSize() const { return cellSize; }
+	// A box around every vertex, cell aligned; false if there are none
+	bool bounds(float lo[3], float hi[3]) const;
+
+private:
+	// not copyable, the arrays belong to one mesh
+	VertexGrid(const VertexGrid&);
+	VertexGrid& operator=(const VertexGrid&);
+
+	int cellCoord(float p) const;
+	uint64_t cellKey(int x, int y, int z) const;
+	uint64_t vertexKey(int v) const;
+	int bucketOf(uint64_t key) const;
+	void sortHits(int* hits, int n);
+	void growBounds(int v);
+	void allocate(const VertexStore* store, float cellSize, MeshArena& arena);
+	void findBounds();
+	// cell ranges of a query box, clipped to the bounds; GRID_EMPTY,
+	// GRID_CELLS or GRID_SCAN (grid.cpp)
+	int cellRange(float minX, float minY, float minZ,
+	              float maxX, float maxY, float maxZ, int range[6]) const;
+
+	const VertexStore* store;
+	int vertexCount;
+	float cellSize;
+	float invCellSize;
+
+	int bucketBits;
+	int* bucketStart;   // bucketCount + 1 offsets into the sorted arrays
+	int* order;         // sorted slot -> vertex
+	uint64_t* slotKey;  // sorted slot -> cell key, GRID_STALE once moved out
+	float *sx, *sy, *sz;// sorted copy of the positions
+	int* slot;          // vertex -> sorted slot, -1 while in the overflow
+	int* moved;         // overflow: vertices that left their cell
+	int movedCount;
+	int* scratch;       // vertexCount ints for build and sortHits
+	int cellMin[3];     // cell coordinates every vertex lies within,
+	int cellMax[3];     // queries are clipped to them
+};
+
+#endif
@@ -0,0 +1,213 @@
+/*  =================== File Information =================
+        File Name: implicit.cpp
+        Description: Backward Euler step for the mass-spring system
+        Author:
+        ===================================================== */
+#include "implicit.h"
+#include <math.h>
+
+// below this many vertices or edges per chunk threads do not pay off
+#define IMPLICIT_MIN_CHUNK 2048
+
+// out += B * (x, y, z) for a symmetric 3x3 block stored as xx xy xz yy yz zz
+static inline void addBlockProduct(const float* B, float x, float y, float z, float* out) {
+	out[0] += B[0] * x + B[1] * y + B[2] * z;
+	out[1] += B[1] * x + B[3] * y + B[4] * z;
+	out[2] += B[2] * x + B[4] * y + B[5] * z;
+}
+
+ImplicitSolver::ImplicitSolver(){
+	maxIterations = 50;
+	tolerance = 1e-3f;
+	lastIterations = 0;
+	release();
+}
+
+void ImplicitSolver::allocate(int vertexCount, int edgeCount, MeshArena& arena){
+	edgeBlock = arena.allocate<float>(6 * (size_t)edgeCount);
+	dampBlock = arena.allocate<float>(6 * (size_t)vertexCount);
+	float** perVertex[] = { &invDiag, &dv, &r, &z, &p, &Ap };
+	for (int k = 0; k < 6; k++) {
+		*perVertex[k] = arena.allocate<float>(3 * (size_t)vertexCount);
+	}
+}
+
+size_t ImplicitSolver::bytesFor(int vertexCount, int edgeCount){
+	return MeshArena::bytesFor<float>(6 * (size_t)edgeCount)
+		+ MeshArena::bytesFor<float>(6 * (size_t)vertexCount)
+		+ 6 * MeshArena::bytesFor<float>(3 * (size_t)vertexCount);
+}
+
+void ImplicitSolver::release(){
+	edgeBlock = dampBlock = invDiag = NULL;
+	dv = r = z = p = Ap = NULL;
+}
+
+double ImplicitSolver::apply(const VertexGraph& graph, WorkerPool& pool,
+                             const float* x, float* y, float h, float mass){
+	int n = graph.size();
+	float h2 = h * h;
+	partial.assign(pool.chunkCount(n, IMPLICIT_MIN_CHUNK), 0.0);
+	pool.run(n, IMPLICIT_MIN_CHUNK, [&](int chunk, int begin, int end) {
+		double sum = 0;
+		for (int i = begin; i < end; i++) {
+			const float* xi = x + 3 * i;
+			float damped[3] = { 0, 0, 0 };
+			addBlockProduct(&dampBlock[6 * i], xi[0], xi[1], xi[2], damped);
+
+			// h^2 sum K_e (x_i - x_j) over the springs of i
+			float spring[3] = { 0, 0, 0 };
+			for (int k = graph.firstNeighbor(i); k < graph.lastNeighbor(i); k++) {
+				const float* xj = x + 3 * graph.neighbor(k);
+				addBlockProduct(&edgeBlock[6 * graph.neighborEdge(k)],
+				                xi[0] - xj[0], xi[1] - xj[1], xi[2] - xj[2], spring);
+			}
+			for (int a = 0; a < 3; a++) {
+				y[3 * i + a] = mass * xi[a] + h * damped[a] + h2 * spring[a];
+				sum += (double)xi[a] * y[3 * i + a];
+			}
+		}
+		partial[chunk] = sum;
+	});
+	double total = 0;
+	for (size_t c = 0; c < partial.size(); c++) total += partial[c];
+	return total;
+}
+
+int ImplicitSolver::step(VertexStore& store, const edge* edges, int edgeCount,
+                         const VertexGraph& graph, WorkerPool& pool,
+                         float h, float stiffness, float damping, float mass, float gravity){
+	int n = store.count;
+	if (n == 0) return 0;
+	const float *px = store.px, *py = store.py, *pz = store.pz;
+
+	// Stiffness block of every spring, d(force on vertices[0]) / d(vertices[1]).
+	// Compressed springs keep only the d d^T / l term so K stays
+	// semi-definite and CG applies.
+	pool.run(edgeCount, IMPLICIT_MIN_CHUNK, [&](int, int begin, int end) {
+		for (int e = begin; e < end; e++) {
+			int v1 = edges[e].vertices[0];
+			int v2 = edges[e].vertices[1];
+			float dx = px[v2] - px[v1];
+			float dy = py[v2] - py[v1];
+			float dz = pz[v2] - pz[v1];
+			float l = sqrtf(dx * dx + dy * dy + dz * dz);
+			float* B = &edgeBlock[6 * e];
+			if (l <= 0) {
+				for (int a = 0; a < 6; a++) B[a] = 0;
+				continue;
+			}
+			float stretch = stiffness * fmaxf(l - edges[e].len, 0);
+			float outer = stiffness / l;
+			B[0] = stretch + outer * dx * dx;
+			B[1] = outer * dx * dy;
+			B[2] = outer * dx * dz;
+			B[3] = stretch + outer * dy * dy;
+			B[4] = outer * dy * dz;
+			B[5] = stretch + outer * dz * dz;
+		}
+	});
+
+	// Damping acts on a vertex's own velocity along each of its springs,
+	// -D_ii = -damping * sum n n^T.  Also set up the right hand side
+	// b = h (f + h K v) in r and the Jacobi preconditioner.
+	float h2 = h * h;
+	pool.run(n, IMPLICIT_MIN_CHUNK, [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			float* D = &dampBlock[6 * i];
+			for (int a = 0; a < 6; a++) D[a] = 0;
+			float Kv[3] = { 0, 0, 0 };
+			float Kdiag[3] = { 0, 0, 0 };
+			for (int k = graph.firstNeighbor(i); k < graph.lastNeighbor(i); k++) {
+				int j = graph.neighbor(k);
+				const float* B = &edgeBlock[6 * graph.neighborEdge(k)];
+				addBlockProduct(B, store.vx[j] - store.vx[i], store.vy[j] - store.vy[i],
+				                store.vz[j] - store.vz[i], Kv);
+				Kdiag[0] += B[0];
+				Kdiag[1] += B[3];
+				Kdiag[2] += B[5];
+
+				float dx = px[j] - px[i];
+				float dy = py[j] - py[i];
+				float dz = pz[j] - pz[i];
+				float l2 = dx * dx + dy * dy + dz * dz;
+				if (l2 <= 0) continue;
+				float c = -damping / l2;
+				D[0] += c * dx * dx;
+				D[1] += c * dx * dy;
+				D[2] += c * dx * dz;
+				D[3] += c * dy * dy;
+				D[4] += c * dy * dz;
+				D[5] += c * dz * dz;
+			}
+			float f[3] = { store.fx[i], store.fy[i] - gravity, store.fz[i] };
+			float Ddiag[3] = { D[0], D[3], D[5] };
+			for (int a = 0; a < 3; a++) {
+				r[3 * i + a] = h * (f[a] + h * Kv[a]);
+				invDiag[3 * i + a] = 1 / (mass + h * Ddiag[a] + h2 * Kdiag[a]);
+				dv[3 * i + a] = 0;
+			}
+		}
+	});
+
+	// preconditioned conjugate gradient, dot products reduced in
+	// chunk order so the result does not depend on thread timing
+	int chunks = pool.chunkCount(n, IMPLICIT_MIN_CHUNK);
+	partial.assign(chunks, 0.0);
+	pool.run(n, IMPLICIT_MIN_CHUNK, [&](int chunk, int begin, int end) {
+		double sum = 0;
+		for (int k = 3 * begin; k < 3 * end; k++) {
+			z[k] = invDiag[k] * r[k];
+			p[k] = z[k];
+			sum += (double)r[k] * z[k];
+		}
+		partial[chunk] = sum;
+	});
+	double rz = 0;
+	for (int c = 0; c < chunks; c++) rz += partial[c];
+	double rzLimit = rz * tolerance * tolerance;
+
+	int iterations = 0;
+	while (iterations < maxIterations && rz > rzLimit && rz > 0) {
+		double pAp = apply(graph, pool, &p[0], &Ap[0], h, mass);
+		if (!(pAp > 0)) break;
+		float alpha = (float)(rz / pAp);
+
+		partial.assign(chunks, 0.0);
+		pool.run(n, IMPLICIT_MIN_CHUNK, [&](int chunk, int begin, int end) {
+			double sum = 0;
+			for (int k = 3 * begin; k < 3 * end; k++) {
+				dv[k] += alpha * p[k];
+				r[k] -= alpha * Ap[k];
+				z[k] = invDiag[k] * r[k];
+				sum += (double)r[k] * z[k];
+			}
+			partial[chunk] = sum;
+		});
+		double rzNext = 0;
+		for (int c = 0; c < chunks; c++) rzNext += partial[c];
+
+		float beta = (float)(rzNext / rz);
+		rz = rzNext;
+		pool.run(n, IMPLICIT_MIN_CHUNK, [&](int, int begin, int end) {
+			for (int k = 3 * begin; k < 3 * end; k++) {
+				p[k] = z[k] + beta * p[k];
+			}
+		});
+		iterations++;
+	}
+
+	// v += dv, then move with the new velocity
+	pool.run(n, IMPLICIT_MIN_CHUNK, [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			store.vx[i] += dv[3 * i];
+			store.vy[i] += dv[3 * i + 1];
+			store.vz[i] += dv[3 * i + 2];
+			store.px[i] += h * store.vx[i];
+			store.py[i] += h * store.vy[i];
+			store.pz[i] += h * store.vz[i];
+		}
+	});
+	lastIterations = iterations;
+	return iterations;
+}
@@ -0,0 +1,75 @@
+/*  =================== File Information =================
+        File Name: implicit.h
+        Description: Backward Euler step for the mass-spring system
+        Author:
+
+        Purpose: Lets the springs be much stiffer, or the step much
+                 longer, than explicit integration allows.  Each step
+                 linearizes the spring and damping forces around the
+                 current state and solves
+                     (M - h D - h^2 K) dv = h (f + h K v)
+                 with preconditioned conjugate gradient.  K and D are
+                 never assembled: the 3x3 block of every edge is
+                 computed once per step and applied through the CSR
+                 adjacency of the VertexGraph.
+        ===================================================== */
+#ifndef IMPLICIT_H
+#define IMPLICIT_H
+
+#include <vector>
+#include "geometry.h"
+#include "parallel.h"
+#include "arena.h"
+
+class ImplicitSolver{
+
+public:
+	ImplicitSolver();
+
+	// CG stops after maxIterations, or once the preconditioned
+	// residual fell below tolerance times the initial one
+	int maxIterations;
+	float tolerance;
+	// iterations the last step took
+	int lastIterations;
+
+	/*  ===============================================
+	      Desc: Advances positions and velocities of store by h
+	      Precondition: store->fx/fy/fz hold the total force on every
+	            vertex except gravity, evaluated at the current state,
+	            and graph was built from edges; allocate has run for
+	            the counts of this mesh
+	      Postcondition: velocities and positions are updated;
+	            the grid in graph is not refitted
+	      Returns: the number of CG iterations used
+	    =============================================== */
+	int step(VertexStore& store, const edge* edges, int edgeCount,
+	         const VertexGraph& graph, WorkerPool& pool,
+	         float h, float stiffness, float damping, float mass, float gravity);
+
+	/*  ===============================================
+	      Desc: Takes the per-edge and per-vertex arrays step works in
+	            out of the arena of the mesh it steps
+	      Postcondition: they are valid until the arena's next reserve,
+	            which has to be followed by release
+	    =============================================== */
+	void allocate(int vertexCount, int edgeCount, MeshArena& arena);
+	// arena bytes allocate takes, for adding up what to reserve
+	static size_t bytesFor(int vertexCount, int edgeCount);
+	// Forgets the arrays; the next step needs allocate again
+	void release();
+	bool isAllocated() const { return dv != NULL; }
+
+private:
+	// y = A x, returns dot(x, y); chunks run on pool
+	double apply(const VertexGraph& graph, WorkerPool& pool,
+	             const float* x, float* y, float h, float mass);
+
+	float* edgeBlock;   // 6 per edge: xx xy xz yy yz zz of K_e
+	float* dampBlock;   // 6 per vertex: -D_ii, same layout
+	float* invDiag;     // 3 per vertex: Jacobi preconditioner
+	float *dv, *r, *z, *p, *Ap;  // 3 per vertex, interleaved xyz
+	std::vector<double> partial;    // per-chunk dot products
+};
+
+#endif
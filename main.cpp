@@ -12,6 +12,9 @@
 #include <GL/glui.h>
 #include <math.h>
 #include "ply.h"
+#include "simulation.h"
+#include "meshloader.h"
+#include "plyrender.h"
 #include "Algebra.h"
 #define SPHERE 1
 #define CUBE 0
@@ -26,6 +29,9 @@ float heightY = 3;
 float radius = 0.1;
 int  scale = 40;
 int objType = 0;
+int integrator = PLY_EXPLICIT;
+int springs = 0;
+int smooth = 0;
 float view_rotate[16] = { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
 float mouseX;
 float mouseY;
@@ -33,62 +39,54 @@ float mouseY;
         use it to 
 */
 GLUI_EditText* filenameTextField = NULL;
+// how the last load went
+GLUI_StaticText* statusText = NULL;
 string filenamePath = "cow.ply";
 
 /****************************************/
 /*         PLY Object                   */
 /****************************************/
-ply* myPLY = new ply (filenamePath);
-Point spherePos;
-Vector sphereTrajectory;
-
-
-Point cubePos;
-Vector cubeTrajectory;
+// steps the scene and the projectiles on its own thread, see simulation.h;
+// the scene itself is shared by the simulation and its snapshots
+Simulation* simulation = NULL;
+// reads the files picked with Load PLY without blocking the UI
+MeshLoader loader;
+// draws the instances in view, and holds the scene it draws
+SceneRenderer renderer;
+
+void showStatus(const string& text) {
+    cout << text << endl;
+    if (statusText != NULL) statusText->set_text(text.c_str());
+}
 /***************************************** myGlutIdle() ***********/
 void callback_obj(int obj) {
     cerr << objType << endl;
 }
+void callback_smooth(int id) {
+    simulation->setSmoothNormals(smooth);
+}
+void callback_integrator(int id) {
+    simulation->setIntegrator((plyIntegrator)integrator);
+}
 void myMouse(int button, int state, int x, int y) {
     float width = glutGet(GLUT_WINDOW_WIDTH);
     float height = glutGet(GLUT_WINDOW_HEIGHT);
     mouseX = ((x/width) - 0.5) * 3.0;
     mouseY = -((1 - (y/height)) - 0.5) * 3.0;
-    Vector back(0, 0, 1);
     //myPLY->deformModel(mouseX, mouseY, rot_mat(up, DEG_TO_RAD(rotY)))a
-    if (objType == SPHERE) {
-        if (!drop) {
-            Matrix transform = rotY_mat(DEG_TO_RAD(-rotY));
-            sphereTrajectory = Vector(0, 0, 0);
-            sphereTrajectory[2] = -0.05;
-            sphereTrajectory = transform * sphereTrajectory;
-
-            spherePos = Point(0, 0, 0);
-            spherePos[2] = 1.7;
-            spherePos[1] = heightY;
-            spherePos = transform * spherePos;
-        } else {
-            sphereTrajectory = Vector(0, -0.005, 0);
-
-            spherePos = Point(mouseX, heightY, mouseY);
-        }
-    }
-    if (objType == CUBE) {
-        if (!drop) {
-            Matrix transform = rotY_mat(DEG_TO_RAD(-rotY));
-            cubeTrajectory = Vector(0, 0, 0);
-            cubeTrajectory[2] = -0.05;
-            cubeTrajectory = transform * cubeTrajectory;
-
-            cubePos = Point(0, 0, 0);
-            cubePos[2] = 1.7;
-            cubePos[1] = heightY;
-            cubePos = transform * spherePos;
-        } else {
-            cubeTrajectory = Vector(0, -0.005, 0);
-            cubePos = Point(mouseX, heightY, mouseY);
-        }
+    Projectile p;
+    p.type = objType == SPHERE ? PROJECTILE_SPHERE : PROJECTILE_CUBE;
+    p.radius = radius;
+    if (!drop) {
+        // thrown horizontally towards the mesh from where the camera looks
+        Matrixf transform(rotY_mat(DEG_TO_RAD(-rotY)));
+        p.trajectory = transform * Vectorf(0, 0, -0.05f);
+        p.position = transform * Pointf(0, heightY, 1.7f);
+    } else {
+        p.trajectory = Vectorf(0, -0.005f, 0);
+        p.position = Pointf(mouseX, heightY, mouseY);
     }
+    simulation->launch(p);
 }
 
 void myGlutIdle(void)
@@ -99,6 +97,19 @@ void myGlutIdle(void)
         if (glutGetWindow() != main_window){
                 glutSetWindow(main_window);
         }
+        // a finished load goes to the simulation, which swaps it in
+        // between two steps; a failed one only changes the status
+        shared_ptr<ply> loaded;
+        string error;
+        if (loader.finished(loaded, error)) {
+                if (loaded != NULL) {
+                        loaded->printAttributes();
+                        simulation->setMesh(loaded);
+                        showStatus("Loaded " + to_string(loaded->getFaceCount()) + " faces");
+                } else {
+                        showStatus(error);
+                }
+        }
         glutPostRedisplay();
 }
 
@@ -132,6 +143,33 @@ void myGlutReshape(int x, int y)
         glutPostRedisplay();
 }
 
+/*  ==========================================
+    The six planes of the view volume in the coordinates
+    of the current modelview matrix, for culling: the rows
+    of projection * modelview added to and taken from the
+    last one, as Scene::cull takes them
+    ========================================== */
+void viewPlanes(float planes[6][4])
+{
+        float p[16], m[16], c[16];
+        glGetFloatv(GL_PROJECTION_MATRIX, p);
+        glGetFloatv(GL_MODELVIEW_MATRIX, m);
+        // column major, c = p * m
+        for (int col = 0; col < 4; col++) {
+                for (int row = 0; row < 4; row++) {
+                        c[col * 4 + row] = p[row] * m[col * 4] + p[4 + row] * m[col * 4 + 1]
+                                         + p[8 + row] * m[col * 4 + 2] + p[12 + row] * m[col * 4 + 3];
+                }
+        }
+        for (int k = 0; k < 6; k++) {
+                int row = k / 2;
+                float sign = (k % 2 == 0) ? 1 : -1;
+                for (int col = 0; col < 4; col++) {
+                        planes[k][col] = c[col * 4 + 3] + sign * c[col * 4 + row];
+                }
+        }
+}
+
 /***************************************** myGlutDisplay() *****************/
 
 void myGlutDisplay(void)
@@ -148,30 +186,37 @@ void myGlutDisplay(void)
         glMultMatrixf(view_rotate);
         glScalef(scale / 100.0, scale / 100.0, scale / 100.0);
         glRotatef(rotY, 0.0, 1.0, 0.0);
-        if (objType == SPHERE) {
-            if (sphereTrajectory.length() > 0) {
-                glPushMatrix();
-                glTranslated(spherePos[0], spherePos[1], spherePos[2]);
+        // only the instances in this view are copied for drawing
+        float planes[6][4];
+        viewPlanes(planes);
+        simulation->setView(planes);
+        // the latest state the simulation thread finished, never waits for it
+        simulation->setDrop(drop);
+        simulation->setSolver(springs, wireframe);
+        const SimSnapshot& snapshot = simulation->acquireSnapshot();
+        const ProjectileSystem& projectiles = snapshot.projectiles;
+        for (int i = 0; i < projectiles.size(); i++) {
+            glPushMatrix();
+            glTranslated(projectiles.px[i], projectiles.py[i], projectiles.pz[i]);
+            if (projectiles.type[i] == PROJECTILE_SPHERE) {
                 glColor3f(1, 1, 0);
-                glutWireSphere(radius, 5, 5);
-                glPopMatrix(); 
-            }
-        }
-        if (objType == CUBE) {
-            if (cubeTrajectory.length() > 0) {
-                glPushMatrix();
-                glTranslated(cubePos[0], cubePos[1], cubePos[2]);
+                glutWireSphere(projectiles.radius[i], 5, 5);
+            } else {
                 glColor3f(1, 0, 1);
-                glutWireCube(radius);
-                glPopMatrix(); 
+                glutWireCube(projectiles.radius[i]);
             }
-
+            glPopMatrix(); 
         }
+        // the snapshot holds the scene it was taken from, so a mesh
+        // swapped in by a load is only drawn with its own positions;
+        // smooth normals arrive with the first snapshot after they
+        // are enabled
         glPushMatrix();
 
         float rotRad = PI * (rotY / 180.0);
-        myPLY->lookX = sinf(-rotRad);
-        myPLY->lookZ = cosf(-rotRad);
+        renderer.lookX = sinf(-rotRad);
+        renderer.lookZ = cosf(-rotRad);
+        renderer.update(snapshot);
 
         //draw the axes
         glLineWidth(1);
@@ -184,41 +229,12 @@ void myGlutDisplay(void)
         glVertex3f(0, 0, 0); glVertex3f(0, 0, 1.0);
         glEnd();
 
-        if (objType == CUBE && cubeTrajectory.length() > 0) {
-            cubePos = cubePos + cubeTrajectory;
-            Vector r(radius / 2, radius / 2, radius / 2); 
-            if (myPLY->deformModel(cubePos - r, cubePos + r, cubeTrajectory / 100)) {
-                cubeTrajectory = cubeTrajectory * 0.1;
-            } else {
-
-                if (drop) {
-                    cubeTrajectory = cubeTrajectory + Vector(0, -0.001, 0);
-                }
-            }
-        }
-
-        if (objType == SPHERE && sphereTrajectory.length() > 0) {
-            spherePos = spherePos + sphereTrajectory;
-            if (myPLY->deformModel(spherePos, radius, sphereTrajectory / 100)) {
-                sphereTrajectory = sphereTrajectory * 0.01;
-                if (sphereTrajectory.length() < 0.0001) {
-                    sphereTrajectory = Vector();
-                } 
-            } else {
-                if (drop) {
-                    sphereTrajectory = sphereTrajectory + Vector(0, -0.001, 0);
-                }
-            }
-
-        }
-        //myPLY->adjustModel(wireframe);
-
         if (filled) {
             glEnable(GL_LIGHTING);
             glEnable(GL_POLYGON_OFFSET_FILL);
             glColor3f(0.6, 0.6, 0.6);
             glPolygonMode(GL_FRONT, GL_FILL);
-            myPLY->render();
+            renderer.render();
         }
 
         if (wireframe) {
@@ -226,13 +242,13 @@ void myGlutDisplay(void)
             glDisable(GL_POLYGON_OFFSET_FILL);
             glColor3f(1.0, 1.0, 0.0);
             glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-            myPLY->render();
+            renderer.render();
         }
 
         if(silhouette){
             glColor3f(1.0, 1.0, 1.0);
             glLineWidth(2);
-            myPLY->renderSilhouette();
+            renderer.renderSilhouette();
         }
         glPopMatrix();
         glutSwapBuffers();
@@ -243,7 +259,8 @@ void myGlutDisplay(void)
     ========================================== */
 void onExit()
 {
-    delete myPLY;
+    delete simulation;
+    renderer.clear();
 }
 
 /*   ==========================================
@@ -257,12 +274,13 @@ void callback_load(int id) {
     if (filenameTextField == NULL) {
         return;
     }
-    // 
-    cout << "Loading new ply file from: " << filenameTextField->get_text() << endl;
-    // Reload our model
-    myPLY->reload(filenameTextField->get_text());
-    // Print out the attributes
-    myPLY->printAttributes();
+    // The model is read on the loader's thread while the old one keeps
+    // running; myGlutIdle picks up the result
+    if (!loader.load(filenameTextField->get_text())) {
+        showStatus("Still loading the previous file");
+        return;
+    }
+    showStatus("Loading " + string(filenameTextField->get_text()));
 }
 
 
@@ -271,6 +289,11 @@ void callback_load(int id) {
 int main(int argc, char* argv[])
 {
 
+    shared_ptr<ply> first = make_shared<ply>(filenamePath);
+    if (!first->getLoadError().empty()) {
+        cout << first->getLoadError() << endl;
+    }
+    simulation = new Simulation(first);
     atexit(onExit);
 
     /****************************************/
@@ -316,6 +339,8 @@ int main(int argc, char* argv[])
 
     glEnable(GL_DEPTH_TEST);
     glPolygonOffset(1, 1);
+    // instances may be scaled, and their normals with them
+    glEnable(GL_NORMALIZE);
 
     /****************************************/
     /*         Here's the GLUI code         */
@@ -328,6 +353,7 @@ int main(int argc, char* argv[])
     new GLUI_Checkbox(render_panel, "Wireframe", &wireframe);
     new GLUI_Checkbox(render_panel, "Filled", &filled);
     new GLUI_Checkbox(render_panel, "Silhouette", &silhouette);
+    new GLUI_Checkbox(render_panel, "Smooth", &smooth, 0, callback_smooth);
     new GLUI_Checkbox(render_panel, "Drop", &drop);
 
     GLUI_Panel *camera_panel = glui->add_panel("Camera");
@@ -344,9 +370,18 @@ int main(int argc, char* argv[])
         glui->add_radiogroup_to_panel(obj_panel, (int*)(&objType), 3, callback_obj);
     glui->add_radiobutton_to_group(group1, "Cube");
     glui->add_radiobutton_to_group(group1, "Sphere");
+
+    GLUI_Panel *solver_panel = glui->add_panel("Solver");
+    GLUI_RadioGroup *group2 =
+        glui->add_radiogroup_to_panel(solver_panel, &integrator, 0, callback_integrator);
+    glui->add_radiobutton_to_group(group2, "Explicit");
+    glui->add_radiobutton_to_group(group2, "Implicit");
+    glui->add_radiobutton_to_group(group2, "XPBD");
+    new GLUI_Checkbox(solver_panel, "Springs", &springs);
     filenameTextField = new GLUI_EditText( glui, "Filename:", filenamePath);
     filenameTextField->set_w(300);
     glui->add_button("Load PLY", 0, callback_load);
+    statusText = glui->add_statictext(first->getLoadError().c_str());
 
 
     glui->add_column(true);
@@ -356,6 +391,8 @@ int main(int argc, char* argv[])
     /* We register the idle callback with GLUI, *not* with GLUT */
     GLUI_Master.set_glutIdleFunc(myGlutIdle);
 
+    simulation->start();
+
 
 
     glutMainLoop();
@@ -0,0 +1,63 @@
+/*  =================== File Information =================
+        File Name: mappedfile.cpp
+        Description: Memory mapping of a whole file
+        Author:
+        ===================================================== */
+#include "mappedfile.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(){
+	bytes = NULL;
+	length = 0;
+	modifiedTime = 0;
+	writable = false;
+}
+
+MappedFile::~MappedFile(){
+	close();
+}
+
+bool MappedFile::open(const std::string& path, bool copyOnWrite){
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+		::close(fd);
+		return false;
+	}
+
+	int protection = copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ;
+	void* mapping = mmap(NULL, info.st_size, protection, MAP_PRIVATE, fd, 0);
+	// the mapping stays valid after the descriptor is closed
+	::close(fd);
+	if (mapping == MAP_FAILED) {
+		return false;
+	}
+	// the loaders read front to back; copy on write mappings are used
+	// in place, so start reading them in now
+	madvise(mapping, info.st_size, copyOnWrite ? MADV_WILLNEED : MADV_SEQUENTIAL);
+
+	bytes = (const char*)mapping;
+	length = info.st_size;
+	modifiedTime = (uint64_t)info.st_mtim.tv_sec * 1000000000u + info.st_mtim.tv_nsec;
+	writable = copyOnWrite;
+	return true;
+}
+
+void MappedFile::close(){
+	if (bytes != NULL) {
+		munmap((void*)bytes, length);
+	}
+	bytes = NULL;
+	length = 0;
+	modifiedTime = 0;
+	writable = false;
+}
@@ -0,0 +1,50 @@
+/*  =================== File Information =================
+        File Name: mappedfile.h
+        Description: Memory mapping of a whole file
+        Author:
+
+        Purpose: Lets loaders decode a file in place, straight out of
+                 the page cache, without copying it line by line.  A
+                 copy on write mapping can also be written to: pages
+                 are copied the first time they change and the file on
+                 disk is never touched.
+        ===================================================== */
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+class MappedFile{
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	// Maps the file at path, copy on write if asked; returns false if
+	// it cannot be opened or mapped
+	bool open(const std::string& path, bool copyOnWrite = false);
+	// Unmaps the file (also done by the destructor)
+	void close();
+
+	const char* data() const { return bytes; }
+	size_t size() const { return length; }
+	// last modification of the file when it was mapped, in
+	// nanoseconds since the epoch
+	uint64_t modified() const { return modifiedTime; }
+	// the same bytes, writable; NULL unless mapped copy on write
+	char* writableData() { return writable ? (char*)bytes : NULL; }
+
+private:
+	// not copyable, the mapping has exactly one owner
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const char* bytes;
+	size_t length;
+	uint64_t modifiedTime;
+	bool writable;
+};
+
+#endif
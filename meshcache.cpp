@@ -0,0 +1,205 @@
+/*  =================== File Information =================
+        File Name: meshcache.cpp
+        Description: On-disk cache of a loaded, preprocessed mesh
+        Author:
+        ===================================================== */
+#include "meshcache.h"
+#include "geometry.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#define CACHE_MAGIC "PLYCACHE"
+#define CACHE_BYTE_ORDER 0x01020304u
+// sections start on a cache line, as arena arrays do
+#define CACHE_ALIGN 64
+
+// multipliers of the hash rounds (the xxHash64 primes)
+static const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t prime3 = 0x165667B19E3779F9ull;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t readWord(const char* p) {
+	uint64_t w;
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+static inline uint64_t round64(uint64_t lane, uint64_t word) {
+	return rotl(lane + word * prime2, 31) * prime1;
+}
+
+// Four independent lanes of 8 byte words, so the multiplies overlap
+// and the hash runs at close to memory speed
+uint64_t meshCacheHash(const char* data, size_t size) {
+	uint64_t lane[4] = { prime1 + prime2, prime2, 0, 0 - prime1 };
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		lane[0] = round64(lane[0], readWord(data + i));
+		lane[1] = round64(lane[1], readWord(data + i + 8));
+		lane[2] = round64(lane[2], readWord(data + i + 16));
+		lane[3] = round64(lane[3], readWord(data + i + 24));
+	}
+	uint64_t h = rotl(lane[0], 1) + rotl(lane[1], 7) + rotl(lane[2], 12) + rotl(lane[3], 18);
+	h += size;
+	for (; i + 8 <= size; i += 8) {
+		h = rotl(h ^ round64(0, readWord(data + i)), 27) * prime1 + prime3;
+	}
+	for (; i < size; i++) {
+		h = rotl(h ^ ((unsigned char)data[i] * prime3), 11) * prime1;
+	}
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+// the directory caches go in, or "" if there is nowhere to put them
+static std::string cacheDirectory() {
+	const char* setting = getenv("PLY_CACHE_DIR");
+	if (setting != NULL && *setting) return setting;
+	setting = getenv("XDG_CACHE_HOME");
+	if (setting != NULL && *setting) return std::string(setting) + "/plycache";
+	setting = getenv("HOME");
+	if (setting != NULL && *setting) return std::string(setting) + "/.cache/plycache";
+	return std::string();
+}
+
+std::string meshCachePath(const std::string& source) {
+	std::string directory = cacheDirectory();
+	if (directory.empty()) return directory;
+	// the absolute path tells apart files of the same name
+	char* absolute = realpath(source.c_str(), NULL);
+	std::string key = absolute != NULL ? absolute : source;
+	free(absolute);
+	size_t slash = source.find_last_of('/');
+	std::string name = slash == std::string::npos ? source : source.substr(slash + 1);
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)meshCacheHash(key.data(), key.size()));
+	return directory + "/" + name + "." + hash + ".cache";
+}
+
+// Creates every missing directory above the file at path; failures
+// are left for the write to run into
+static void makeDirectories(const std::string& path) {
+	for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+		mkdir(path.substr(0, slash).c_str(), 0755);
+	}
+}
+
+// the checksum covers the rest of the header, section table included,
+// everything past the checksum field itself
+#define CACHE_CHECKED_FROM (offsetof(MeshCacheHeader, checksum) + sizeof(uint64_t))
+
+static uint64_t headerChecksum(const MeshCacheHeader& header) {
+	return meshCacheHash((const char*)&header + CACHE_CHECKED_FROM, sizeof(MeshCacheHeader) - CACHE_CHECKED_FROM);
+}
+
+static uint64_t alignUp(uint64_t n) {
+	return (n + CACHE_ALIGN - 1) & ~(uint64_t)(CACHE_ALIGN - 1);
+}
+
+// Writes the new source time into the header of the cache at path, so
+// the next load does not hash the source again.  Only the key changes,
+// which is outside the checksum and only read on opening.  Returns
+// false if it could not, which costs another hash next time.
+static bool touchMeshCache(const std::string& path, uint64_t sourceTime) {
+	int fd = open(path.c_str(), O_WRONLY);
+	if (fd < 0) return false;
+	bool ok = pwrite(fd, &sourceTime, sizeof(sourceTime), offsetof(MeshCacheHeader, sourceTime)) == sizeof(sourceTime);
+	close(fd);
+	return ok;
+}
+
+MeshCacheHeader* openMeshCache(MappedFile& file, const std::string& path,
+                               const MappedFile& source) {
+	if (path.empty() || !file.open(path, true)) return NULL;
+	MeshCacheHeader* header = (MeshCacheHeader*)file.writableData();
+	bool ok = file.size() >= sizeof(MeshCacheHeader)
+		&& memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) == 0
+		&& header->version == MESHCACHE_VERSION
+		&& header->byteOrder == CACHE_BYTE_ORDER
+		&& header->edgeBytes == sizeof(edge)
+		&& header->headerBytes == sizeof(MeshCacheHeader)
+		&& header->sourceSize == source.size()
+		&& header->checksum == headerChecksum(*header);
+	for (int s = 0; ok && s < CACHE_SECTIONS; s++) {
+		ok = header->offset[s] % CACHE_ALIGN == 0
+			&& header->offset[s] <= file.size()
+			&& header->bytes[s] <= file.size() - header->offset[s];
+	}
+	// same size at another time: touched, copied or checked out again,
+	// or edited in place; only the contents can tell
+	if (ok && header->sourceTime != source.modified()) {
+		ok = header->sourceHash == meshCacheHash(source.data(), source.size());
+		if (ok) {
+			touchMeshCache(path, source.modified());
+			header->sourceTime = source.modified();
+		}
+	}
+	if (!ok) {
+		file.close();
+		return NULL;
+	}
+	return header;
+}
+
+bool writeMeshCache(const std::string& path, const MappedFile& source, MeshCacheHeader& header,
+                    const void* const sections[CACHE_SECTIONS]) {
+	if (path.empty()) return false;
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.version = MESHCACHE_VERSION;
+	header.byteOrder = CACHE_BYTE_ORDER;
+	header.edgeBytes = sizeof(edge);
+	header.headerBytes = sizeof(MeshCacheHeader);
+	header.sourceSize = source.size();
+	header.sourceHash = meshCacheHash(source.data(), source.size());
+	header.sourceTime = source.modified();
+	uint64_t at = alignUp(sizeof(MeshCacheHeader));
+	for (int s = 0; s < CACHE_SECTIONS; s++) {
+		header.offset[s] = at;
+		at = alignUp(at + header.bytes[s]);
+	}
+	header.checksum = headerChecksum(header);
+
+	// written under a temporary name and renamed over the old cache, so
+	// nobody ever maps a half written file
+	makeDirectories(path);
+	std::string temporary = path + ".XXXXXX";
+	int fd = mkstemp(&temporary[0]);
+	if (fd < 0) return false;
+	fchmod(fd, 0644);
+	FILE* out = fdopen(fd, "wb");
+	if (out == NULL) {
+		close(fd);
+		unlink(temporary.c_str());
+		return false;
+	}
+
+	static const char padding[CACHE_ALIGN] = { 0 };
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+	uint64_t written = sizeof(header);
+	for (int s = 0; ok && s < CACHE_SECTIONS; s++) {
+		ok = fwrite(padding, 1, header.offset[s] - written, out) == header.offset[s] - written;
+		if (ok && header.bytes[s] > 0) {
+			ok = fwrite(sections[s], 1, header.bytes[s], out) == header.bytes[s];
+		}
+		written = header.offset[s] + header.bytes[s];
+	}
+	// pad to the end of the last section, so empty ones still lie
+	// inside the file
+	if (ok) ok = fwrite(padding, 1, at - written, out) == at - written;
+	ok = fclose(out) == 0 && ok;
+	if (ok) ok = rename(temporary.c_str(), path.c_str()) == 0;
+	if (!ok) unlink(temporary.c_str());
+	return ok;
+}
@@ -0,0 +1,126 @@
+/*  =================== File Information =================
+        File Name: meshcache.h
+        Description: On-disk cache of a loaded, preprocessed mesh
+        Author:
+
+        Purpose: Loading a .ply file means parsing it, centering it,
+                 finding its edges and building its adjacency, pick grid
+                 and constraint colouring.  None of
+                 that changes while the file does not, so after the first
+                 load ply writes the result to the user's cache directory
+                 and later loads map it instead of doing the work again.
+
+                 The cache is a header followed by raw arrays, each on a
+                 64 byte boundary, exactly as they are laid out in
+                 memory, so a load maps the file and points at them;
+                 nothing is parsed.  The header holds the size,
+                 modification time and a 64 bit hash of the source.  A
+                 source of the same size and time is taken to be
+                 unchanged, as make does, so a hit reads neither the
+                 source nor the arrays; only when the time differs is
+                 the source hashed, and if the hash still matches the new
+                 time is written into the header.  A cache whose key,
+                 version or layout does not match is ignored and
+                 rewritten.  The rest of the header, with the section
+                 table, is covered by a checksum, so a damaged table
+                 cannot point outside the file.  The arrays themselves
+                 are not checked: a cache is only ever replaced by
+                 renaming a complete new file over it, so it is never
+                 seen half written, and a mapped cache never changes
+                 under a running program (the source time aside, which
+                 is only read on opening).
+        ===================================================== */
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "mappedfile.h"
+
+// bump whenever a section or the header changes
+#define MESHCACHE_VERSION 3
+
+// The arrays stored, in file order
+enum meshCacheSection {
+	CACHE_PX, CACHE_PY, CACHE_PZ,           // positions after scaleAndCenter
+	CACHE_CENTER_LEN,
+	CACHE_CONFIDENCE, CACHE_INTENSITY,
+	CACHE_R, CACHE_G, CACHE_B,
+	CACHE_INDICES,                          // FaceList::indices
+	CACHE_OFFSETS,                          // FaceList::offsets, empty for triangles
+	CACHE_NORM_X, CACHE_NORM_Y, CACHE_NORM_Z,
+	CACHE_EDGES,                            // edgeList, with rest lengths
+	CACHE_NEIGHBOR_START, CACHE_NEIGHBORS, CACHE_NEIGHBOR_EDGES,
+	CACHE_FACE_START, CACHE_INCIDENT_FACES, // vertex to face table
+	CACHE_GRID_BUCKETS, CACHE_GRID_ORDER,   // VertexGridArrays
+	CACHE_GRID_KEYS, CACHE_GRID_X, CACHE_GRID_Y, CACHE_GRID_Z, CACHE_GRID_SLOT,
+	CACHE_XPBD_COLORS, CACHE_XPBD_V1,       // XpbdSolver's packed edges
+	CACHE_XPBD_V2, CACHE_XPBD_REST,
+	CACHE_SECTIONS
+};
+
+struct MeshCacheHeader {
+	char magic[8];          // "PLYCACHE"
+	uint32_t version;
+	uint32_t byteOrder;     // 0x01020304 as written by the host
+	uint32_t edgeBytes;     // sizeof(edge)
+	uint32_t headerBytes;   // sizeof(MeshCacheHeader)
+	uint64_t sourceSize;
+	uint64_t sourceHash;
+	uint64_t sourceTime;    // MappedFile::modified of the source
+	uint64_t checksum;      // meshCacheHash of the rest of the header
+	int32_t vertexCount;
+	int32_t faceCount;
+	int32_t indexCount;
+	int32_t edgeCount;
+	int32_t boundaryEdgeCount;
+	int32_t nonManifoldEdgeCount;
+	float gridCellSize;
+	int32_t xpbdColorCount;
+	int32_t xpbdSerialColor;
+	int32_t unused;
+	uint64_t offset[CACHE_SECTIONS];
+	uint64_t bytes[CACHE_SECTIONS];
+};
+
+// Hash of a file's contents, the cache key together with its size
+uint64_t meshCacheHash(const char* data, size_t size);
+
+/*  ===============================================
+      Desc: Where the cache of source lives: a file named after it and
+            a hash of its absolute path, in $PLY_CACHE_DIR, else
+            $XDG_CACHE_HOME/plycache, else ~/.cache/plycache
+      Returns: an empty string if none of them is set
+    =============================================== */
+std::string meshCachePath(const std::string& source);
+
+/*  ===============================================
+      Desc: Maps the cache at path copy on write, so the mesh can use
+            (and change) the arrays in place
+      Precondition: source is the mapped source file
+      Returns: the header, or NULL (and file closed) if there is no
+            cache or it is for other contents, another version or
+            another layout, or cut short or damaged
+    =============================================== */
+MeshCacheHeader* openMeshCache(MappedFile& file, const std::string& path,
+                               const MappedFile& source);
+
+// Start of a section of a cache opened by openMeshCache
+template <typename T>
+T* meshCacheSection(MappedFile& file, const MeshCacheHeader* header, meshCacheSection section) {
+	return (T*)(file.writableData() + header->offset[section]);
+}
+
+/*  ===============================================
+      Desc: Writes a cache for source: header (counts filled in; key,
+            offsets and magic are set here) and header->bytes[s] bytes
+            from sections[s] for every section.  The cache directory is
+            created if it is missing.
+      Returns: false if it could not be written, which leaves any
+            existing cache as it was
+    =============================================== */
+bool writeMeshCache(const std::string& path, const MappedFile& source, MeshCacheHeader& header,
+                    const void* const sections[CACHE_SECTIONS]);
+
+#endif
@@ -0,0 +1,55 @@
+/*  =================== File Information =================
+        File Name: meshloader.cpp
+        Description: Loads .ply files on a background thread
+        Author:
+        ===================================================== */
+#include "meshloader.h"
+
+using namespace std;
+
+MeshLoader::MeshLoader() : pool(1){
+	loading = false;
+	hasResult = false;
+}
+
+MeshLoader::~MeshLoader(){
+	if (worker.joinable()) worker.join();
+}
+
+bool MeshLoader::load(const string& path){
+	if (loading) return false;
+	// the previous load has finished, its thread only needs joining
+	if (worker.joinable()) worker.join();
+	loading = true;
+	worker = thread(&MeshLoader::run, this, path);
+	return true;
+}
+
+void MeshLoader::run(string path){
+	shared_ptr<ply> mesh = make_shared<ply>(path, &pool);
+	string reason = mesh->getLoadError();
+	if (reason.empty()) {
+		mesh->setWorkerPool(&WorkerPool::shared());
+	} else {
+		mesh.reset();
+	}
+
+	{
+		lock_guard<mutex> guard(resultLock);
+		result = mesh;
+		error = reason;
+		hasResult = true;
+	}
+	loading = false;
+}
+
+bool MeshLoader::finished(shared_ptr<ply>& mesh, string& _error){
+	lock_guard<mutex> guard(resultLock);
+	if (!hasResult) return false;
+	mesh = result;
+	_error = error;
+	result.reset();
+	error.clear();
+	hasResult = false;
+	return true;
+}
@@ -0,0 +1,70 @@
+/*  =================== File Information =================
+        File Name: meshloader.h
+        Description: Loads .ply files on a background thread
+        Author:
+
+        Purpose: Parsing, centering, finding edges and building the
+                 graph of a large model takes long enough to freeze the
+                 UI.  MeshLoader does all of it on its own thread, into
+                 a fresh ply that nothing else can see yet, with a one
+                 thread pool of its own so it does not take the shared
+                 workers away from the simulation.  The finished mesh
+                 is handed back as a shared_ptr for the caller to pass
+                 on (Simulation::setMesh); a file that cannot be loaded
+                 comes back as an error message instead.
+        ===================================================== */
+#ifndef MESHLOADER_H
+#define MESHLOADER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "ply.h"
+#include "parallel.h"
+
+class MeshLoader{
+
+public:
+	MeshLoader();
+	// waits for a load in progress
+	~MeshLoader();
+
+	/*  ===============================================
+	      Desc: Starts loading path on the loader thread and returns
+	            at once
+	      Returns: false, and does nothing, while another load runs
+	    =============================================== */
+	bool load(const std::string& path);
+	bool isLoading() { return loading; }
+
+	/*  ===============================================
+	      Desc: Hands over the result of a finished load, once.  mesh
+	            is the loaded mesh, or NULL with the reason in error.
+	            Never blocks; call from one thread.
+	      Returns: false while nothing new has finished
+	    =============================================== */
+	bool finished(std::shared_ptr<ply>& mesh, std::string& error);
+
+private:
+	// not copyable, it owns a thread
+	MeshLoader(const MeshLoader&);
+	MeshLoader& operator=(const MeshLoader&);
+
+	void run(std::string path);
+
+	// the loading passes run on this pool, the finished mesh is
+	// moved over to the shared one
+	WorkerPool pool;
+	std::thread worker;
+	std::atomic<bool> loading;
+
+	// result of the last load, guarded by resultLock
+	std::mutex resultLock;
+	bool hasResult;
+	std::shared_ptr<ply> result;
+	std::string error;
+};
+
+#endif
@@ -0,0 +1,126 @@
+/*  =================== File Information =================
+        File Name: parallel.cpp
+        Description: Persistent worker threads for the per-vertex loops
+        Author:
+        ===================================================== */
+#include "parallel.h"
+#include <stdlib.h>
+
+WorkerPool::WorkerPool(int threads){
+	threadCount = 1;
+	generation = 0;
+	joined = 0;
+	busy = 0;
+	stopping = false;
+	body = NULL;
+	jobCount = 0;
+	jobChunks = 0;
+	nextChunk = 0;
+	start(threads);
+}
+
+WorkerPool::~WorkerPool(){
+	stop();
+}
+
+WorkerPool& WorkerPool::shared(){
+	static WorkerPool pool(getenv("PLY_THREADS") ? atoi(getenv("PLY_THREADS")) : 0);
+	return pool;
+}
+
+void WorkerPool::setThreadCount(int threads){
+	std::lock_guard<std::mutex> owner(jobLock);
+	stop();
+	start(threads);
+}
+
+void WorkerPool::start(int threads){
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	if (threads <= 0) threads = 1;
+	threadCount = threads;
+	stopping = false;
+	// the calling thread runs chunks too
+	for (int i = 1; i < threadCount; i++) {
+		workers.push_back(std::thread(&WorkerPool::work, this));
+	}
+}
+
+void WorkerPool::stop(){
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+	workers.clear();
+}
+
+int WorkerPool::chunkCount(int count, int minChunk) const{
+	if (minChunk < 1) minChunk = 1;
+	int chunks = count / minChunk;
+	if (chunks > threadCount) chunks = threadCount;
+	return chunks < 1 ? 1 : chunks;
+}
+
+void WorkerPool::runChunks(){
+	int c;
+	while ((c = nextChunk.fetch_add(1)) < jobChunks) {
+		// chunk c is [count * c / chunks, count * (c + 1) / chunks)
+		int begin = (int)((long long)jobCount * c / jobChunks);
+		int end   = (int)((long long)jobCount * (c + 1) / jobChunks);
+		(*body)(c, begin, end);
+	}
+}
+
+void WorkerPool::work(){
+	unsigned seen = 0;
+	std::unique_lock<std::mutex> guard(lock);
+	for (;;) {
+		wake.wait(guard, [&]{ return stopping || generation != seen; });
+		if (stopping) return;
+		seen = generation;
+		joined++;
+		busy++;
+		guard.unlock();
+
+		runChunks();
+
+		guard.lock();
+		busy--;
+		idle.notify_all();
+	}
+}
+
+void WorkerPool::run(int count, int minChunk, const std::function<void(int, int, int)>& _body){
+	int chunks = chunkCount(count, minChunk);
+	// while another thread has the workers (the simulation thread, say,
+	// when the renderer asks for normals) run on the caller instead of
+	// waiting; the chunks, and so the results, are the same
+	std::unique_lock<std::mutex> owner(jobLock, std::try_to_lock);
+	if (chunks == 1 || workers.empty() || !owner.owns_lock()) {
+		for (int c = 0; c < chunks; c++) {
+			_body(c, (int)((long long)count * c / chunks), (int)((long long)count * (c + 1) / chunks));
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		body = &_body;
+		jobCount = count;
+		jobChunks = chunks;
+		nextChunk = 0;
+		joined = 0;
+		generation++;
+	}
+	wake.notify_all();
+	runChunks();
+
+	// wait for every worker to have joined and left, so none of them
+	// can still be looking at this job when the next run replaces it
+	std::unique_lock<std::mutex> guard(lock);
+	idle.wait(guard, [&]{ return joined == (int)workers.size() && busy == 0; });
+	body = NULL;
+}
@@ -0,0 +1,79 @@
+/*  =================== File Information =================
+        File Name: parallel.h
+        Description: Persistent worker threads for the per-vertex loops
+        Author:
+
+        Purpose: Splits an index range into contiguous chunks and runs
+                 them on a fixed set of threads.  How a range is split
+                 only depends on its length and the thread count, so a
+                 loop that reduces per-chunk partial results in chunk
+                 order gives the same answer every run.
+        ===================================================== */
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool{
+
+public:
+	// 0 threads means one per hardware thread
+	explicit WorkerPool(int threads = 0);
+	~WorkerPool();
+
+	// Process-wide pool, sized by PLY_THREADS if it is set
+	static WorkerPool& shared();
+
+	// Blocks until running work is done, then resizes
+	void setThreadCount(int threads);
+	int getThreadCount() const { return threadCount; }
+
+	/*  ===============================================
+	      Desc: How many chunks run splits count items into: one per
+	            thread, but none smaller than minChunk items
+	    =============================================== */
+	int chunkCount(int count, int minChunk) const;
+
+	/*  ===============================================
+	      Desc: Calls body(chunk, begin, end) for every chunk of
+	            [0, count), in parallel, and returns once all are done
+	      Precondition: body only writes state owned by its chunk
+	      Note: may be called from several threads; only one of them
+	            gets the workers, the others run their chunks themselves
+	    =============================================== */
+	void run(int count, int minChunk, const std::function<void(int, int, int)>& body);
+
+private:
+	// not copyable, the threads have exactly one owner
+	WorkerPool(const WorkerPool&);
+	WorkerPool& operator=(const WorkerPool&);
+
+	void start(int threads);
+	void stop();
+	void work();
+	void runChunks();
+
+	int threadCount;
+	std::vector<std::thread> workers;
+
+	std::mutex jobLock;             // held by the thread that has the workers
+	std::mutex lock;
+	std::condition_variable wake;   // a new job, or stopping
+	std::condition_variable idle;   // the job is done
+	unsigned generation;            // bumped for every job
+	int joined;                     // workers that picked up the job
+	int busy;                       // workers still inside it
+	bool stopping;
+
+	const std::function<void(int, int, int)>* body;
+	int jobCount;
+	int jobChunks;
+	std::atomic<int> nextChunk;
+};
+
+#endif
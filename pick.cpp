@@ -0,0 +1,258 @@
+/*  =================== File Information =================
+        File Name: pick.cpp
+        Description: Scalar and SIMD kernels behind pick.h
+        Author:
+        ===================================================== */
+#include "pick.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PICK_X86 1
+#include <immintrin.h>
+#endif
+
+// The kernels must not fuse multiplies into adds, or the scalar and
+// vector versions would round differently and disagree on hits.
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+/*  ============== Scalar kernels ==============
+	Also used for the tail of the vector kernels
+	============================================ */
+static int pickSphereScalar(const float* px, const float* py, const float* pz,
+                            int begin, int count, float cx, float cy, float cz,
+                            float radius2, int* hits) {
+    int n = 0;
+    for (int i = begin; i < count; i++) {
+        float dx = px[i] - cx;
+        float dy = py[i] - cy;
+        float dz = pz[i] - cz;
+        float d2 = dx * dx + dy * dy;
+        d2 = d2 + dz * dz;
+        if (d2 < radius2) hits[n++] = i;
+    }
+    return n;
+}
+
+static int pickBoxScalar(const float* px, const float* py, const float* pz,
+                         int begin, int count,
+                         float minX, float minY, float minZ,
+                         float maxX, float maxY, float maxZ, int* hits) {
+    int n = 0;
+    for (int i = begin; i < count; i++) {
+        if (px[i] > minX && py[i] > minY && pz[i] > minZ &&
+            px[i] < maxX && py[i] < maxY && pz[i] < maxZ) {
+            hits[n++] = i;
+        }
+    }
+    return n;
+}
+
+static void pickFacingScalar(const float* nx, const float* nz, int begin, int count,
+                             float lookX, float lookZ, signed char* facing) {
+    for (int i = begin; i < count; i++) {
+        float d = nx[i] * lookX + nz[i] * lookZ;
+        facing[i] = (d > 0) - (d < 0);
+    }
+}
+
+#ifdef PICK_X86
+
+// Appends base + every set bit of mask to hits, lowest first
+static inline int appendMask(unsigned mask, int base, int* hits) {
+    int n = 0;
+    while (mask) {
+        hits[n++] = base + __builtin_ctz(mask);
+        mask &= mask - 1;
+    }
+    return n;
+}
+
+/*  ============== SSE2 kernels (4 vertices per step) ============== */
+static int pickSphereSSE2(const float* px, const float* py, const float* pz, int count,
+                          float cx, float cy, float cz, float radius2, int* hits) {
+    __m128 x0 = _mm_set1_ps(cx), y0 = _mm_set1_ps(cy), z0 = _mm_set1_ps(cz);
+    __m128 r2 = _mm_set1_ps(radius2);
+    int n = 0, i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(px + i), x0);
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(py + i), y0);
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(pz + i), z0);
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        d2 = _mm_add_ps(d2, _mm_mul_ps(dz, dz));
+        unsigned mask = _mm_movemask_ps(_mm_cmplt_ps(d2, r2));
+        if (mask) n += appendMask(mask, i, hits + n);
+    }
+    return n + pickSphereScalar(px, py, pz, i, count, cx, cy, cz, radius2, hits + n);
+}
+
+static int pickBoxSSE2(const float* px, const float* py, const float* pz, int count,
+                       float minX, float minY, float minZ,
+                       float maxX, float maxY, float maxZ, int* hits) {
+    __m128 lx = _mm_set1_ps(minX), ly = _mm_set1_ps(minY), lz = _mm_set1_ps(minZ);
+    __m128 hx = _mm_set1_ps(maxX), hy = _mm_set1_ps(maxY), hz = _mm_set1_ps(maxZ);
+    int n = 0, i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(px + i);
+        __m128 y = _mm_loadu_ps(py + i);
+        __m128 z = _mm_loadu_ps(pz + i);
+        __m128 in = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(x, lx), _mm_cmplt_ps(x, hx)),
+                               _mm_and_ps(_mm_cmpgt_ps(y, ly), _mm_cmplt_ps(y, hy)));
+        in = _mm_and_ps(in, _mm_and_ps(_mm_cmpgt_ps(z, lz), _mm_cmplt_ps(z, hz)));
+        unsigned mask = _mm_movemask_ps(in);
+        if (mask) n += appendMask(mask, i, hits + n);
+    }
+    return n + pickBoxScalar(px, py, pz, i, count, minX, minY, minZ, maxX, maxY, maxZ, hits + n);
+}
+
+/*  ============== AVX2 kernels (8 vertices per step) ============== */
+__attribute__((target("avx2")))
+static int pickSphereAVX2(const float* px, const float* py, const float* pz, int count,
+                          float cx, float cy, float cz, float radius2, int* hits) {
+    __m256 x0 = _mm256_set1_ps(cx), y0 = _mm256_set1_ps(cy), z0 = _mm256_set1_ps(cz);
+    __m256 r2 = _mm256_set1_ps(radius2);
+    int n = 0, i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(px + i), x0);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(py + i), y0);
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(pz + i), z0);
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        d2 = _mm256_add_ps(d2, _mm256_mul_ps(dz, dz));
+        unsigned mask = _mm256_movemask_ps(_mm256_cmp_ps(d2, r2, _CMP_LT_OQ));
+        if (mask) n += appendMask(mask, i, hits + n);
+    }
+    return n + pickSphereScalar(px, py, pz, i, count, cx, cy, cz, radius2, hits + n);
+}
+
+__attribute__((target("avx2")))
+static int pickBoxAVX2(const float* px, const float* py, const float* pz, int count,
+                       float minX, float minY, float minZ,
+                       float maxX, float maxY, float maxZ, int* hits) {
+    __m256 lx = _mm256_set1_ps(minX), ly = _mm256_set1_ps(minY), lz = _mm256_set1_ps(minZ);
+    __m256 hx = _mm256_set1_ps(maxX), hy = _mm256_set1_ps(maxY), hz = _mm256_set1_ps(maxZ);
+    int n = 0, i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(px + i);
+        __m256 y = _mm256_loadu_ps(py + i);
+        __m256 z = _mm256_loadu_ps(pz + i);
+        __m256 in = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, lx, _CMP_GT_OQ), _mm256_cmp_ps(x, hx, _CMP_LT_OQ)),
+                                  _mm256_and_ps(_mm256_cmp_ps(y, ly, _CMP_GT_OQ), _mm256_cmp_ps(y, hy, _CMP_LT_OQ)));
+        in = _mm256_and_ps(in, _mm256_and_ps(_mm256_cmp_ps(z, lz, _CMP_GT_OQ), _mm256_cmp_ps(z, hz, _CMP_LT_OQ)));
+        unsigned mask = _mm256_movemask_ps(in);
+        if (mask) n += appendMask(mask, i, hits + n);
+    }
+    return n + pickBoxScalar(px, py, pz, i, count, minX, minY, minZ, maxX, maxY, maxZ, hits + n);
+}
+
+/*  ============== Facing signs ==============
+	The sign is lt - gt of the two compare masks (each -1 or 0),
+	narrowed to bytes with saturating packs
+	========================================== */
+static void pickFacingSSE2(const float* nx, const float* nz, int count,
+                           float lookX, float lookZ, signed char* facing) {
+    __m128 lx = _mm_set1_ps(lookX), lz = _mm_set1_ps(lookZ);
+    __m128 zero = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 d = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(nx + i), lx),
+                              _mm_mul_ps(_mm_loadu_ps(nz + i), lz));
+        __m128i sign = _mm_sub_epi32(_mm_castps_si128(_mm_cmplt_ps(d, zero)),
+                                     _mm_castps_si128(_mm_cmpgt_ps(d, zero)));
+        sign = _mm_packs_epi32(sign, sign);
+        sign = _mm_packs_epi16(sign, sign);
+        int packed = _mm_cvtsi128_si32(sign);
+        memcpy(facing + i, &packed, 4);
+    }
+    pickFacingScalar(nx, nz, i, count, lookX, lookZ, facing);
+}
+
+__attribute__((target("avx2")))
+static void pickFacingAVX2(const float* nx, const float* nz, int count,
+                           float lookX, float lookZ, signed char* facing) {
+    __m256 lx = _mm256_set1_ps(lookX), lz = _mm256_set1_ps(lookZ);
+    __m256 zero = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 d = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(nx + i), lx),
+                                 _mm256_mul_ps(_mm256_loadu_ps(nz + i), lz));
+        __m256i sign = _mm256_sub_epi32(_mm256_castps_si256(_mm256_cmp_ps(d, zero, _CMP_LT_OQ)),
+                                        _mm256_castps_si256(_mm256_cmp_ps(d, zero, _CMP_GT_OQ)));
+        // the packs work within 128 bit lanes, so narrow the halves together
+        __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(sign),
+                                        _mm256_extracti128_si256(sign, 1));
+        _mm_storel_epi64((__m128i*)(facing + i), _mm_packs_epi16(words, words));
+    }
+    pickFacingScalar(nx, nz, i, count, lookX, lookZ, facing);
+}
+
+#endif
+
+/*  ============== Dispatch ==============
+	Chosen once, the first time a kernel is used
+	====================================== */
+enum pickKernel { PICK_SCALAR, PICK_SSE2, PICK_AVX2 };
+
+// PLY_PICK_KERNEL=scalar|sse2 forces a narrower kernel, to compare them
+static pickKernel detectKernel() {
+    const char* forced = getenv("PLY_PICK_KERNEL");
+    if (forced != NULL && strcmp(forced, "scalar") == 0) return PICK_SCALAR;
+#ifdef PICK_X86
+    __builtin_cpu_init();
+    if (forced == NULL || strcmp(forced, "sse2") != 0) {
+        if (__builtin_cpu_supports("avx2")) return PICK_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) return PICK_SSE2;
+#endif
+    return PICK_SCALAR;
+}
+
+static pickKernel activeKernel() {
+    static const pickKernel kernel = detectKernel();
+    return kernel;
+}
+
+int pickSphere(const float* px, const float* py, const float* pz, int count,
+               float cx, float cy, float cz, float radius2, int* hits) {
+    switch (activeKernel()) {
+#ifdef PICK_X86
+        case PICK_AVX2: return pickSphereAVX2(px, py, pz, count, cx, cy, cz, radius2, hits);
+        case PICK_SSE2: return pickSphereSSE2(px, py, pz, count, cx, cy, cz, radius2, hits);
+#endif
+        default: return pickSphereScalar(px, py, pz, 0, count, cx, cy, cz, radius2, hits);
+    }
+}
+
+int pickBox(const float* px, const float* py, const float* pz, int count,
+            float minX, float minY, float minZ,
+            float maxX, float maxY, float maxZ, int* hits) {
+    switch (activeKernel()) {
+#ifdef PICK_X86
+        case PICK_AVX2: return pickBoxAVX2(px, py, pz, count, minX, minY, minZ, maxX, maxY, maxZ, hits);
+        case PICK_SSE2: return pickBoxSSE2(px, py, pz, count, minX, minY, minZ, maxX, maxY, maxZ, hits);
+#endif
+        default: return pickBoxScalar(px, py, pz, 0, count, minX, minY, minZ, maxX, maxY, maxZ, hits);
+    }
+}
+
+void pickFacing(const float* nx, const float* nz, int count,
+                float lookX, float lookZ, signed char* facing) {
+    switch (activeKernel()) {
+#ifdef PICK_X86
+        case PICK_AVX2: pickFacingAVX2(nx, nz, count, lookX, lookZ, facing); return;
+        case PICK_SSE2: pickFacingSSE2(nx, nz, count, lookX, lookZ, facing); return;
+#endif
+        default: pickFacingScalar(nx, nz, 0, count, lookX, lookZ, facing);
+    }
+}
+
+const char* pickKernelName() {
+    switch (activeKernel()) {
+        case PICK_AVX2: return "avx2";
+        case PICK_SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
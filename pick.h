@@ -0,0 +1,48 @@
+/*  =================== File Information =================
+        File Name: pick.h
+        Description: Vertex range queries over structure-of-arrays positions
+        Author:
+
+        Purpose: Finds every vertex inside a sphere or an open box,
+                 and which faces are turned towards the viewer.
+                 The kernels are picked at runtime for the CPU (AVX2, SSE2
+                 or plain C++); every version evaluates the same float
+                 expression in the same order, so they all return the
+                 same hits, in ascending vertex order.
+        ===================================================== */
+#ifndef PICK_H
+#define PICK_H
+
+/*  ===============================================
+      Desc: Writes to hits every i in [0, count) with
+            (px-cx)^2 + (py-cy)^2 + (pz-cz)^2 < radius2
+      Precondition: hits has room for count entries
+      Returns: the number of hits written
+    =============================================== */
+int pickSphere(const float* px, const float* py, const float* pz, int count,
+               float cx, float cy, float cz, float radius2, int* hits);
+
+/*  ===============================================
+      Desc: Writes to hits every i in [0, count) strictly inside
+            the box (minX, minY, minZ) - (maxX, maxY, maxZ)
+      Precondition: hits has room for count entries
+      Returns: the number of hits written
+    =============================================== */
+int pickBox(const float* px, const float* py, const float* pz, int count,
+            float minX, float minY, float minZ,
+            float maxX, float maxY, float maxZ, int* hits);
+
+/*  ===============================================
+      Desc: Writes to facing, for every face i in [0, count), the sign
+            of nx[i] * lookX + nz[i] * lookZ: 1 for a face turned
+            towards the look vector, -1 for one turned away, 0 when
+            it is edge on or has no normal
+      Precondition: facing has room for count entries
+    =============================================== */
+void pickFacing(const float* nx, const float* nz, int count,
+                float lookX, float lookZ, signed char* facing);
+
+// Name of the kernels in use ("avx2", "sse2" or "scalar")
+const char* pickKernelName();
+
+#endif
@@ -6,20 +6,28 @@
   ===================================================== */
 #include <iostream>
 #include <string>
-#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <charconv>
+#include <vector>
+#include <algorithm>
 #include <stdio.h>
 #include <cstdlib>
-#include <GL/glui.h>
+#include <memory>
 #include "ply.h"
 #include "geometry.h"
+#include "mappedfile.h"
+#include "meshcache.h"
+#include "implicit.h"
+#include "xpbd.h"
 #include <math.h>
-#include "Algebra.h"
+#include "AlgebraF.h"
 
-#define KS 1
+#define KS 1      // default spring stiffness, see setStiffness
 #define KV 0
 #define GRAVITY 1
 #define M 1
-#define DT .01
+#define DT .01     // default time step, see setTimeStep
 
 using namespace std;
 
@@ -27,19 +35,50 @@ using namespace std;
       Desc: Default constructor for a ply object
       Precondition: _filePath is set to a valid filesystem location
             which contains a valid .ply file (triangles only)
-      Postcondition: vertexList, faceList are filled in
+      Postcondition: vertexList, faceList are filled in, or the mesh
+            is empty and getLoadError says why
     =============================================== */ 
-ply::ply(string _filePath){
+ply::ply(string _filePath, WorkerPool* pool){
+        initialize(pool);
         filePath = _filePath;
-        vertexList = NULL;
-        faceList = NULL;
+        // Call helper function to load geometry
+        loadGeometry();
+}
+
+/*  ===============================================
+      Desc: Makes another instance of a loaded mesh
+      Precondition: _geometry is loaded and has not been deformed or
+            stepped since
+      Postcondition: the mesh is at the rest positions of _geometry
+    =============================================== */
+ply::ply(shared_ptr<ply> _geometry, WorkerPool* pool){
+        initialize(pool);
+        geometry = _geometry;
+        filePath = geometry->filePath;
+        instantiate();
+}
+
+void ply::initialize(WorkerPool* pool){
+        format = PLY_ASCII;
         edgeList = NULL;
-        properties = 0; 
+        faceStart = NULL;
+        incidentFaces = NULL;
+        vertexMoved = NULL;
+        faceEpoch = NULL;
+        vertexEpoch = NULL;
+        workers = pool ? pool : &WorkerPool::shared();
+        integrator = PLY_EXPLICIT;
+        timeStep = DT;
+        stiffness = KS;
+        allMoved = false;
+        allUpdated = true;
+        smoothNormals = false;
+        normalEpoch = 0;
 		vertexCount = 0;
 		faceCount = 0;
 		edgeCount = 0;
-        // Call helper function to load geometry
-        loadGeometry();
+		boundaryEdgeCount = 0;
+		nonManifoldEdgeCount = 0;
 }
 
 /*  ===============================================
@@ -54,163 +93,773 @@ inline float sqt(float n) {
     return sqrt(n < 0 ? 0 : n);
 }
 
-void ply::deconstruct(){
-  int i;
-  // Delete the allocated arrays
-  delete[] vertexList;
+// Maps a type name from a property line (both the "float" and the
+// "float32" spellings are in use) to a plyType
+static plyType parsePlyType(const char* name) {
+    if (name == NULL) return PLY_NOTYPE;
+    if (!strcmp(name, "char")   || !strcmp(name, "int8"))    return PLY_INT8;
+    if (!strcmp(name, "uchar")  || !strcmp(name, "uint8"))   return PLY_UINT8;
+    if (!strcmp(name, "short")  || !strcmp(name, "int16"))   return PLY_INT16;
+    if (!strcmp(name, "ushort") || !strcmp(name, "uint16"))  return PLY_UINT16;
+    if (!strcmp(name, "int")    || !strcmp(name, "int32"))   return PLY_INT32;
+    if (!strcmp(name, "uint")   || !strcmp(name, "uint32"))  return PLY_UINT32;
+    if (!strcmp(name, "float")  || !strcmp(name, "float32")) return PLY_FLOAT32;
+    if (!strcmp(name, "double") || !strcmp(name, "float64")) return PLY_FLOAT64;
+    return PLY_NOTYPE;
+}
 
-  for (i = 0; i < faceCount; i++) {
-          delete [] faceList[i].vertexList;
-  }
+// Bytes taken by one value of the given type in a binary body
+static int plyTypeSize(plyType type) {
+    switch (type) {
+        case PLY_INT8:  case PLY_UINT8:   return 1;
+        case PLY_INT16: case PLY_UINT16:  return 2;
+        case PLY_INT32: case PLY_UINT32:  case PLY_FLOAT32: return 4;
+        case PLY_FLOAT64: return 8;
+        default: return 0;
+    }
+}
+
+static bool hostIsLittleEndian() {
+    unsigned int one = 1;
+    return *(unsigned char*)&one == 1;
+}
+
+// Reads one T from unaligned memory, reversing the bytes if asked
+template <typename T>
+static T readRaw(const char* p, bool swap) {
+    T value;
+    if (swap) {
+        char reversed[sizeof(T)];
+        for (size_t i = 0; i < sizeof(T); i++) {
+            reversed[i] = p[sizeof(T) - 1 - i];
+        }
+        memcpy(&value, reversed, sizeof(T));
+    } else {
+        memcpy(&value, p, sizeof(T));
+    }
+    return value;
+}
+
+// Reads one binary value of the given type
+static double readPlyValue(const char* p, plyType type, bool swap) {
+    switch (type) {
+        case PLY_INT8:    return readRaw<signed char>(p, swap);
+        case PLY_UINT8:   return readRaw<unsigned char>(p, swap);
+        case PLY_INT16:   return readRaw<short>(p, swap);
+        case PLY_UINT16:  return readRaw<unsigned short>(p, swap);
+        case PLY_INT32:   return readRaw<int>(p, swap);
+        case PLY_UINT32:  return readRaw<unsigned int>(p, swap);
+        case PLY_FLOAT32: return readRaw<float>(p, swap);
+        case PLY_FLOAT64: return readRaw<double>(p, swap);
+        default: return 0;
+    }
+}
+
+// Largest value of an integer type, used to bring integer colors into 0..1
+static float plyTypeRange(plyType type) {
+    switch (type) {
+        case PLY_INT8:   return 127;
+        case PLY_UINT8:  return 255;
+        case PLY_INT16:  return 32767;
+        case PLY_UINT16: return 65535;
+        default: return 1;
+    }
+}
+
+/*  ===============================================
+      Desc: Builds the decode plan for a vertex element
+            Properties are matched to the vertex by name; anything the
+            vertex has no field for (normals, uv, ...) is left out of the
+            plan so the decoders can skip it.
+      Returns: the fields to extract, in declaration order
+      =============================================== */
+static vector<plyField> vertexFields(const plyElement &element) {
+    vector<plyField> fields;
+    for (size_t k = 0; k < element.properties.size(); k++) {
+        const plyProperty &property = element.properties[k];
+        if (property.isList) continue;
+
+        const string &name = property.name;
+        plyField field;
+        field.property = (int)k;
+        field.scale = 1;
+        if (name == "x") field.target = &VertexStore::px;
+        else if (name == "y") field.target = &VertexStore::py;
+        else if (name == "z") field.target = &VertexStore::pz;
+        else if (name == "confidence") field.target = &VertexStore::confidence;
+        else if (name == "intensity") field.target = &VertexStore::intensity;
+        else if (name == "r" || name == "red" || name == "diffuse_red") field.target = &VertexStore::r;
+        else if (name == "g" || name == "green" || name == "diffuse_green") field.target = &VertexStore::g;
+        else if (name == "b" || name == "blue" || name == "diffuse_blue") field.target = &VertexStore::b;
+        else continue;
+
+        if (field.target == &VertexStore::r || field.target == &VertexStore::g || field.target == &VertexStore::b) {
+            field.scale = 1 / plyTypeRange(property.type);
+        }
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+// Index of the list holding a face's vertex indices, or -1 if it has none
+static int faceIndexProperty(const plyElement &element) {
+    int firstList = -1;
+    for (size_t k = 0; k < element.properties.size(); k++) {
+        const plyProperty &property = element.properties[k];
+        if (!property.isList) continue;
+        if (property.name == "vertex_indices" || property.name == "vertex_index") return (int)k;
+        if (firstList < 0) firstList = (int)k;
+    }
+    return firstList;
+}
+
+void ply::deconstruct(){
+  // The arrays live in the arena: the next reserve (or the arena's
+  // destructor) frees them all at once
+  vertexList.release();
+  faceList.release();
+  implicitSolver.release();
+  xpbdSolver.release();
+  cache.close();
+  geometry.reset();
+  // contacts picked on the old mesh
+  contactVertices.clear();
+  contactPushes.clear();
 
-  delete[] faceList;
-  delete[] edgeList;
-  
   // Set pointers to NULL
-  vertexList = NULL;
-  faceList = NULL;
   edgeList = NULL;
+  faceStart = NULL;
+  incidentFaces = NULL;
+  vertexMoved = NULL;
+  faceEpoch = NULL;
+  vertexEpoch = NULL;
 }
 
 /*  ===============================================
       Desc: reloads the geometry for a 3D object
             (or loads a different file)
     =============================================== */ 
-void ply::reload(string _filePath){
+bool ply::reload(string _filePath){
   
   filePath = _filePath;
   deconstruct();
   // Call our function again to load new vertex and face information.
-  loadGeometry();
+  return loadGeometry();
+}
+
+const string& ply::getLoadError(){ return loadError; }
+
+const MeshArena& ply::getArena(){ return arena; }
+
+// PLY_CACHE=0 turns the mesh cache off
+static bool cacheDefault(){
+    const char* setting = getenv("PLY_CACHE");
+    return setting == NULL || strcmp(setting, "0") != 0;
+}
+bool ply::cacheEnabled = cacheDefault();
+
+void ply::setCacheEnabled(bool enabled){ cacheEnabled = enabled; }
+bool ply::getCacheEnabled(){ return cacheEnabled; }
+bool ply::loadedFromCache(){ return cache.data() != NULL; }
+
+/*  ===============================================
+      Desc: Estimates the arena bytes of the mesh from the header
+            counts.  Edges are counted with Euler's formula, E = V + F
+            (exact up to a few for closed triangle meshes); polygons
+            and meshes with more edges spill into the arena's
+            overflow, which the next reload folds back in.
+      Precondition: vertexCount and faceCount are read from the header
+    =============================================== */
+size_t ply::meshBytes(){
+    int edgeGuess = vertexCount + faceCount;
+    return VertexStore::bytesFor(vertexCount)
+        + FaceList::bytesFor(faceCount)
+        + MeshArena::bytesFor<edge>(edgeGuess)
+        + VertexGraph::bytesFor(vertexCount, edgeGuess)
+        + MeshArena::bytesFor<int>(vertexCount + 1)
+        + MeshArena::bytesFor<int>(3 * (size_t)faceCount)
+        + MeshArena::bytesFor<unsigned char>(vertexCount)
+        + MeshArena::bytesFor<unsigned>(faceCount)
+        + MeshArena::bytesFor<unsigned>(vertexCount)
+        + XpbdSolver::bytesFor(edgeGuess, vertexCount, faceCount)
+        + implicitBytes(edgeGuess);
+}
+
+// The implicit solver's arrays are only taken (on its first step) when
+// that integrator is used, so they are only reserved for when it is
+size_t ply::implicitBytes(int edges){
+    return integrator == PLY_IMPLICIT ? ImplicitSolver::bytesFor(vertexCount, edges) : 0;
 }
 /*  ===============================================
       Desc: Loads the data structures (look at geometry.h and ply.h)
-      Precondition: filePath is something valid, arrays are NULL
+            The whole file is mapped once; the header is read from the
+            mapping and the body is decoded from the same bytes.  When
+            the cache is enabled, a cache of the same contents replaces
+            the decoding and everything finishLoading builds, and a
+            file loaded without one gets a cache written.
+      Precondition: arrays are NULL
       Postcondition: data structures are filled 
-          (including edgeList, this calls scaleAndCenter and findEdges)
+          (including edgeList, this calls scaleAndCenter and findEdges),
+          or, if the file cannot be loaded, hold an empty mesh and
+          loadError says why
+      Returns: false if the file could not be loaded
       =============================================== */ 
-void ply::loadGeometry(){
+bool ply::loadGeometry(){
+    loadError.clear();
+    MappedFile mapped;
+    // if the path is invalid, report it and keep an empty mesh
+    bool ok = mapped.open(filePath);
+    if (!ok) {
+        loadError = "cannot open file " + filePath;
+    }
 
-  /* You will implement this section of code
-        1. Parse the header
-        2.) Update any private or helper variables in the ply.h private section
-        3.) allocate memory for the vertexList 
-            3a.) Populate vertices
-        4.) allocate memory for the faceList
-            4a.) Populate faceList
-  */
+    const char* end  = ok ? mapped.data() + mapped.size() : NULL;
+    const char* body = ok ? parseHeader(mapped.data(), end) : NULL;
+    if (ok && body == NULL) {
+        loadError = "invalid ply header in " + filePath;
+        ok = false;
+    }
 
+    if (ok && cacheEnabled && loadCache(mapped)) return true;
 
-    ifstream myfile (filePath.c_str()); // load the file
-    if ( myfile.is_open()) { // if the file is accessable
-        properties = -2; // set the properties because there are extras labeled
-        
-        string line;
-        char * token_pointer; 
-        char * lineCopy = new char[80]; 
-        int count;
-        bool reading_header = true;
-        // loop for reading the header 
-        while (reading_header && getline ( myfile, line)) {
-
-            // get the first token in the line, this will determine which
-            // action to take. 
-            strcpy(lineCopy, line.c_str());
-            token_pointer = strtok(lineCopy, " ");
-            // case when the element label is spotted:
-            if (strcmp(token_pointer, "element") == 0){
-                token_pointer = strtok(NULL, " ");
-
-                // When the vertex token is spotted read in the next token
-                // and use it to set the vertexCount and initialize vertexList
-                if (strcmp(token_pointer, "vertex") == 0){
-                    token_pointer = strtok(NULL, " ");
-                    vertexCount = atoi(token_pointer);
-                    vertexList = new vertex[vertexCount];
-                }
+    if (ok) {
+        arena.reserve(meshBytes());
+        vertexList.allocate(vertexCount, arena);
+        faceList.allocate(faceCount, arena);
+    }
+    if (ok && format == PLY_ASCII) {
+        ok = loadAsciiBody(body, end);
+    } else if (ok) {
+        ok = loadBinaryBody(body, end);
+    }
+
+    if (!ok) {
+        vertexCount = 0;
+        faceCount = 0;
+        elements.clear();
+        arena.reserve(meshBytes());
+        vertexList.allocate(0, arena);
+        faceList.allocate(0, arena);
+    }
+    finishLoading();
+    // a cache that cannot be written (no cache directory) only
+    // means the next load decodes again
+    if (ok && cacheEnabled) saveCache(mapped);
+    return ok;
+};
+
+// Records why loading stopped; returns false for the decoders to pass on
+bool ply::failLoad(const string& reason){
+    loadError = reason + " in " + filePath;
+    return false;
+}
 
-                // When the face label is spotted read in the next token and 
-                // use it to set the faceCount and initialize faceList.
-                if (strcmp(token_pointer, "face") == 0){
-                    token_pointer = strtok(NULL, " ");
-                    faceCount = atoi(token_pointer);
-                    faceList = new face[faceCount];
+/*  ===============================================
+      Desc: Parses the header at the start of the file
+            Lines are read straight from the buffer, so there is no
+            limit on their length.
+      Precondition: [p, end) holds the whole file
+      Postcondition: format and elements describe the body, including
+            byte offsets and strides, and vertexCount and faceCount
+            hold the declared counts
+      Returns: the first byte of the body, or NULL if the header is bad
+      =============================================== */
+const char* ply::parseHeader(const char* p, const char* end){
+    format = PLY_ASCII;
+    elements.clear();
+    vertexCount = 0;
+    faceCount = 0;
+
+    bool firstLine = true;
+    while (p < end) {
+        const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+        if (lineEnd == NULL) lineEnd = end;
+        istringstream line(string(p, lineEnd));
+        p = lineEnd < end ? lineEnd + 1 : end;
+
+        string keyword;
+        line >> keyword;
+        if (firstLine) {
+            // every ply file starts with the magic word
+            if (keyword != "ply") return NULL;
+            firstLine = false;
+            continue;
+        }
+
+        // the format line says whether the body is text or binary
+        if (keyword == "format") {
+            string name;
+            line >> name;
+            if (name == "binary_little_endian") format = PLY_BINARY_LE;
+            else if (name == "binary_big_endian") format = PLY_BINARY_BE;
+            else if (name == "ascii") format = PLY_ASCII;
+            else return NULL;
+        }
+        // case when the element label is spotted:
+        else if (keyword == "element") {
+            plyElement element;
+            element.count = -1;
+            element.stride = 0;
+            line >> element.name >> element.count;
+            if (element.count < 0) return NULL;
+            elements.push_back(element);
+
+            // the vertex and face counts size the arena and the lists
+            if (element.name == "vertex") vertexCount = element.count;
+            if (element.name == "face") faceCount = element.count;
+        }
+        // a property belongs to the element declared above it
+        else if (keyword == "property") {
+            if (elements.empty()) return NULL;
+
+            plyProperty property;
+            string type;
+            line >> type;
+            property.isList = type == "list";
+            property.countType = PLY_NOTYPE;
+            if (property.isList) {
+                string countType;
+                line >> countType >> type;
+                property.countType = parsePlyType(countType.c_str());
+            }
+            property.type = parsePlyType(type.c_str());
+            if (property.type == PLY_NOTYPE) return NULL;
+            if (property.isList && property.countType == PLY_NOTYPE) return NULL;
+            line >> property.name;
+
+            // lay the property out after the previous one in the record
+            plyElement &element = elements.back();
+            property.offset = -1;
+            if (element.properties.empty()) {
+                property.offset = 0;
+            } else {
+                const plyProperty &previous = element.properties.back();
+                if (previous.offset >= 0 && !previous.isList) {
+                    property.offset = previous.offset + plyTypeSize(previous.type);
                 }
             }
-            // if property label increment the number of properties.
-            if (strcmp(token_pointer, "property") == 0) {properties++;} 
-            // if end_header break the header loop and move to reading vertices.
-            if (strcmp(token_pointer, "end_header") == 0) {reading_header = false; }
+            element.properties.push_back(property);
         }
-        
-        // Read in exactly vertexCount number of lines after reading the header
-        // and set the appropriate vertex in the vertexList.
-        for (int i = 0; i < vertexCount; i++){
-
-            getline ( myfile, line); 
-            strcpy(lineCopy, line.c_str());
-            
-            // depending on how many properties there are set that number of 
-            // elements (x, y, z, confidence, intensity, r, g, b) (max 7) with
-            // the input given
-            if ( properties >= 0){
-                vertexList[i].x = atof(strtok(lineCopy, " "));
+        // end_header is the last line before the body
+        else if (keyword == "end_header") {
+            for (size_t e = 0; e < elements.size(); e++) {
+                plyElement &element = elements[e];
+                element.stride = 0;
+                if (element.properties.empty()) continue;
+                const plyProperty &last = element.properties.back();
+                if (!last.isList && last.offset >= 0) {
+                    element.stride = last.offset + plyTypeSize(last.type);
+                }
             }
-            if ( properties >= 1){
-                vertexList[i].y = atof(strtok(NULL, " "));
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Skips spaces on the current line; false if the line has no more tokens
+static bool skipBlanks(const char*& p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p < end && *p != '\n';
+}
+
+// Parses the next number on the current line in place
+template <typename T>
+static bool parseAscii(const char*& p, const char* end, T& value) {
+    if (!skipBlanks(p, end)) return false;
+    if (*p == '+') p++;
+    value = 0;
+    from_chars_result result = from_chars(p, end, value);
+    // out of range values (denormals) keep 0 but still consume the token
+    if (result.ec != errc() && result.ec != errc::result_out_of_range) return false;
+    p = result.ptr;
+    return true;
+}
+
+// Moves p to the start of the next line
+static void skipLine(const char*& p, const char* end) {
+    const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+    p = lineEnd == NULL ? end : lineEnd + 1;
+}
+
+// Steps over the next token on the current line without converting it
+static bool skipToken(const char*& p, const char* end) {
+    if (!skipBlanks(p, end)) return false;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+    return true;
+}
+
+/*  ===============================================
+      Desc: Decodes an ASCII PLY body from memory
+            One line per element entry.  Only the columns in the decode
+            plan are converted (in place, with from_chars); the columns
+            in between are stepped over and the rest of the line is
+            skipped.  Elements other than vertex and face are skipped
+            a line at a time.
+      Precondition: header parsed, vertexList and faceList allocated
+      Postcondition: vertexList and faceList are populated
+      Returns: false (with loadError set) if the body is malformed
+      =============================================== */
+bool ply::loadAsciiBody(const char* p, const char* end){
+    for (size_t e = 0; e < elements.size(); e++) {
+        const plyElement &element = elements[e];
+        bool isVertex = element.name == "vertex";
+        bool isFace   = element.name == "face";
+
+        // the last column that has to be read on each line
+        vector<plyField> fields;
+        int lastColumn = -1;
+        if (isVertex) {
+            fields = vertexFields(element);
+            if (!fields.empty()) lastColumn = fields.back().property;
+        }
+        if (isFace) {
+            lastColumn = faceIndexProperty(element);
+            if (lastColumn < 0) {
+                return failLoad("face element has no vertex list");
             }
-            if (properties >= 2){
-                vertexList[i].z = atof(strtok(NULL, " "));
+        }
+
+        for (int i = 0; i < element.count; i++) {
+            bool ok = true;
+            size_t f = 0;
+            for (int k = 0; ok && k <= lastColumn; k++) {
+                const plyProperty &property = element.properties[k];
+
+                if (isFace && k == lastColumn) {
+                    int n = 0;
+                    ok = parseAscii(p, end, n) && n >= 0;
+                    if (!ok) break;
+                    int* indices = faceList.addFace(i, n);
+                    for (int j = 0; ok && j < n; j++) {
+                        int index = 0;
+                        ok = parseAscii(p, end, index) && index >= 0 && index < vertexCount;
+                        indices[j] = index;
+                    }
+                } else if (property.isList) {
+                    int n = 0;
+                    ok = parseAscii(p, end, n) && n >= 0;
+                    for (int j = 0; ok && j < n; j++) {
+                        ok = skipToken(p, end);
+                    }
+                } else if (f < fields.size() && fields[f].property == k) {
+                    float value = 0;
+                    ok = parseAscii(p, end, value);
+                    (vertexList.*(fields[f].target))[i] = value * fields[f].scale;
+                    f++;
+                } else {
+                    ok = skipToken(p, end);
+                }
             }
-            if (properties >= 3){
-                vertexList[i].confidence = atof(strtok(NULL, " "));
+            if (!ok) {
+                return failLoad("malformed " + element.name + " " + to_string(i));
             }
-            if (properties >= 4){
-                vertexList[i].intensity = atof(strtok(NULL, " "));
+            skipLine(p, end);
+        }
+    }
+    return true;
+}
+
+/*  ===============================================
+      Desc: Builds everything that is derived from the loaded
+            vertices and faces
+      Precondition: vertexList and faceList are populated
+      Postcondition: the mesh is centered and edgeList and the
+            vertex graph are ready
+      =============================================== */
+void ply::finishLoading(){
+    centerForce = Vectorf();
+    scaleAndCenter();
+    findEdges();
+    vg.construct(&vertexList, edgeList, vertexCount, edgeCount, arena);
+    xpbdSolver.build(edgeList, edgeCount, vertexCount, arena);
+    findIncidentFaces();
+    setXpbdSurface();
+    allocateNormalTables();
+    allMoved = true;
+    updateNormals();
+}
+
+// Bytes every cache section takes for the counts in header; offsets
+// only exist for meshes with polygons
+static void meshCacheBytes(MeshCacheHeader& header, bool polygons){
+    uint64_t vertexFloats = (uint64_t)header.vertexCount * sizeof(float);
+    for (int s = CACHE_PX; s <= CACHE_B; s++) {
+        header.bytes[s] = vertexFloats;
+    }
+    header.bytes[CACHE_INDICES] = (uint64_t)header.indexCount * sizeof(int);
+    header.bytes[CACHE_OFFSETS] = polygons ? ((uint64_t)header.faceCount + 1) * sizeof(int) : 0;
+    for (int s = CACHE_NORM_X; s <= CACHE_NORM_Z; s++) {
+        header.bytes[s] = (uint64_t)header.faceCount * sizeof(float);
+    }
+    header.bytes[CACHE_EDGES] = (uint64_t)header.edgeCount * sizeof(edge);
+    header.bytes[CACHE_NEIGHBOR_START] = ((uint64_t)header.vertexCount + 1) * sizeof(int);
+    header.bytes[CACHE_NEIGHBORS] = 2 * (uint64_t)header.edgeCount * sizeof(int);
+    header.bytes[CACHE_NEIGHBOR_EDGES] = 2 * (uint64_t)header.edgeCount * sizeof(int);
+    header.bytes[CACHE_FACE_START] = ((uint64_t)header.vertexCount + 1) * sizeof(int);
+    // every index puts its face around one vertex
+    header.bytes[CACHE_INCIDENT_FACES] = (uint64_t)header.indexCount * sizeof(int);
+    header.bytes[CACHE_GRID_BUCKETS] = ((uint64_t)VertexGrid::bucketCountFor(header.vertexCount) + 1) * sizeof(int);
+    header.bytes[CACHE_GRID_ORDER] = (uint64_t)header.vertexCount * sizeof(int);
+    header.bytes[CACHE_GRID_KEYS] = (uint64_t)header.vertexCount * sizeof(uint64_t);
+    for (int s = CACHE_GRID_X; s <= CACHE_GRID_Z; s++) {
+        header.bytes[s] = vertexFloats;
+    }
+    header.bytes[CACHE_GRID_SLOT] = (uint64_t)header.vertexCount * sizeof(int);
+    header.bytes[CACHE_XPBD_COLORS] = ((uint64_t)header.xpbdColorCount + 1) * sizeof(int);
+    header.bytes[CACHE_XPBD_V1] = (uint64_t)header.edgeCount * sizeof(int);
+    header.bytes[CACHE_XPBD_V2] = (uint64_t)header.edgeCount * sizeof(int);
+    header.bytes[CACHE_XPBD_REST] = (uint64_t)header.edgeCount * sizeof(float);
+}
+
+/*  ===============================================
+      Desc: Takes the mesh from its cache.  The per-vertex arrays are
+            copied into the arena, next to the velocities and forces
+            the simulation writes; faces, normals, edges and both
+            adjacency tables are used in place from the copy on write
+            mapping, so they cost page faults and no parsing.  The pick
+            grid and the solver's packed edges are copied into their
+            owners without sorting or colouring again.
+      Precondition: the header has been parsed
+      Postcondition: the mesh is loaded exactly as finishLoading left
+            it when the cache was written
+      Returns: false, leaving the mesh untouched, if there is no cache
+            for this source or it does not match the header
+      =============================================== */
+bool ply::loadCache(const MappedFile& source){
+    MeshCacheHeader* header = openMeshCache(cache, meshCachePath(filePath), source);
+    if (header == NULL) return false;
+
+    MeshCacheHeader expected = *header;
+    meshCacheBytes(expected, header->bytes[CACHE_OFFSETS] != 0);
+    bool ok = header->vertexCount == vertexCount && header->faceCount == faceCount
+        && header->indexCount >= 0 && header->edgeCount >= 0
+        && header->xpbdColorCount >= 0;
+    for (int s = 0; ok && s < CACHE_SECTIONS; s++) {
+        ok = header->bytes[s] == expected.bytes[s];
+    }
+    if (!ok) {
+        cache.close();
+        return false;
+    }
+
+    edgeCount = header->edgeCount;
+    boundaryEdgeCount = header->boundaryEdgeCount;
+    nonManifoldEdgeCount = header->nonManifoldEdgeCount;
+    arena.reserve(VertexStore::bytesFor(vertexCount)
+        + VertexGraph::attachBytesFor(vertexCount)
+        + MeshArena::bytesFor<unsigned char>(vertexCount)
+        + MeshArena::bytesFor<unsigned>(faceCount)
+        + MeshArena::bytesFor<unsigned>(vertexCount)
+        + XpbdSolver::restoreBytesFor(edgeCount, vertexCount, faceCount)
+        + implicitBytes(edgeCount));
+
+    vertexList.allocate(vertexCount, arena);
+    float* VertexStore::*stored[] = {
+        &VertexStore::px, &VertexStore::py, &VertexStore::pz,
+        &VertexStore::centerLen, &VertexStore::confidence, &VertexStore::intensity,
+        &VertexStore::r, &VertexStore::g, &VertexStore::b };
+    for (int s = CACHE_PX; s <= CACHE_B; s++) {
+        memcpy(vertexList.*stored[s - CACHE_PX], cache.data() + header->offset[s], header->bytes[s]);
+    }
+
+    faceList.attach(faceCount, header->indexCount,
+                    meshCacheSection<int>(cache, header, CACHE_INDICES),
+                    header->bytes[CACHE_OFFSETS] ? meshCacheSection<int>(cache, header, CACHE_OFFSETS) : NULL,
+                    meshCacheSection<float>(cache, header, CACHE_NORM_X),
+                    meshCacheSection<float>(cache, header, CACHE_NORM_Y),
+                    meshCacheSection<float>(cache, header, CACHE_NORM_Z));
+    edgeList = meshCacheSection<edge>(cache, header, CACHE_EDGES);
+    VertexGridArrays grid;
+    grid.cellSize = header->gridCellSize;
+    grid.bucketStart = meshCacheSection<int>(cache, header, CACHE_GRID_BUCKETS);
+    grid.order = meshCacheSection<int>(cache, header, CACHE_GRID_ORDER);
+    grid.slotKey = meshCacheSection<uint64_t>(cache, header, CACHE_GRID_KEYS);
+    grid.sx = meshCacheSection<float>(cache, header, CACHE_GRID_X);
+    grid.sy = meshCacheSection<float>(cache, header, CACHE_GRID_Y);
+    grid.sz = meshCacheSection<float>(cache, header, CACHE_GRID_Z);
+    grid.slot = meshCacheSection<int>(cache, header, CACHE_GRID_SLOT);
+    vg.attach(&vertexList, vertexCount,
+              meshCacheSection<int>(cache, header, CACHE_NEIGHBOR_START),
+              meshCacheSection<int>(cache, header, CACHE_NEIGHBORS),
+              meshCacheSection<int>(cache, header, CACHE_NEIGHBOR_EDGES), grid, arena);
+    faceStart = meshCacheSection<int>(cache, header, CACHE_FACE_START);
+    incidentFaces = meshCacheSection<int>(cache, header, CACHE_INCIDENT_FACES);
+    xpbdSolver.restore(meshCacheSection<int>(cache, header, CACHE_XPBD_COLORS),
+                       header->xpbdColorCount, header->xpbdSerialColor,
+                       meshCacheSection<int>(cache, header, CACHE_XPBD_V1),
+                       meshCacheSection<int>(cache, header, CACHE_XPBD_V2),
+                       meshCacheSection<float>(cache, header, CACHE_XPBD_REST),
+                       edgeCount, vertexCount, arena);
+    setXpbdSurface();
+    allocateNormalTables();
+
+    // what scaleAndCenter and finishLoading leave
+    center = vertex();
+    center.x = 0;
+    center.y = 0;
+    center.z = 0;
+    center.velocity = Vectorf();
+    centerForce = Vectorf();
+    // the face normals were saved up to date
+    allMoved = false;
+    if (smoothNormals) computeVertexNormals(NULL, vertexCount);
+    return true;
+}
+
+/*  ===============================================
+      Desc: Writes the mesh as finishLoading left it to the cache
+            of the source
+      Precondition: finishLoading has just run, nothing has moved
+      Returns: false if the cache could not be written
+      =============================================== */
+bool ply::saveCache(const MappedFile& source){
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.vertexCount = vertexCount;
+    header.faceCount = faceCount;
+    header.indexCount = faceList.indexCount;
+    header.edgeCount = edgeCount;
+    header.boundaryEdgeCount = boundaryEdgeCount;
+    header.nonManifoldEdgeCount = nonManifoldEdgeCount;
+    VertexGridArrays grid = vg.getGrid().arrays();
+    header.gridCellSize = grid.cellSize;
+    header.xpbdColorCount = xpbdSolver.getColorCount();
+    header.xpbdSerialColor = xpbdSolver.getSerialColor();
+    meshCacheBytes(header, faceList.offsets != NULL);
+
+    const void* sections[CACHE_SECTIONS];
+    sections[CACHE_PX] = vertexList.px;
+    sections[CACHE_PY] = vertexList.py;
+    sections[CACHE_PZ] = vertexList.pz;
+    sections[CACHE_CENTER_LEN] = vertexList.centerLen;
+    sections[CACHE_CONFIDENCE] = vertexList.confidence;
+    sections[CACHE_INTENSITY] = vertexList.intensity;
+    sections[CACHE_R] = vertexList.r;
+    sections[CACHE_G] = vertexList.g;
+    sections[CACHE_B] = vertexList.b;
+    sections[CACHE_INDICES] = faceList.indices;
+    sections[CACHE_OFFSETS] = faceList.offsets;
+    sections[CACHE_NORM_X] = faceList.normX;
+    sections[CACHE_NORM_Y] = faceList.normY;
+    sections[CACHE_NORM_Z] = faceList.normZ;
+    sections[CACHE_EDGES] = edgeList;
+    sections[CACHE_NEIGHBOR_START] = vg.neighborOffsets();
+    sections[CACHE_NEIGHBORS] = vg.neighborArray();
+    sections[CACHE_NEIGHBOR_EDGES] = vg.neighborEdgeArray();
+    sections[CACHE_FACE_START] = faceStart;
+    sections[CACHE_INCIDENT_FACES] = incidentFaces;
+    sections[CACHE_GRID_BUCKETS] = grid.bucketStart;
+    sections[CACHE_GRID_ORDER] = grid.order;
+    sections[CACHE_GRID_KEYS] = grid.slotKey;
+    sections[CACHE_GRID_X] = grid.sx;
+    sections[CACHE_GRID_Y] = grid.sy;
+    sections[CACHE_GRID_Z] = grid.sz;
+    sections[CACHE_GRID_SLOT] = grid.slot;
+    sections[CACHE_XPBD_COLORS] = xpbdSolver.getColorStart();
+    sections[CACHE_XPBD_V1] = xpbdSolver.getEdgeV1();
+    sections[CACHE_XPBD_V2] = xpbdSolver.getEdgeV2();
+    sections[CACHE_XPBD_REST] = xpbdSolver.getRestLen();
+    return writeMeshCache(meshCachePath(filePath), source, header, sections);
+}
+
+/*  ===============================================
+      Desc: Decodes a binary PLY body that has been mapped into memory
+            Records with a fixed stride are addressed directly: the
+            fields in the decode plan are read at their byte offsets and
+            whole elements that are not needed are skipped in one step.
+            Records holding lists are walked property by property.
+            Values are read at their declared width and byte order.
+      Precondition: header parsed, vertexList and faceList allocated
+      Postcondition: vertexList and faceList are populated
+      Returns: false (with loadError set) if the body is malformed
+      =============================================== */
+bool ply::loadBinaryBody(const char* body, const char* end){
+    bool swap = (format == PLY_BINARY_LE) != hostIsLittleEndian();
+    const char* p = body;
+
+    for (size_t e = 0; e < elements.size(); e++) {
+        const plyElement &element = elements[e];
+        bool isVertex = element.name == "vertex";
+        bool isFace   = element.name == "face";
+
+        vector<plyField> fields;
+        int indexProperty = -1;
+        if (isVertex) fields = vertexFields(element);
+        if (isFace) {
+            indexProperty = faceIndexProperty(element);
+            if (indexProperty < 0) {
+                return failLoad("face element has no vertex list");
             }
-            if (properties >= 5){
-                vertexList[i].r = atof(strtok(NULL, " "));
+        }
+
+        if (element.stride > 0) {
+            // fixed size records
+            if ((size_t)(end - p) / element.stride < (size_t)element.count) {
+                return failLoad("unexpected end of file");
             }
-            if (properties >= 6) {
-                vertexList[i].g = atof(strtok(NULL, " "));
+            for (size_t f = 0; f < fields.size(); f++) {
+                const plyProperty &property = element.properties[fields[f].property];
+                const char* value = p + property.offset;
+                for (int i = 0; i < element.count; i++, value += element.stride) {
+                    (vertexList.*(fields[f].target))[i] =
+                        (float)readPlyValue(value, property.type, swap) * fields[f].scale;
+                }
             }
-            if (properties >= 7) {
-                vertexList[i].b = atof(strtok(NULL, " "));
+            p += (size_t)element.count * element.stride;
+            continue;
+        }
+
+        // variable size records, walked one property at a time
+        for (int i = 0; i < element.count; i++) {
+            size_t f = 0;
+            for (int k = 0; p != NULL && k < (int)element.properties.size(); k++) {
+                const plyProperty &property = element.properties[k];
+                int width = plyTypeSize(property.type);
+
+                if (property.isList) {
+                    int countWidth = plyTypeSize(property.countType);
+                    if (end - p < countWidth) {
+                        p = NULL;
+                        break;
+                    }
+                    int n = (int)readPlyValue(p, property.countType, swap);
+                    p += countWidth;
+                    if (n < 0 || end - p < (ptrdiff_t)n * width) {
+                        p = NULL;
+                        break;
+                    }
+                    if (k == indexProperty) {
+                        int* indices = faceList.addFace(i, n);
+                        for (int j = 0; j < n; j++) {
+                            int index = (int)readPlyValue(p + j * width, property.type, swap);
+                            if (index < 0 || index >= vertexCount) {
+                                return failLoad("face " + to_string(i) + " has an invalid vertex");
+                            }
+                            indices[j] = index;
+                        }
+                    }
+                    p += n * width;
+                } else {
+                    if (end - p < width) {
+                        p = NULL;
+                        break;
+                    }
+                    if (f < fields.size() && fields[f].property == k) {
+                        (vertexList.*(fields[f].target))[i] =
+                            (float)readPlyValue(p, property.type, swap) * fields[f].scale;
+                        f++;
+                    }
+                    p += width;
+                }
             }
-        } 
-        
-        // Read in the faces (exactly faceCount number of lines) and set the 
-        // appropriate face in the faceList
-        for (int i = 0; i < faceCount; i++){
-
-            getline ( myfile, line);
-
-            strcpy(lineCopy, line.c_str());
-            count = atoi(strtok(lineCopy, " "));
-            faceList[i].vertexCount = count; // number of vertices stored 
-            faceList[i].vertexList = new int[count]; // initialize the vertices
-            
-            // set the vertices from the input, reading only the number of 
-            // vertices that are specified
-            for (int j = 0; j < count; j++){
-                faceList[i].vertexList[j] = atoi(strtok(NULL, " "));
+            if (p == NULL) {
+                return failLoad("unexpected end of file");
             }
         }
-        delete(lineCopy);
     }
-    // if the path is invalid, report then exit.
-    else {
-		cout << "cannot open file " << filePath.c_str() << "\n";
-        exit(1);
-    }
-    myfile.close();
-
-    forceList   = new Vector[vertexCount];
-    centerForce = Vector();
-    scaleAndCenter();
-    findEdges();
-    vg.construct(vertexList, edgeList, vertexCount, edgeCount);
-};
+    return true;
+}
 
 /*  ===============================================
 Desc: Moves all the geometry so that the object is centered at 0, 0, 0 and scaled to be between 0.5 and -0.5
@@ -228,14 +877,14 @@ void ply::scaleAndCenter() {
     for (i = 0; i < vertexCount; i++){
         
         // obtain the total for each property of the vertex
-        avrg_x += vertexList[i].x;
-        avrg_y += vertexList[i].y;
-        avrg_z += vertexList[i].z;
+        avrg_x += vertexList.px[i];
+        avrg_y += vertexList.py[i];
+        avrg_z += vertexList.pz[i];
 
         // obtain the max dimension to find the furthest point from 0,0
-        if (max < (vertexList[i].x)) max = (vertexList[i].x);
-        if (max < (vertexList[i].y)) max = (vertexList[i].y);
-        if (max < (vertexList[i].z)) max = (vertexList[i].z);
+        if (max < (vertexList.px[i])) max = (vertexList.px[i]);
+        if (max < (vertexList.py[i])) max = (vertexList.py[i]);
+        if (max < (vertexList.pz[i])) max = (vertexList.pz[i]);
     }
     // compute the average for each property
     avrg_x = avrg_x / vertexCount;
@@ -247,63 +896,22 @@ void ply::scaleAndCenter() {
 
     // center and scale each vertex 
     for (i = 0; i < vertexCount; i++){
-        vertexList[i].x = (vertexList[i].x - avrg_x) / max;
-        vertexList[i].y = (vertexList[i].y - avrg_y) / max;
-        vertexList[i].z = (vertexList[i].z - avrg_z) / max;
+        vertexList.px[i] = (vertexList.px[i] - avrg_x) / max;
+        vertexList.py[i] = (vertexList.py[i] - avrg_y) / max;
+        vertexList.pz[i] = (vertexList.pz[i] - avrg_z) / max;
     }
 
     center   = vertex();
     center.x = 0;
     center.y = 0;
     center.z = 0;
-    center.velocity = Vector();
-}
-
-/*  ===============================================
-      Desc: Draws a filled 3D object
-      Precondition: arrays are EITHER valid data OR NULL
-      Postcondition: no changes to data
-      Error Condition: If we haven't allocated memory for our
-      faceList or vertexList then do not attempt to render.
-    =============================================== */  
-void ply::render(){
-    if(vertexList==NULL || faceList==NULL){
-                return;
-    }
-
-    glPushMatrix();
-    glTranslatef(getXPosition(),getYPosition(),getZPosition());
-    glScalef(getXScale(),getYScale(),getZScale());
-    // For each of our faces
-    glBegin(GL_TRIANGLES);
-          for(int i = 0; i < faceCount; i++) {
-            // All of our faces are actually triangles for PLY files
-                        // Get the vertex list from the face list
-                        int index0 = faceList[i].vertexList[0];
-                        int index1 = faceList[i].vertexList[1];
-                        int index2 = faceList[i].vertexList[2];
-
-                        setNormal(i, vertexList[index0].x, vertexList[index0].y, vertexList[index0].z,
-                                          vertexList[index1].x, vertexList[index1].y, vertexList[index1].z,
-                                          vertexList[index2].x, vertexList[index2].y, vertexList[index2].z);
-
-            for(int j = 0; j < faceList[i].vertexCount; j++){
-                                // Get each vertices x,y,z and draw them
-                int index = faceList[i].vertexList[j];
-                glColor3f(vertexList[index].x,fabs(vertexList[index].y),fabs(vertexList[index].z));
-                glVertex3f(vertexList[index].x,vertexList[index].y,vertexList[index].z);
-            }
-        }
-        glEnd();        
-        glPopMatrix();
+    center.velocity = Vectorf();
 }
 
 float ply::findLen (int i1, int i2) {
-    vertex v1 = vertexList[i1];
-    vertex v2 = vertexList[i2];
-    float xd = v2.x - v1.x;
-    float yd = v2.y - v1.y;
-    float zd = v2.z - v1.z;
+    float xd = vertexList.px[i2] - vertexList.px[i1];
+    float yd = vertexList.py[i2] - vertexList.py[i1];
+    float zd = vertexList.pz[i2] - vertexList.pz[i1];
 
     float l = sqt(xd*xd + yd*yd + zd*zd);
 
@@ -311,156 +919,544 @@ float ply::findLen (int i1, int i2) {
 }
 
 float ply::findCenterLen (int index) {
-    vertex v = vertexList[index];
-
-    float xd = center.x - v.x;
-    float yd = center.y - v.y;
-    float zd = center.z - v.z;
+    float xd = center.x - vertexList.px[index];
+    float yd = center.y - vertexList.py[index];
+    float zd = center.z - vertexList.pz[index];
     
     float l  = sqt(xd*xd + yd*yd + zd*zd);
  
     return l;
 }
 
-Point ply::asPoint(int index) {
-    vertex v = vertexList[index];
-    return Point(v.x, v.y, v.z);
+Pointf ply::asPoint(int index) {
+    return vertexList.position(index);
 }
 
-Vector ply::computeEdgeContribution(edge e) {
+Vectorf ply::computeEdgeContribution(const edge &e) {
     int v1 = e.vertices[0];
     int v2 = e.vertices[1];
 
-    Vector d = asPoint(v2) - asPoint(v1);
+    Vectorf d = asPoint(v2) - asPoint(v1);
 
     float x  = findLen(v1, v2) - e.len; 
 
-    Vector fVec = d * x;
+    Vectorf fVec = d * x;
 
-    return fVec * KS;
+    return fVec * stiffness;
 }
 
 
-Vector ply::computeVolumeContribution(int index) {
-    vertex v = vertexList[index];
-    Vector d = Point(center.x, center.y, center.z) - asPoint(index);
+Vectorf ply::computeVolumeContribution(int index) {
+    Vectorf d = Pointf(center.x, center.y, center.z) - asPoint(index);
 
-    float x = findCenterLen(index) - v.centerLen;
+    float x = findCenterLen(index) - vertexList.centerLen[index];
 
-    Vector fVec = d * x;
+    Vectorf fVec = d * x;
     return fVec * KV;
 }
-bool ply::deformModel(Point p1, Point p2, Vector transform) {
-    auto vertices = vg.pickVerts(p1, p2);
+bool ply::getBounds(float lo[3], float hi[3]) {
+    return vg.getGrid().bounds(lo, hi);
+}
 
-    for (auto vert : vertices) {
-        vg.deform(vert, transform, 5);
+bool ply::getWorldBounds(float lo[3], float hi[3]) {
+    if (!getBounds(lo, hi)) return false;
+    float position[3] = { getXPosition(), getYPosition(), getZPosition() };
+    float scale[3] = { getXScale(), getYScale(), getZScale() };
+    for (int a = 0; a < 3; a++) {
+        float from = lo[a] * scale[a] + position[a];
+        float to = hi[a] * scale[a] + position[a];
+        lo[a] = from < to ? from : to;
+        hi[a] = from < to ? to : from;
     }
+    return true;
+}
 
-    if (vertices.size() > 0) {
-        return true;
+/*  ===============================================
+      Desc: Gathers the contact of a sphere pushing by push, both in
+            world space, for deformContacts.  They are brought into
+            the mesh's own space through its entity position and scale;
+            under a scale that differs per axis the sphere is an
+            ellipsoid there, so the vertices picked around it are kept
+            only if they lie inside it.
+      Returns: whether any vertex was hit
+    =============================================== */
+bool ply::addSphereContact(const Pointf& p, float radius, const Vectorf& push) {
+    float scale[3] = { getXScale(), getYScale(), getZScale() };
+    if (scale[0] == 0 || scale[1] == 0 || scale[2] == 0) return false;
+    Pointf local((p[0] - getXPosition()) / scale[0],
+                 (p[1] - getYPosition()) / scale[1],
+                 (p[2] - getZPosition()) / scale[2]);
+    Vectorf localPush(push[0] / scale[0], push[1] / scale[1], push[2] / scale[2]);
+    float sx = fabsf(scale[0]), sy = fabsf(scale[1]), sz = fabsf(scale[2]);
+    bool uniform = sx == sy && sy == sz;
+
+    float smallest = sx < sy ? (sx < sz ? sx : sz) : (sy < sz ? sy : sz);
+    int hitCount = vg.pickVerts(local, radius / smallest);
+    const int* hits = vg.hits();
+    size_t before = contactVertices.size();
+    for (int k = 0; k < hitCount; k++) {
+        int v = hits[k];
+        float dx = (vertexList.px[v] - local[0]) * scale[0];
+        float dy = (vertexList.py[v] - local[1]) * scale[1];
+        float dz = (vertexList.pz[v] - local[2]) * scale[2];
+        if (uniform || dx * dx + dy * dy + dz * dz < radius * radius) {
+            contactVertices.push_back(v);
+            contactPushes.push_back(localPush);
+        }
     }
-    return false;
+    return contactVertices.size() > before;
+}
+
+// addSphereContact for an open box
+bool ply::addBoxContact(const Pointf& p1, const Pointf& p2, const Vectorf& push) {
+    float position[3] = { getXPosition(), getYPosition(), getZPosition() };
+    float scale[3] = { getXScale(), getYScale(), getZScale() };
+    if (scale[0] == 0 || scale[1] == 0 || scale[2] == 0) return false;
+    float lo[3], hi[3];
+    for (int a = 0; a < 3; a++) {
+        float from = (p1[a] - position[a]) / scale[a];
+        float to = (p2[a] - position[a]) / scale[a];
+        // a negative scale turns the box around
+        lo[a] = from < to ? from : to;
+        hi[a] = from < to ? to : from;
+    }
+    Vectorf localPush(push[0] / scale[0], push[1] / scale[1], push[2] / scale[2]);
+    int hitCount = vg.pickVerts(Pointf(lo[0], lo[1], lo[2]), Pointf(hi[0], hi[1], hi[2]));
+    const int* hits = vg.hits();
+    for (int k = 0; k < hitCount; k++) {
+        contactVertices.push_back(hits[k]);
+        contactPushes.push_back(localPush);
+    }
+    return hitCount > 0;
+}
+
+/*  ===============================================
+      Desc: Pushes the mesh at every gathered contact in one deform.
+            A vertex under several contacts moves by the sum of their
+            pushes, as it would have one contact after the other; the
+            vertices around them move with the nearest one.
+      Postcondition: no contacts are left gathered
+    =============================================== */
+void ply::deformContacts() {
+    if (contactVertices.empty()) return;
+    vg.deform(contactVertices.data(), contactPushes.data(), (int)contactVertices.size(), 5);
+    markMoved(vg.deformed(), vg.deformedCount());
+    contactVertices.clear();
+    contactPushes.clear();
+}
 
+bool ply::deformModel(const Pointf& p1, const Pointf& p2, const Vectorf& transform) {
+    int hitCount = vg.pickVerts(p1, p2);
+    // one traversal for all hit vertices, each neighbor moves once
+    vg.deform(vg.hits(), hitCount, transform, 5);
+    markMoved(vg.deformed(), vg.deformedCount());
+
+    return hitCount > 0;
 }
 
-bool ply::deformModel(Point p, float radius, Vector transform) {
-    auto vertices = vg.pickVerts(p, radius);
+bool ply::deformModel(const Pointf& p, float radius, const Vectorf& transform) {
+    int hitCount = vg.pickVerts(p, radius);
+    // one traversal for all hit vertices, each neighbor moves once
+    vg.deform(vg.hits(), hitCount, transform, 5);
+    markMoved(vg.deformed(), vg.deformedCount());
 
-    for (auto vert : vertices) {
-        vg.deform(vert, transform, 5);
+    return hitCount > 0;
+}
+void ply::deformModel(float x, float y, const Matrixf& transform) {
+    int i = vg.pickVert(x, y);
+    if (i >= 0) {
+        vg.deform(i, transform * Vectorf(0, 0, -0.0005f), 5);
+        markMoved(vg.deformed(), vg.deformedCount());
     }
+}
+void ply::computeNormals() {
+    computeNormals(vertexList.px, vertexList.py, vertexList.pz,
+                   faceList.normX, faceList.normY, faceList.normZ);
+}
 
-    if (vertices.size() > 0) {
-        return true;
+// faces per chunk below which threads cost more than they save
+#define NORMAL_MIN_CHUNK 4096
+// updateNormals recomputes everything once more than this fraction
+// of the vertices moved
+#define NORMAL_FULL_FRACTION 4
+
+// unit normal of a face from its first three vertices, zero for
+// degenerate faces instead of NaN
+static inline void faceNormal(const int* face, const float* px, const float* py, const float* pz,
+                              float& nx, float& ny, float& nz) {
+    int a = face[0], b = face[1], c = face[2];
+
+    // (p0 - p1) x (p1 - p2)
+    float v1x = px[a] - px[b], v1y = py[a] - py[b], v1z = pz[a] - pz[b];
+    float v2x = px[b] - px[c], v2y = py[b] - py[c], v2z = pz[b] - pz[c];
+    float cx = v1y * v2z - v1z * v2y;
+    float cy = v1z * v2x - v1x * v2z;
+    float cz = v1x * v2y - v1y * v2x;
+
+    float length = sqt(cx * cx + cy * cy + cz * cz);
+    if (length > 0) {
+        cx /= length;
+        cy /= length;
+        cz /= length;
     }
-    return false;
+    nx = cx;
+    ny = cy;
+    nz = cz;
 }
-void ply::deformModel(float x, float y, Matrix transform) {
-    int i = vg.pickVert(x, y);
-    vg.deform(i, transform * Vector(0, 0, -0.0005), 5);
+
+void ply::computeNormals(const float* px, const float* py, const float* pz,
+                         float* nx, float* ny, float* nz) {
+    if (px == NULL || faceList.indices == NULL) return;
+    workers->run(faceCount, NORMAL_MIN_CHUNK, [&](int, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            if (faceList.size(i) < 3) {
+                nx[i] = ny[i] = nz[i] = 0;
+                continue;
+            }
+            faceNormal(faceList.vertices(i), px, py, pz, nx[i], ny[i], nz[i]);
+        }
+    });
 }
-void ply::adjustModel(bool w) {
-    // For every edge, compute the force contributed by
-    // the stretched or compressed edge
 
-    for (int i = 0; i < edgeCount; i++) {
-        float ft = 0;
-        if (i < edgeCount / 2 && w) ft = 1;
-        Vector fv = Vector(0, ft, 0);
+/*  ===============================================
+      Desc: Sets the mesh up as an instance of geometry.  The faces,
+            edges, adjacency and vertex to face table are used in place
+            from geometry and never change; everything a deformation
+            or a solver step writes (the vertices, face normals, pick
+            grid and solver state) is copied into this mesh's arena.
+      Precondition: geometry is set, loaded and still at rest
+    =============================================== */
+void ply::instantiate() {
+    const ply& source = *geometry;
+    vertexCount = source.vertexCount;
+    faceCount = source.faceCount;
+    edgeCount = source.edgeCount;
+    boundaryEdgeCount = source.boundaryEdgeCount;
+    nonManifoldEdgeCount = source.nonManifoldEdgeCount;
+    format = source.format;
+    elements = source.elements;
+    arena.reserve(VertexStore::bytesFor(vertexCount)
+        + 3 * MeshArena::bytesFor<float>(faceCount)
+        + VertexGraph::attachBytesFor(vertexCount)
+        + MeshArena::bytesFor<unsigned char>(vertexCount)
+        + MeshArena::bytesFor<unsigned>(faceCount)
+        + MeshArena::bytesFor<unsigned>(vertexCount)
+        + XpbdSolver::restoreBytesFor(edgeCount, vertexCount, faceCount)
+        + implicitBytes(edgeCount));
+
+    vertexList.allocate(vertexCount, arena);
+    float* VertexStore::*rest[] = {
+        &VertexStore::px, &VertexStore::py, &VertexStore::pz,
+        &VertexStore::centerLen, &VertexStore::confidence, &VertexStore::intensity,
+        &VertexStore::r, &VertexStore::g, &VertexStore::b };
+    for (size_t k = 0; k < sizeof(rest) / sizeof(rest[0]); k++) {
+        memcpy(vertexList.*rest[k], source.vertexList.*rest[k], vertexCount * sizeof(float));
+    }
 
-        edge e = edgeList[i];
-        int v1 = e.vertices[0];
-        int v2 = e.vertices[1];
+    float* normals[3];
+    const float* sourceNormals[3] = { source.faceList.normX, source.faceList.normY, source.faceList.normZ };
+    for (int k = 0; k < 3; k++) {
+        normals[k] = arena.allocate<float>(faceCount);
+        memcpy(normals[k], sourceNormals[k], faceCount * sizeof(float));
+    }
+    faceList.attach(faceCount, source.faceList.indexCount, source.faceList.indices,
+                    source.faceList.offsets, normals[0], normals[1], normals[2]);
+    edgeList = source.edgeList;
+    vg.attach(&vertexList, vertexCount, (int*)source.vg.neighborOffsets(),
+              (int*)source.vg.neighborArray(), (int*)source.vg.neighborEdgeArray(),
+              source.vg.getGrid().arrays(), arena);
+    faceStart = source.faceStart;
+    incidentFaces = source.incidentFaces;
+    const XpbdSolver& solver = source.xpbdSolver;
+    xpbdSolver.restore(solver.getColorStart(), solver.getColorCount(), solver.getSerialColor(),
+                       solver.getEdgeV1(), solver.getEdgeV2(), solver.getRestLen(),
+                       edgeCount, vertexCount, arena);
+    setXpbdSurface();
+    allocateNormalTables();
+
+    center = vertex();
+    center.x = 0;
+    center.y = 0;
+    center.z = 0;
+    center.velocity = Vectorf();
+    centerForce = Vectorf();
+    allMoved = false;
+}
 
-        float be = -sqrt(4 * M * KS);
-        float bv = -sqrt(4 * M * KV);
+void ply::allocateNormalTables() {
+    movedVertices.clear();
+    // a new mesh changes everything
+    updatedVertices.clear();
+    allUpdated = true;
+    vertexMoved = arena.allocate<unsigned char>(vertexCount);
+    faceEpoch = arena.allocate<unsigned>(faceCount);
+    vertexEpoch = arena.allocate<unsigned>(vertexCount);
+    memset(vertexMoved, 0, vertexCount);
+    memset(faceEpoch, 0, faceCount * sizeof(unsigned));
+    memset(vertexEpoch, 0, vertexCount * sizeof(unsigned));
+    normalEpoch = 0;
+}
 
-        if (isnan(be)) be = 0;
-        if (isnan(bv)) bv = 0;
-        
-        Vector fVec  = computeEdgeContribution(e);
-        Vector fNorm = fVec;
-
-        fNorm.normalize();
-
-
-        Vector v1SDamping = (be * (dot(vertexList[v1].velocity, fNorm) * fNorm));
-        Vector v1VDamping = (bv * (dot(vertexList[v1].velocity, fNorm) * fNorm));
-        Vector v2SDamping = (be * (dot(vertexList[v2].velocity, fNorm) * fNorm));
-        Vector v2VDamping = (bv * (dot(vertexList[v2].velocity, fNorm) * fNorm));
-       /* 
-        if (v1SDamping != Vector() || v1VDamping != Vector()){ 
-            cout << "v1S: ";
-            v1SDamping.print();
-            fVec.print();
-            cout << " v1V: " ;
-            v1VDamping.print(); 
-            cout << endl;
-        }*/
-        
-        Vector v1Vec = computeVolumeContribution(v1); 
-        Vector v2Vec = computeVolumeContribution(v2); 
+void ply::findIncidentFaces() {
+    // count the faces around every vertex, then turn the counts into offsets
+    faceStart = arena.allocate<int>(vertexCount + 1);
+    memset(faceStart, 0, (vertexCount + 1) * sizeof(int));
+    for (int i = 0; i < faceCount; i++) {
+        const int* face = faceList.vertices(i);
+        for (int k = 0; k < faceList.size(i); k++) {
+            faceStart[face[k] + 1]++;
+        }
+    }
+    for (int v = 0; v < vertexCount; v++) {
+        faceStart[v + 1] += faceStart[v];
+    }
+    incidentFaces = arena.allocate<int>(faceStart[vertexCount]);
+    vector<int> slot(faceStart, faceStart + vertexCount);
+    for (int i = 0; i < faceCount; i++) {
+        const int* face = faceList.vertices(i);
+        for (int k = 0; k < faceList.size(i); k++) {
+            incidentFaces[slot[face[k]]++] = i;
+        }
+    }
+}
 
-        Vector floorForce = Vector(0, 0, 0);
-        //collide with floor
-        if (vertexList[v1].y < -1) floorForce = Vector(0, GRAVITY, 0);
-        if (vertexList[v1].y > 1) floorForce = Vector(0, -GRAVITY, 0);
+void ply::markMoved(const int* vertices, int count) {
+    for (int i = 0; i < count; i++) {
+        int v = vertices[i];
+        if (v < 0 || v >= vertexCount || vertexMoved == NULL || vertexMoved[v]) continue;
+        vertexMoved[v] = 1;
+        movedVertices.push_back(v);
+    }
+}
 
-        forceList[v1] = forceList[v1] + (fVec  + v1SDamping) + (v1Vec + v1VDamping) + floorForce + fv;
-        forceList[v2] = forceList[v2] + (-fVec + v2SDamping) + (v2Vec + v2VDamping) + floorForce + fv;
-        
-        centerForce   = centerForce + (-v1Vec - (bv * (dot(center.velocity, fNorm) * fNorm))); 
-        centerForce   = centerForce + (-v2Vec - (bv * (dot(center.velocity, fNorm) * fNorm)));
+void ply::computeVertexNormals(const int* vertices, int count) {
+    workers->run(count, NORMAL_MIN_CHUNK, [&](int, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            int v = vertices ? vertices[i] : i;
+            float x = 0, y = 0, z = 0;
+            for (int k = faceStart[v]; k < faceStart[v + 1]; k++) {
+                int f = incidentFaces[k];
+                x += faceList.normX[f];
+                y += faceList.normY[f];
+                z += faceList.normZ[f];
+            }
+            float length = sqt(x * x + y * y + z * z);
+            if (length > 0) {
+                x /= length;
+                y /= length;
+                z /= length;
+            }
+            vertexList.nx[v] = x;
+            vertexList.ny[v] = y;
+            vertexList.nz[v] = z;
+        }
+    });
+}
+
+int ply::updateNormals() {
+    updatedVertices.clear();
+    allUpdated = false;
+    if (vertexList.px == NULL || faceList.indices == NULL) return 0;
+    int recomputed;
+    if (allMoved || (int)movedVertices.size() > vertexCount / NORMAL_FULL_FRACTION) {
+        computeNormals();
+        if (smoothNormals) computeVertexNormals(NULL, vertexCount);
+        recomputed = faceCount;
+        allUpdated = true;
+    } else {
+        if (movedVertices.empty()) return 0;
+        // a new epoch unmarks every face and vertex without touching them
+        if (++normalEpoch == 0) {
+            fill(faceEpoch, faceEpoch + faceCount, 0);
+            fill(vertexEpoch, vertexEpoch + vertexCount, 0);
+            normalEpoch = 1;
+        }
+        changedFaces.clear();
+        for (size_t i = 0; i < movedVertices.size(); i++) {
+            int v = movedVertices[i];
+            for (int k = faceStart[v]; k < faceStart[v + 1]; k++) {
+                int f = incidentFaces[k];
+                if (faceEpoch[f] != normalEpoch) {
+                    faceEpoch[f] = normalEpoch;
+                    changedFaces.push_back(f);
+                }
+            }
+        }
+        recomputed = (int)changedFaces.size();
+        const float *px = vertexList.px, *py = vertexList.py, *pz = vertexList.pz;
+        workers->run(recomputed, NORMAL_MIN_CHUNK, [&](int, int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                int f = changedFaces[i];
+                if (faceList.size(f) < 3) continue;
+                faceNormal(faceList.vertices(f), px, py, pz,
+                           faceList.normX[f], faceList.normY[f], faceList.normZ[f]);
+            }
+        });
+
+        // every corner of a changed face has a changed smooth normal
+        if (smoothNormals) {
+            changedVertices.clear();
+            for (int i = 0; i < recomputed; i++) {
+                int f = changedFaces[i];
+                const int* face = faceList.vertices(f);
+                for (int k = 0; k < faceList.size(f); k++) {
+                    if (vertexEpoch[face[k]] != normalEpoch) {
+                        vertexEpoch[face[k]] = normalEpoch;
+                        changedVertices.push_back(face[k]);
+                    }
+                }
+            }
+            computeVertexNormals(changedVertices.data(), (int)changedVertices.size());
+        }
     }
-    // Apply forces to vertices
-    for (int i = 0; i < vertexCount; i++) {
-        vertex v    = vertexList[i];
-        Vector g    = Vector (0, -GRAVITY, 0);
-        Vector fVec = (forceList[i] + g);
 
-    //    if (i == 0) asPoint(i).print();
+    for (size_t i = 0; i < movedVertices.size(); i++) {
+        vertexMoved[movedVertices[i]] = 0;
+    }
+    // hand the list over, keeping both capacities
+    updatedVertices.swap(movedVertices);
+    movedVertices.clear();
+    allMoved = false;
+    return recomputed;
+}
+
+const vector<int>* ply::getUpdatedVertices() {
+    return allUpdated ? NULL : &updatedVertices;
+}
+
+void ply::setSmoothNormals(bool enabled) {
+    if (enabled && !smoothNormals && vertexList.px != NULL && faceList.indices != NULL) {
+        // bring the face normals up to date first, then fill every vertex
+        updateNormals();
+        computeVertexNormals(NULL, vertexCount);
+    }
+    smoothNormals = enabled;
+}
+
+bool ply::getSmoothNormals() {
+    return smoothNormals;
+}
+
+void ply::setWorkerPool(WorkerPool* pool) {
+    workers = pool;
+}
+
+WorkerPool* ply::getWorkerPool() {
+    return workers;
+}
+
+const int* ply::getFaceStart() {
+    return faceStart;
+}
+
+const int* ply::getIncidentFaces() {
+    return incidentFaces;
+}
+
+void ply::setIntegrator(plyIntegrator _integrator) {
+    integrator = _integrator;
+}
+
+void ply::setTimeStep(float dt) {
+    timeStep = dt;
+}
+
+void ply::setStiffness(float ks) {
+    stiffness = ks;
+}
+
+ImplicitSolver& ply::getImplicitSolver() {
+    return implicitSolver;
+}
+
+XpbdSolver& ply::getXpbdSolver() {
+    return xpbdSolver;
+}
+
+// below this many vertices per chunk the threads cost more than they save
+#define ADJUST_MIN_CHUNK 2048
+
+void ply::adjustModel(bool w) {
+    // every integrator moves every vertex
+    allMoved = true;
+    if (integrator == PLY_PBD) {
+        stepConstraints(w);
+        return;
+    }
+
+    // For every vertex, gather the force contributed by each
+    // stretched or compressed edge around it.  Walking the adjacency
+    // in vg means every vertex only writes its own force entry, so
+    // chunks of vertices can run on different threads.
+
+    float be = -sqrt(4 * M * stiffness);
+    float bv = -sqrt(4 * M * KV);
+
+    if (isnan(be)) be = 0;
+    if (isnan(bv)) bv = 0;
+
+    centerPartial.assign(workers->chunkCount(vertexCount, ADJUST_MIN_CHUNK), Vectorf());
+
+    workers->run(vertexCount, ADJUST_MIN_CHUNK, [&](int chunk, int begin, int end) {
+        Vectorf chunkCenterForce;
+        for (int i = begin; i < end; i++) {
+            Vectorf force;
+            Vectorf velocity = vertexList.velocity(i);
+            Vectorf vVec     = computeVolumeContribution(i);
 
-        Vector a    = fVec / M;
-        Vector vi   = v.velocity;
-        Vector vf   = vi + a * DT;
-        Vector d    = vi * DT + .5 * DT * DT * a;
-      
-        v.x += d[0];
-        v.y += d[1];
-        v.z += d[2];
+            for (int k = vg.firstNeighbor(i); k < vg.lastNeighbor(i); k++) {
+                int ei = vg.neighborEdge(k);
+                const edge &e = edgeList[ei];
 
-        v.velocity = vf;
-        vertexList[i] = v;
+                float ft = 0;
+                if (ei < edgeCount / 2 && w) ft = 1;
+                Vectorf fv = Vectorf(0, ft, 0);
+
+                // the edge force pulls vertices[0] towards vertices[1]
+                Vectorf fVec  = computeEdgeContribution(e);
+                Vectorf fNorm = fVec;
+
+                fNorm.normalize();
+                if (e.vertices[0] != i) fVec.negate();
+
+                Vectorf sDamping = (be * (dot(velocity, fNorm) * fNorm));
+                Vectorf vDamping = (bv * (dot(velocity, fNorm) * fNorm));
+
+                Vectorf floorForce = Vectorf(0, 0, 0);
+                //collide with floor
+                if (vertexList.py[e.vertices[0]] < -1) floorForce = Vectorf(0, GRAVITY, 0);
+                if (vertexList.py[e.vertices[0]] > 1) floorForce = Vectorf(0, -GRAVITY, 0);
+
+                force = force + (fVec + sDamping) + (vVec + vDamping) + floorForce + fv;
+
+                chunkCenterForce = chunkCenterForce + (-vVec - (bv * (dot(center.velocity, fNorm) * fNorm)));
+            }
+            vertexList.fx[i] = force[0];
+            vertexList.fy[i] = force[1];
+            vertexList.fz[i] = force[2];
+        }
+        centerPartial[chunk] = chunkCenterForce;
+    });
+    for (size_t c = 0; c < centerPartial.size(); c++) {
+        centerForce = centerForce + centerPartial[c];
+    }
 
-        forceList[i] = Vector();
+    if (integrator == PLY_IMPLICIT) {
+        if (!implicitSolver.isAllocated()) {
+            implicitSolver.allocate(vertexCount, edgeCount, arena);
+        }
+        implicitSolver.step(vertexList, edgeList, edgeCount, vg, *workers,
+                            timeStep, stiffness, be, M, GRAVITY);
+    } else {
+        integrateExplicit();
     }
+    vg.refit();
     // Apply center forces
-    Vector fVec = centerForce + Vector(0, GRAVITY, 0);
-    Vector a    = fVec / (M * vertexCount);
-    Vector vi   = center.velocity;
-    Vector vf   = vi + a * DT;
-    Vector d    = vi * DT + .5 * DT * DT * a;
+    Vectorf fVec = centerForce + Vectorf(0, GRAVITY, 0);
+    Vectorf a    = fVec / (M * vertexCount);
+    Vectorf vi   = center.velocity;
+    Vectorf vf   = vi + a * timeStep;
+    Vectorf d    = vi * timeStep + 0.5f * timeStep * timeStep * a;
     
     //std::cout << center.x << " ," << center.y << " ," << center.z << std::endl;
     center.x   += d[0];
@@ -468,76 +1464,165 @@ void ply::adjustModel(bool w) {
     center.z   += d[2];
 
     center.velocity = vf;
-    centerForce = Vector();
+    centerForce = Vectorf();
 }
 
-//loads data structures so edges are known
-void ply::findEdges(){
-    //edges, if you want to use this data structure
-    //TODO add all the edges to the edgeList and make sure they have both faces
-    edgeList = new edge[faceCount * 9];
+void ply::setXpbdSurface() {
+    // an open surface encloses no volume
+    if (faceCount > 0 && boundaryEdgeCount == 0 && nonManifoldEdgeCount == 0) {
+        xpbdSolver.setSurface(&faceList, faceStart, incidentFaces, vertexList, arena);
+    }
+}
 
-    edgeCount = 0;
-    for (int i = 0; i < faceCount; i++) {
-        for (int j = i; j < faceCount; j++) {
-            // find a shared vertex between the faces
-            int sharedVert1 = -1;
-            int sharedVert2 = -1;
-            for (int fi = 0; fi < 3; fi++) {
-                for (int fj = 0; fj < 3; fj++) {
-                    if (faceList[i].vertexList[fi] == faceList[j].vertexList[fj]) {
-                        if (sharedVert1 == -1){
-                            sharedVert1 = faceList[i].vertexList[fi];
-                        } else {
-                            sharedVert2 = faceList[i].vertexList[fi];
-                            fi = 4;
-                            fj = 4;
-                        }
-                    }
+void ply::stepConstraints(bool w) {
+    // the lift adjustModel applies through the first half of the
+    // edges, as an external force on their vertices
+    const float* lift = NULL;
+    if (w) {
+        workers->run(vertexCount, ADJUST_MIN_CHUNK, [&](int, int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                int lifting = 0;
+                for (int k = vg.firstNeighbor(i); k < vg.lastNeighbor(i); k++) {
+                    if (vg.neighborEdge(k) < edgeCount / 2) lifting++;
                 }
+                vertexList.fy[i] = lifting;
             }
+        });
+        lift = vertexList.fy;
+    }
+    xpbdSolver.step(vertexList, *workers, timeStep, M, GRAVITY, lift, center);
+    vg.refit();
+}
+
+void ply::integrateExplicit() {
+    // Apply forces to vertices, one array at a time so the
+    // loop vectorizes
+    const float dt      = timeStep;
+    const float halfDt2 = .5f * dt * dt;
+    const float invM    = 1.0f / M;
+    float *px = vertexList.px, *py = vertexList.py, *pz = vertexList.pz;
+    float *vx = vertexList.vx, *vy = vertexList.vy, *vz = vertexList.vz;
+    const float *fx = vertexList.fx, *fy = vertexList.fy, *fz = vertexList.fz;
+    workers->run(vertexCount, ADJUST_MIN_CHUNK, [&](int, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            float ax = fx[i] * invM;
+            float ay = (fy[i] - GRAVITY) * invM;
+            float az = fz[i] * invM;
+
+            px[i] += vx[i] * dt + halfDt2 * ax;
+            py[i] += vy[i] * dt + halfDt2 * ay;
+            pz[i] += vz[i] * dt + halfDt2 * az;
+
+            vx[i] += ax * dt;
+            vy[i] += ay * dt;
+            vz[i] += az * dt;
+        }
+    });
+}
+
+/*  ===============================================
+Desc: Builds the edgeList from the faceList in linear time
+Every face contributes one half-edge per side.  The half-edges are
+bucketed by their lower-numbered vertex (a counting sort), and the
+half-edges inside a bucket are merged on their higher-numbered vertex,
+so each edge is found without comparing faces against each other.
+Precondition: faceList and vertexList are loaded
+Postcondition: edgeList holds exactly edgeCount edges, each with the
+faces that share it.  Boundary edges (one face) have faces[1] == -1 and
+non-manifold edges (more than two faces) keep the first two faces; both
+are counted in boundaryEdgeCount / nonManifoldEdgeCount.
+=============================================== */
+void ply::findEdges(){
+    int i, j;
+    int halfEdgeCount = 0;
+    for (i = 0; i < faceCount; i++) {
+        halfEdgeCount += faceList.size(i);
+    }
+
+    // bucket every half-edge by its lower vertex
+    vector<int> bucketStart(vertexCount + 1, 0);
+    for (i = 0; i < faceCount; i++) {
+        const int* face = faceList.vertices(i);
+        int n = faceList.size(i);
+        for (j = 0; j < n; j++) {
+            int a = face[j];
+            int b = face[(j + 1) % n];
+            if (a != b) bucketStart[(a < b ? a : b) + 1]++;
+        }
+    }
+    for (i = 0; i < vertexCount; i++) {
+        bucketStart[i + 1] += bucketStart[i];
+    }
+
+    vector<int> bucketFill(bucketStart.begin(), bucketStart.end() - 1);
+    vector<int> upperVert(halfEdgeCount);
+    vector<int> ownerFace(halfEdgeCount);
+    for (i = 0; i < faceCount; i++) {
+        const int* face = faceList.vertices(i);
+        int n = faceList.size(i);
+        for (j = 0; j < n; j++) {
+            int a = face[j];
+            int b = face[(j + 1) % n];
+            if (a == b) continue; // degenerate side
+            int lo = a < b ? a : b;
+            upperVert[bucketFill[lo]] = a < b ? b : a;
+            ownerFace[bucketFill[lo]] = i;
+            bucketFill[lo]++;
+        }
+    }
+
+    // seenIn[hi] == lo means the edge (lo, hi) was already created while
+    // merging bucket lo, and edgeOf[hi] is its index.
+    vector<int> seenIn(vertexCount, -1);
+    vector<int> edgeOf(vertexCount, -1);
 
-            if (sharedVert1 != -1 && sharedVert2 != -1) { // 2 shared vertices
-                edgeList[edgeCount].vertices[0] = sharedVert1;
-                edgeList[edgeCount].vertices[1] = sharedVert2;
-                edgeList[edgeCount].faces[0] = i;
-                edgeList[edgeCount].faces[1] = j;
-                edgeList[edgeCount].len = findLen(sharedVert1, sharedVert2);
+    // first pass only counts unique edges so the list is sized exactly
+    edgeCount = 0;
+    for (int lo = 0; lo < vertexCount; lo++) {
+        for (int k = bucketStart[lo]; k < bucketStart[lo + 1]; k++) {
+            if (seenIn[upperVert[k]] != lo) {
+                seenIn[upperVert[k]] = lo;
                 edgeCount++;
+            }
+        }
+    }
 
-                vertexList[sharedVert1].centerLen = findCenterLen(sharedVert1);
-                vertexList[sharedVert2].centerLen = findCenterLen(sharedVert2);
-                vertexList[sharedVert1].velocity  = Vector();
-                vertexList[sharedVert2].velocity  = Vector();
+    edgeList = arena.allocate<edge>(edgeCount);
+    uninitialized_default_construct_n(edgeList, edgeCount);
+    std::fill(seenIn.begin(), seenIn.end(), -1);
+    boundaryEdgeCount = 0;
+    nonManifoldEdgeCount = 0;
+
+    int e = 0;
+    for (int lo = 0; lo < vertexCount; lo++) {
+        for (int k = bucketStart[lo]; k < bucketStart[lo + 1]; k++) {
+            int hi = upperVert[k];
+            if (seenIn[hi] != lo) {
+                seenIn[hi] = lo;
+                edgeOf[hi] = e;
+                edgeList[e].vertices[0] = lo;
+                edgeList[e].vertices[1] = hi;
+                edgeList[e].faces[0] = ownerFace[k];
+                edgeList[e].faceCount = 1;
+                edgeList[e].len = findLen(lo, hi);
+                e++;
+            } else {
+                edge &shared = edgeList[edgeOf[hi]];
+                if (shared.faceCount == 1) shared.faces[1] = ownerFace[k];
+                shared.faceCount++;
             }
         }
     }
-} 
 
-/* Desc: Renders the silhouette
- * Precondition: Edges are known
- */
-void ply::renderSilhouette(){
-    glPushMatrix();
-    glBegin(GL_LINES);
-
-    //TODO Iterate through the edgeList, and if you want to draw an edge,
-    //call glVertex3f once for each vertex in that edge.  
-    //
-    for (int i = 0; i < edgeCount; i++) {
-        face face1 = faceList[edgeList[i].faces[0]];
-        face face2 = faceList[edgeList[i].faces[1]];
-        if (dot(Vector(face1.normX, face1.normY, face1.normZ), Vector(lookX, 0, lookZ)) * 
-                dot(Vector(face2.normX, face2.normY, face2.normZ), Vector(lookX, 0, lookZ))
-                < 0) {
-            vertex vertex1 = vertexList[edgeList[i].vertices[0]];
-            vertex vertex2 = vertexList[edgeList[i].vertices[1]];
-            glVertex3f(vertex1.x, vertex1.y, vertex1.z);
-            glVertex3f(vertex2.x, vertex2.y, vertex2.z);
-        }
-    }
-    glEnd();
-    glPopMatrix();
+    for (i = 0; i < edgeCount; i++) {
+        if (edgeList[i].faceCount == 1) boundaryEdgeCount++;
+        if (edgeList[i].faceCount > 2) nonManifoldEdgeCount++;
+    }
+
+    for (i = 0; i < vertexCount; i++) {
+        vertexList.centerLen[i] = findCenterLen(i);
+        vertexList.setVelocity(i, Vectorf());
+    }
 } 
 
 /*  ===============================================
@@ -548,18 +1633,36 @@ void ply::printAttributes(){
     cout << "==== ply Mesh Attributes=====" << endl;
     cout << "vertex count:" << vertexCount << endl;
     cout << "face count:" << faceCount << endl;       
-    cout << "properties:" << properties << endl;
+    cout << "edge count:" << edgeCount << endl;
+    cout << "boundary edges:" << boundaryEdgeCount << endl;
+    cout << "non-manifold edges:" << nonManifoldEdgeCount << endl;
+    cout << "format:" << (format == PLY_ASCII ? "ascii" :
+            format == PLY_BINARY_LE ? "binary_little_endian" : "binary_big_endian") << endl;
+    for (size_t e = 0; e < elements.size(); e++) {
+        cout << "element " << elements[e].name << " " << elements[e].count << ":";
+        for (size_t k = 0; k < elements[e].properties.size(); k++) {
+            cout << " " << elements[e].properties[k].name;
+        }
+        cout << endl;
+    }
 }
 
+int ply::getVertexCount(){ return vertexCount; }
+int ply::getFaceCount(){ return faceCount; }
+int ply::getEdgeCount(){ return edgeCount; }
+VertexStore& ply::getVertexList(){ return vertexList; }
+const FaceList& ply::getFaceList(){ return faceList; }
+edge* ply::getEdgeList(){ return edgeList; }
+
 /*  ===============================================
 Desc: Iterate through our array and print out each vertex.
 =============================================== */ 
 void ply::printVertexList(){
-    if(vertexList==NULL){
+    if(vertexList.px==NULL){
         return;
     }else{
         for(int i = 0; i < vertexCount; i++){
-            cout << vertexList[i].x << "," << vertexList[i].y << "," << vertexList[i].z << endl;
+            cout << vertexList.px[i] << "," << vertexList.py[i] << "," << vertexList.pz[i] << endl;
         }
     }
 }
@@ -568,58 +1671,70 @@ void ply::printVertexList(){
 Desc: Iterate through our array and print out each face.
 =============================================== */ 
 void ply::printFaceList(){
-    if(faceList==NULL){
+    if(faceList.indices==NULL){
         return;
     }else{
         // For each of our faces
         for(int i = 0; i < faceCount; i++){
             // Get the vertices that make up each face from the face list
-            for(int j = 0; j < faceList[i].vertexCount; j++){
+            for(int j = 0; j < faceList.size(i); j++){
                 // Print out the vertex
-                int index = faceList[i].vertexList[j];
-                cout << vertexList[index].x << "," << vertexList[index].y << "," << vertexList[index].z << endl;
+                int index = faceList.vertices(i)[j];
+                cout << vertexList.px[index] << "," << vertexList.py[index] << "," << vertexList.pz[index] << endl;
             }
         }
     }
 }
 
-//makes a GL Call to set the normal but also stores it 
-//so it can be accessible for silhouette finding
-void ply::setNormal(int facenum, float x1, float y1, float z1,
-        float x2, float y2, float z2,
-        float x3, float y3, float z3) {
-
-    float v1x, v1y, v1z;
-    float v2x, v2y, v2z;
-    float cx, cy, cz;
-
-    //find vector between x2 and x1
-    v1x = x1 - x2;
-    v1y = y1 - y2;
-    v1z = z1 - z2;
-
-    //find vector between x3 and x2
-    v2x = x2 - x3;
-    v2y = y2 - y3;
-    v2z = z2 - z3;
-
-    //cross product v1xv2
-
-    cx = v1y * v2z - v1z * v2y;
-    cy = v1z * v2x - v1x * v2z;
-    cz = v1x * v2y - v1y * v2x;
-
-    //normalize
-
-    float length = sqt(cx * cx + cy * cy + cz * cz);
+/*  ===============================================
+Desc: Writes the mesh as it is now (centered, scaled and deformed) to
+a binary_little_endian .ply file with float x, y, z per vertex and one
+vertex_indices list per face.
+Returns: false if the file could not be written
+=============================================== */
+bool ply::save(string path){
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
 
-    cx = cx / length;
-    cy = cy / length;
-    cz = cz / length;       
+    int largestFace = 0;
+    for (int i = 0; i < faceCount; i++) {
+        if (faceList.size(i) > largestFace) largestFace = faceList.size(i);
+    }
+    bool byteCounts = largestFace < 256;
 
-    faceList[facenum].normX = cx;
-    faceList[facenum].normY = cy;
-    faceList[facenum].normZ = cz;
+    fprintf(file, "ply\nformat binary_little_endian 1.0\n");
+    fprintf(file, "element vertex %d\n", vertexCount);
+    fprintf(file, "property float x\nproperty float y\nproperty float z\n");
+    fprintf(file, "element face %d\n", faceCount);
+    fprintf(file, "property list %s int vertex_indices\nend_header\n", byteCounts ? "uchar" : "int");
 
-    glNormal3f(cx, cy, cz);
+    bool swap = !hostIsLittleEndian();
+    vector<char> record;
+    for (int i = 0; i < vertexCount; i++) {
+        float xyz[3] = { vertexList.px[i], vertexList.py[i], vertexList.pz[i] };
+        record.assign((char*)xyz, (char*)xyz + sizeof(xyz));
+        if (swap) {
+            for (int k = 0; k < 3; k++) std::reverse(&record[4 * k], &record[4 * k] + 4);
+        }
+        fwrite(&record[0], 1, record.size(), file);
+    }
+    for (int i = 0; i < faceCount; i++) {
+        int n = faceList.size(i);
+        const int* face = faceList.vertices(i);
+        record.clear();
+        if (byteCounts) {
+            record.push_back((char)n);
+        } else {
+            record.insert(record.end(), (char*)&n, (char*)&n + 4);
+            if (swap) std::reverse(record.end() - 4, record.end());
+        }
+        for (int j = 0; j < n; j++) {
+            record.insert(record.end(), (const char*)&face[j], (const char*)&face[j] + 4);
+            if (swap) std::reverse(record.end() - 4, record.end());
+        }
+        fwrite(&record[0], 1, record.size(), file);
+    }
+    return fclose(file) == 0;
 }
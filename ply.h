@@ -9,13 +9,69 @@
 #ifndef PLY_H
 #define PLY_H
 
+#include <stdint.h>
+#include <memory>
 #include <string>
+#include <vector>
+#include "arena.h"
+#include "mappedfile.h"
 #include "geometry.h"
 #include "entity.h"
-#include "Algebra.h"
+#include "parallel.h"
+#include "implicit.h"
+#include "xpbd.h"
+#include "AlgebraF.h"
 
 using namespace std;
 
+/*  ============== PLY schema ==============
+        Purpose: What the header says about the body of a .ply file
+        Use: Built while parsing the header.  Every element keeps its
+        typed properties in declaration order together with their byte
+        offsets, so the body decoders can pull out only the properties
+        a vertex or face needs and step over everything else.
+        ==================================== */
+// How the body of the file is stored
+enum plyFormat { PLY_ASCII, PLY_BINARY_LE, PLY_BINARY_BE };
+// Scalar types a property can be declared with
+enum plyType { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16,
+               PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_NOTYPE };
+
+/*  ============== Integrators ==============
+        PLY_EXPLICIT: the original explicit step, cheap but only stable
+                      for small time steps and soft springs
+        PLY_IMPLICIT: backward Euler solved with conjugate gradient,
+                      stable for stiff springs and steps many times longer
+        PLY_PBD:      no forces; edge distance constraints and, on a
+                      closed mesh, its enclosed volume are projected
+                      with XPBD compliance (see xpbd.h)
+        ==================================== */
+enum plyIntegrator { PLY_EXPLICIT, PLY_IMPLICIT, PLY_PBD };
+
+struct plyProperty {
+        string name;
+        plyType type;       // type of the value, or of each list entry
+        bool isList;
+        plyType countType;  // type of the list length (lists only)
+        int offset;         // byte offset inside a binary record,
+                            // -1 once a list has made the record variable
+};
+
+struct plyElement {
+        string name;
+        int count;
+        vector<plyProperty> properties;
+        int stride;         // bytes per binary record, 0 if it holds a list
+};
+
+// One vertex property the decoder extracts: which property, and
+// which VertexStore array it lands in (scaled, for integer colors)
+struct plyField {
+        int property;
+        float* VertexStore::*target;
+        float scale;
+};
+
 /*  ============== ply ==============
         Purpose: Load a PLY File
 
@@ -25,16 +81,30 @@ using namespace std;
 
         Example usage: 
         1.) ply* myPLY = new ply (filenamePath);
-        2.) myPLY->render();
+        2.) myPLY->adjustModel(false);
         3.) delete myPLY;
+        Drawing lives in PlyRenderer (plyrender.h), so this class
+        and everything it uses builds without GL.
         ==================================== */ 
 class ply : public entity{
 
         public:
                 /*      ===============================================
-                        Desc: Default constructor for a ply object
+                        Desc: Default constructor for a ply object.  The
+                        loading passes run on pool (the shared pool when
+                        NULL), which stays the mesh's pool afterwards.
+                        A file that cannot be loaded leaves an empty
+                        mesh, see getLoadError.
                         =============================================== */ 
-                ply(string _filePath);
+                ply(string _filePath, WorkerPool* pool = NULL);
+                /*      ===============================================
+                        Desc: Another instance of a loaded mesh.  The
+                        faces, edges and adjacency stay geometry's and
+                        are shared; this mesh gets its own copy of
+                        everything that deforms.  geometry is kept alive
+                        and must not be deformed or stepped itself.
+                        =============================================== */
+                ply(shared_ptr<ply> geometry, WorkerPool* pool = NULL);
 
                 /*      ===============================================
                         Desc: Destructor for a ply object
@@ -43,17 +113,69 @@ class ply : public entity{
                 ~ply();
                 /*      ===============================================
                         Desc: reloads the geometry for a 3D object
-                        (usually to see a new .ply file)
+                        (usually to see a new .ply file).  The old mesh
+                        goes in one release of the arena and the new one
+                        comes from a single reserve, so reloading the
+                        same file again and again does not grow memory.
+                        Returns: false if the file could not be loaded,
+                        which leaves an empty mesh
                 =============================================== */ 
-                void reload(string _filePath);
+                bool reload(string _filePath);
+                // Why the last load failed, empty if it succeeded
+                const string& getLoadError();
+                // Storage of the current mesh, for profiling
+                const MeshArena& getArena();
                 /*      ===============================================
-                        Desc: Draws a filled 3D object
-                =============================================== */  
-                void render();
+                        Desc: Whether loads use and write the mesh cache
+                        in the user's cache directory (see meshcache.h).
+                        On unless PLY_CACHE=0; set it before loading.
+                =============================================== */
+                static void setCacheEnabled(bool enabled);
+                static bool getCacheEnabled();
+                // Whether the current mesh came from its cache
+                bool loadedFromCache();
                 //iterates through the geometry to fill in the edgeList
                 void findEdges();
-                //draws the silhouette around the ply object
-                void renderSilhouette();
+                /*      ===============================================
+                        Desc: Unit normal of every face, from its first three
+                        vertices.  Without arguments it uses the current
+                        positions and fills faceList's normal arrays; the
+                        other form reads the given positions (such as a
+                        simulation snapshot) and writes nx/ny/nz, which
+                        need room for getFaceCount() floats.  Runs on the
+                        worker pool and needs no GL context.
+                =============================================== */
+                void computeNormals();
+                void computeNormals(const float* px, const float* py, const float* pz,
+                                    float* nx, float* ny, float* nz);
+                /*      ===============================================
+                        Desc: Brings faceList's normals (and the smooth
+                        vertex normals, when enabled) up to date with
+                        the vertices moved since the last call.  Only
+                        the faces around a moved vertex are recomputed,
+                        found through the vertex to face table, so the
+                        cost follows the deformed area; after a solver
+                        step, which moves everything, it recomputes all.
+                        Returns: the number of faces recomputed
+                =============================================== */
+                int updateNormals();
+                /*      ===============================================
+                        Desc: The vertices the last updateNormals found
+                        moved, which with the faces around them are all
+                        that changed for drawing since the call before
+                        Returns: NULL if it recomputed everything
+                =============================================== */
+                const vector<int>* getUpdatedVertices();
+                // Records that these vertices were moved by something
+                // other than deformModel or adjustModel
+                void markMoved(const int* vertices, int count);
+                /*      ===============================================
+                        Desc: Keeps a smooth normal per vertex in
+                        vertexList.nx/ny/nz, the normalized sum of the
+                        normals of the faces around it.  Off by default.
+                =============================================== */
+                void setSmoothNormals(bool enabled);
+                bool getSmoothNormals();
 
                 /*      ===============================================
                         Desc: Prints some statistics about the file you have read in
@@ -67,29 +189,115 @@ class ply : public entity{
                         =============================================== */
                 void printVertexList();
                 void printFaceList();
-                
-                //components of look vector (changeable by rotation around Y)
-                float lookX;//0.0 when Y-rotation = 0
-                float lookZ;//1.0 when Y-rotation = 0
 
+                /*      ===============================================
+                        Desc: Writes the current mesh to a binary .ply file
+                        Returns: false if it could not be written
+                =============================================== */
+                bool save(string path);
+
+                /*      ===============================================
+                        Desc: Read-only access to the loaded mesh, used
+                        by tools such as plybench
+                =============================================== */
+                int getVertexCount();
+                int getFaceCount();
+                int getEdgeCount();
+                VertexStore& getVertexList();
+                const FaceList& getFaceList();
+                edge* getEdgeList();
+
+                /*      ===============================================
+                        Desc: Advances the mass-spring system by one step.
+                        The per-vertex force and integration loops are
+                        split over the worker pool; for a given thread
+                        count the result is the same every run.
+                =============================================== */
                 void adjustModel(bool w);
-                void deformModel(float x, float y, Matrix transform);
-                bool deformModel(Point p, float radius, Vector transform);
-                bool deformModel(Point p1, Point p2, Vector transform);
+                // Pool adjustModel runs on, WorkerPool::shared() by default
+                void setWorkerPool(WorkerPool* pool);
+                WorkerPool* getWorkerPool();
+                // faces around vertex v are getIncidentFaces()[getFaceStart()[v]]
+                // up to getIncidentFaces()[getFaceStart()[v + 1]]
+                const int* getFaceStart();
+                const int* getIncidentFaces();
+                // Solver settings, PLY_EXPLICIT, DT and KS by default
+                void setIntegrator(plyIntegrator _integrator);
+                void setTimeStep(float dt);
+                void setStiffness(float ks);
+                // CG limits and statistics of the implicit integrator
+                ImplicitSolver& getImplicitSolver();
+                // iterations and compliances of the PLY_PBD integrator
+                XpbdSolver& getXpbdSolver();
+                // A box around every vertex (cell aligned, from the pick
+                // grid), false for an empty mesh
+                bool getBounds(float lo[3], float hi[3]);
+                // The same box through the entity position and scale
+                bool getWorldBounds(float lo[3], float hi[3]);
+                /*      ===============================================
+                        Desc: Picks the vertices under a sphere / open
+                        box pushing by push, in world space through the
+                        entity position and scale (see ply.cpp), and
+                        keeps them for deformContacts.  Every contact of
+                        a step is picked on the mesh as it was before
+                        any of them moved it.
+                        Returns: whether any vertex was hit
+                =============================================== */
+                bool addSphereContact(const Pointf& p, float radius, const Vectorf& push);
+                bool addBoxContact(const Pointf& p1, const Pointf& p2, const Vectorf& push);
+                // Deforms the mesh at every contact gathered since the
+                // last call, in one pass
+                void deformContacts();
+                void deformModel(float x, float y, const Matrixf& transform);
+                bool deformModel(const Pointf& p, float radius, const Vectorf& transform);
+                bool deformModel(const Pointf& p1, const Pointf& p2, const Vectorf& transform);
         private:
                 VertexGraph vg;
 
                 /*      ===============================================
                         Desc: Helper function used in the constructor
                         =============================================== */ 
-                void loadGeometry();
+                bool loadGeometry();
+                // reads the header, returns where the body starts (NULL if invalid)
+                const char* parseHeader(const char* p, const char* end);
+                // decodes an ascii body in place
+                bool loadAsciiBody(const char* p, const char* end);
+                // decodes a binary_little_endian / binary_big_endian body
+                bool loadBinaryBody(const char* body, const char* end);
+                // sets loadError, returns false
+                bool failLoad(const string& reason);
+                // sets every member to an empty mesh
+                void initialize(WorkerPool* pool);
+                // sets the mesh up as an instance of geometry
+                void instantiate();
+                // centers the mesh and builds edges, forces and the graph
+                void finishLoading();
+                // takes the mesh from the cache of the mapped source,
+                // false if there is no usable cache
+                bool loadCache(const MappedFile& source);
+                // writes the freshly loaded mesh to the cache
+                bool saveCache(const MappedFile& source);
+                // arena bytes a mesh with the header's counts will take
+                size_t meshBytes();
+                // arena bytes of the implicit solver's arrays, 0 unless it
+                // is the integrator
+                size_t implicitBytes(int edges);
+                // fills faceStart / incidentFaces from the face list
+                void findIncidentFaces();
+                // zeroed moved flags and epochs for updateNormals
+                void allocateNormalTables();
+                // smooth normal of every vertex in vertices, or of all
+                // of them when vertices is NULL
+                void computeVertexNormals(const int* vertices, int count);
+                // the explicit half of adjustModel: moves every vertex
+                // with the forces in vertexList.fx/fy/fz
+                void integrateExplicit();
+                // gives the PLY_PBD volume constraint the surface, if closed
+                void setXpbdSurface();
+                // adjustModel for PLY_PBD
+                void stepConstraints(bool w);
                 //makes the points fit in the window
                 void scaleAndCenter();
-                //calculates the normal, sends it to graphics card, 
-                //NOTE and stores it
-                void setNormal(int facenum, float x1, float y1, float z1,
-                                                float x2, float y2, float z2,
-                                                float x3, float y3, float z3);
 
                 /*      ===============================================
                         Data
@@ -100,35 +308,82 @@ class ply : public entity{
                         =============================================== */
                 // Store the path to our file
                 string filePath;
+                // the mapped cache the mesh's arrays point into, when
+                // it came from one
+                MappedFile cache;
+                static bool cacheEnabled;
+                // the mesh whose faces, edges and adjacency this one
+                // uses, when it is an instance
+                shared_ptr<ply> geometry;
+                // why the last load failed, empty if it succeeded
+                string loadError;
                 // Stores the number of vertics loaded
                 int vertexCount;
                 // Stores the number of faces loaded
                 int faceCount;
 				// Stores the number of edges loaded
 				int edgeCount;
-				// Tells us how many properites exist in the file
-                int properties;
-                // A dynamically allocated array that stores
-                // a vertex
-                vertex* vertexList;
-                // A dynamically allocated array that stores
-                // a list of faces (essentially integers that will
-                // be looked up from the vertex list)
-                face* faceList;
+				// Edges with only one face, and edges shared by more than two
+				int boundaryEdgeCount;
+				int nonManifoldEdgeCount;
+                // Body format and element layout declared in the header
+                plyFormat format;
+                vector<plyElement> elements;
+                // Owns every array below that is sized by the mesh:
+                // vertices, faces, edges, graph, grid and normal tables
+                MeshArena arena;
+                // Structure of arrays that stores the vertices
+                VertexStore vertexList;
+                // Flat arrays that store the faces (essentially
+                // integers that will be looked up from the vertex list)
+                // along with their normals
+                FaceList faceList;
                 //NOTE EDGE LIST IS NEW
-                //an array of linked lists representing edges
-                //the array is indexed by the lower-numbered vertex in the edge.
+                //an array of unique edges, sized exactly to edgeCount and
+                //grouped by the lower-numbered vertex in the edge.
                 edge* edgeList;
-                Vector* forceList;
                 
-                Point asPoint(int i);
+                Pointf asPoint(int i);
                 float findLen(int v1, int v2);
                 float findCenterLen(int i);
-                Vector computeEdgeContribution(edge e);
-                Vector computeVolumeContribution(int i);
+                Vectorf computeEdgeContribution(const edge &e);
+                Vectorf computeVolumeContribution(int i);
 
                 vertex center;
-                Vector centerForce;
+                Vectorf centerForce;
+
+                WorkerPool* workers;
+                plyIntegrator integrator;
+                float timeStep;
+                float stiffness;
+                ImplicitSolver implicitSolver;
+                XpbdSolver xpbdSolver;
+                // per-chunk sums of the force on the center, added up in
+                // chunk order so the total does not depend on timing
+                vector<Vectorf> centerPartial;
+
+                // faces around vertex v are incidentFaces[faceStart[v]]
+                // up to incidentFaces[faceStart[v + 1]]
+                int* faceStart;
+                int* incidentFaces;
+                // vertices moved since the last updateNormals, each once
+                vector<int> movedVertices;
+                // movedVertices as the last updateNormals took them
+                vector<int> updatedVertices;
+                bool allUpdated;
+                unsigned char* vertexMoved;
+                bool allMoved;
+                bool smoothNormals;
+                // normalEpoch marks the faces and vertices already
+                // collected by the current updateNormals
+                unsigned* faceEpoch;
+                unsigned* vertexEpoch;
+                unsigned normalEpoch;
+                vector<int> changedFaces;
+                vector<int> changedVertices;
+                // contacts gathered for deformContacts: vertex and push
+                vector<int> contactVertices;
+                vector<Vectorf> contactPushes;
 };
 
 
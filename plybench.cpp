@@ -0,0 +1,322 @@
+/*  =================== File Information =================
+        File Name: plybench.cpp
+        Description: Times the mesh data structures on .ply models
+        Author:
+
+        Purpose: Command line benchmark, run as
+                 ./plybench [file.ply ...]
+                 (defaults to the bundled models)
+        ===================================================== */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdio.h>
+#include "ply.h"
+#include "mappedfile.h"
+#include "meshcache.h"
+#include "scene.h"
+
+using namespace std;
+
+typedef chrono::steady_clock benchClock;
+
+static double msSince(benchClock::time_point start) {
+    return chrono::duration<double, milli>(benchClock::now() - start).count();
+}
+
+/*  ===============================================
+      Desc: Times loading the file from scratch (parse, center,
+            edges and graph) through ply::reload, then from its
+            mesh cache unless PLY_CACHE=0
+    =============================================== */
+static void benchLoad(ply &mesh, const string &path) {
+    const int loadReps = 20;
+
+    MappedFile file;
+    size_t bytes = file.open(path) ? file.size() : 0;
+    file.close();
+
+    bool cacheEnabled = ply::getCacheEnabled();
+    ply::setCacheEnabled(false);
+    benchClock::time_point start = benchClock::now();
+    for (int r = 0; r < loadReps; r++) {
+        mesh.reload(path);
+    }
+    double loadMs = msSince(start) / loadReps;
+    ply::setCacheEnabled(cacheEnabled);
+
+    printf("  load             %8.3f ms (%.1f MB/s)\n",
+           loadMs, bytes / loadMs / 1000.0);
+    if (!cacheEnabled) return;
+
+    // the first reload writes the cache if it is missing
+    mesh.reload(path);
+    start = benchClock::now();
+    for (int r = 0; r < loadReps; r++) {
+        mesh.reload(path);
+    }
+    double cachedMs = msSince(start) / loadReps;
+    if (!mesh.loadedFromCache()) {
+        printf("  load cached      %8s (could not write %s)\n", "-", meshCachePath(path).c_str());
+        return;
+    }
+    printf("  load cached      %8.3f ms (%.1fx)\n", cachedMs, loadMs / cachedMs);
+
+    // damage the section table, which says where the face and
+    // adjacency indices are: the load has to notice, decode the source
+    // again and write a good cache over the bad one
+    int vertexCount = mesh.getVertexCount();
+    FILE* cache = fopen(meshCachePath(path).c_str(), "r+b");
+    if (cache == NULL) return;
+    vector<char> garbage(64, (char)0xff);
+    fseek(cache, offsetof(MeshCacheHeader, offset) + CACHE_INDICES * sizeof(uint64_t), SEEK_SET);
+    fwrite(garbage.data(), 1, garbage.size(), cache);
+    fclose(cache);
+    start = benchClock::now();
+    mesh.reload(path);
+    double damagedMs = msSince(start);
+    bool reparsed = !mesh.loadedFromCache() && mesh.getVertexCount() == vertexCount;
+    mesh.reload(path);
+    printf("  load damaged     %8.3f ms (%s, %s)\n", damagedMs,
+           reparsed ? "decoded again" : "USED THE DAMAGED CACHE",
+           mesh.loadedFromCache() ? "cache rewritten" : "cache not rewritten");
+}
+
+/*  ===============================================
+      Desc: Reloads the file many times and checks that the arenas
+            neither take new blocks nor hold more bytes once the
+            first reload has settled their size
+    =============================================== */
+static void benchReload(ply &mesh, const string &path) {
+    const int reloadReps = 1000;
+
+    // the first reload may fold an overflow into one block
+    mesh.reload(path);
+    long blocksBefore = MeshArena::blockCount();
+    size_t liveBefore = MeshArena::liveBytes();
+    for (int r = 0; r < reloadReps; r++) {
+        mesh.reload(path);
+    }
+    long newBlocks = MeshArena::blockCount() - blocksBefore;
+    size_t liveAfter = MeshArena::liveBytes();
+
+    printf("  reload           %8ld blocks in %d reloads, %.1f -> %.1f KB held (%s), %.1f KB used\n",
+           newBlocks, reloadReps, liveBefore / 1024.0, liveAfter / 1024.0,
+           newBlocks == 0 && liveAfter == liveBefore ? "steady" : "GROWING",
+           mesh.getArena().used() / 1024.0);
+}
+
+/*  ===============================================
+      Desc: Times VertexGraph::construct and a walk over every
+            neighbor of every vertex
+    =============================================== */
+static void benchGraph(ply &mesh) {
+    const int buildReps = 50;
+    const int walkReps  = 200;
+    VertexStore &vertexList = mesh.getVertexList();
+
+    VertexGraph graph;
+    MeshArena arena;
+    benchClock::time_point start = benchClock::now();
+    for (int r = 0; r < buildReps; r++) {
+        arena.reserve(VertexGraph::bytesFor(mesh.getVertexCount(), mesh.getEdgeCount()));
+        graph.construct(&vertexList, mesh.getEdgeList(),
+                        mesh.getVertexCount(), mesh.getEdgeCount(), arena);
+    }
+    double buildMs = msSince(start) / buildReps;
+
+    long long visits = 0;
+    float sum = 0;
+    start = benchClock::now();
+    for (int r = 0; r < walkReps; r++) {
+        for (int i = 0; i < graph.size(); i++) {
+            for (int k = graph.firstNeighbor(i); k < graph.lastNeighbor(i); k++) {
+                sum += vertexList.px[graph.neighbor(k)];
+            }
+            visits += graph.lastNeighbor(i) - graph.firstNeighbor(i);
+        }
+    }
+    double walkMs = msSince(start);
+
+    // sphere and box picks centered on vertices, as a projectile would be
+    const int pickReps = 2000;
+    long long hits = 0;
+    start = benchClock::now();
+    for (int r = 0; r < pickReps; r++) {
+        Pointf p = vertexList.position((r * 7919) % graph.size());
+        Vectorf half(0.05f, 0.05f, 0.05f);
+        hits += graph.pickVerts(p, 0.1f);
+        hits += graph.pickVerts(p - half, p + half);
+    }
+    double pickMs = msSince(start);
+
+    printf("  graph build      %8.3f ms\n", buildMs);
+    printf("  graph memory     %8.1f bytes/vertex\n",
+           (double)graph.memoryBytes() / graph.size());
+    printf("  neighbor walk    %8.1f M neighbors/s (checksum %g)\n",
+           visits / walkMs / 1000.0, sum);
+    printf("  pickVerts        %8.3f us/query (%s, %lld hits)\n",
+           pickMs * 1000.0 / (2 * pickReps), pickKernelName(), hits);
+}
+
+/*  ===============================================
+      Desc: Times ply::adjustModel with 1, 2, 4, ... threads up to the
+            shared pool's size (PLY_THREADS, default every core)
+    =============================================== */
+// Full face normal pass against the incremental update after a
+// projectile sized deform, which only touches the faces around it
+static void benchNormals(ply &mesh) {
+    const int reps = 200;
+    VertexStore &vertexList = mesh.getVertexList();
+
+    benchClock::time_point start = benchClock::now();
+    for (int r = 0; r < reps; r++) {
+        mesh.computeNormals();
+    }
+    double fullMs = msSince(start) / reps;
+
+    long long faces = 0;
+    double updateMs = 0;
+    for (int r = 0; r < reps; r++) {
+        Pointf p = vertexList.position((r * 7919) % mesh.getVertexCount());
+        mesh.deformModel(p, 0.05f, Vectorf(0, 0.0001f, 0));
+        start = benchClock::now();
+        faces += mesh.updateNormals();
+        updateMs += msSince(start);
+    }
+
+    printf("  normals full     %8.3f ms (%d faces)\n", fullMs, mesh.getFaceCount());
+    printf("  normals deform   %8.3f ms (%.0f faces)\n", updateMs / reps, (double)faces / reps);
+}
+
+static void benchSolver(const string &path) {
+    const int steps = 20;
+    int maxThreads = WorkerPool::shared().getThreadCount();
+
+    for (int threads = 1; ; threads *= 2) {
+        if (threads > maxThreads) threads = maxThreads;
+        WorkerPool pool(threads);
+        ply mesh(path);
+        mesh.setWorkerPool(&pool);
+
+        benchClock::time_point start = benchClock::now();
+        for (int s = 0; s < steps; s++) {
+            mesh.adjustModel(false);
+        }
+        printf("  adjustModel      %8.3f ms/step (%d threads)\n",
+               msSince(start) / steps, threads);
+        if (threads == maxThreads) break;
+    }
+
+    // backward Euler with ten times the default step
+    ply mesh(path);
+    mesh.setIntegrator(PLY_IMPLICIT);
+    mesh.setTimeStep(0.1f);
+    long long iterations = 0;
+    benchClock::time_point start = benchClock::now();
+    for (int s = 0; s < steps; s++) {
+        mesh.adjustModel(false);
+        iterations += mesh.getImplicitSolver().lastIterations;
+    }
+    printf("  implicit step    %8.3f ms/step (%d threads, %.1f CG iterations)\n",
+           msSince(start) / steps, maxThreads, (double)iterations / steps);
+
+    // XPBD with the same step
+    mesh.setIntegrator(PLY_PBD);
+    start = benchClock::now();
+    for (int s = 0; s < steps; s++) {
+        mesh.adjustModel(false);
+    }
+    printf("  xpbd step        %8.3f ms/step (%d threads, %d iterations, %d colors)\n",
+           msSince(start) / steps, maxThreads, mesh.getXpbdSolver().iterations,
+           mesh.getXpbdSolver().getColorCount());
+}
+
+/*  ===============================================
+      Desc: Times Scene steps in growing grids of instances of the
+            file, with the same spheres falling on the first instance
+            every time, so the cost per step should stay with the
+            contacts and not follow the instance count, and culls a
+            view around that instance, which should follow the
+            instances in its x range.  Instances are capped at about
+            two million vertices in all.
+    =============================================== */
+static void benchScene(const string &path) {
+    const int steps = 200;
+    const int projectileCount = 16;
+
+    shared_ptr<ply> geometry = make_shared<ply>(path);
+    if (!geometry->getLoadError().empty()) return;
+    int vertexCount = geometry->getVertexCount() > 0 ? geometry->getVertexCount() : 1;
+    for (int side = 1; side <= 32 && side * side * (long)vertexCount <= 2000000; side *= 4) {
+        Scene grid;
+        for (int x = 0; x < side; x++) {
+            for (int z = 0; z < side; z++) {
+                grid.add(geometry, Pointf(x * 1.5f, 0, z * 1.5f));
+            }
+        }
+        ProjectileSystem projectiles;
+        long pairs = 0, adjusted = 0;
+        int hits = 0;
+        benchClock::time_point start = benchClock::now();
+        for (int s = 0; s < steps; s++) {
+            if (s % 50 == 0) {
+                for (int k = 0; k < projectileCount; k++) {
+                    Projectile p;
+                    p.type = PROJECTILE_SPHERE;
+                    p.position = Pointf((k % 4) * 0.2f - 0.3f, 1, (k / 4) * 0.2f - 0.3f);
+                    p.trajectory = Vectorf(0, -0.02f, 0);
+                    projectiles.add(p);
+                }
+            }
+            hits += grid.step(projectiles, true);
+            pairs += grid.getPairCount();
+            adjusted += grid.adjust(false);
+        }
+        printf("  scene step       %8.3f ms/step (%d instances, %.1f pairs, %d hits, %.1f adjusted)\n",
+               msSince(start) / steps, side * side, (double)pairs / steps, hits,
+               (double)adjusted / steps);
+
+        // a view around the first instance, as drawing would cull it
+        const int culls = 1000;
+        const float view[6][4] = { {1, 0, 0, 1}, {-1, 0, 0, 1}, {0, 1, 0, 1},
+                                   {0, -1, 0, 1}, {0, 0, 1, 1}, {0, 0, -1, 1} };
+        size_t visible = 0;
+        start = benchClock::now();
+        for (int k = 0; k < culls; k++) {
+            visible += grid.cull(view).size();
+        }
+        printf("  scene cull       %8.4f ms/cull (%d instances, %.1f visible)\n",
+               msSince(start) / culls, side * side, (double)visible / culls);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    vector<string> files;
+    for (int i = 1; i < argc; i++) {
+        files.push_back(argv[i]);
+    }
+    if (files.empty()) {
+        const char* bundled[] = { "cow.ply", "galleon.ply", "hammerhead.ply",
+                                  "footbones.ply", "chopper.ply", "egret.ply" };
+        files.assign(bundled, bundled + 6);
+    }
+
+    for (size_t f = 0; f < files.size(); f++) {
+        ply mesh(files[f]);
+        if (!mesh.getLoadError().empty()) {
+            printf("%s\n", mesh.getLoadError().c_str());
+            continue;
+        }
+        printf("%s: %d vertices, %d faces, %d edges\n", files[f].c_str(),
+               mesh.getVertexCount(), mesh.getFaceCount(), mesh.getEdgeCount());
+        benchLoad(mesh, files[f]);
+        benchReload(mesh, files[f]);
+        benchGraph(mesh);
+        benchNormals(mesh);
+        benchSolver(files[f]);
+        benchScene(files[f]);
+    }
+    return 0;
+}
@@ -0,0 +1,507 @@
+/*  =================== File Information =================
+  File Name: plyrender.cpp
+  Description: OpenGL drawing of a ply mesh from buffer objects
+  Author: Paul Nixon
+  ===================================================== */
+#include <math.h>
+#include <algorithm>
+// buffer object entry points are GL 1.5, past what gl.h declares by default
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glui.h>
+#include "plyrender.h"
+#include "pick.h"
+
+// position, normal and color of one face corner
+#define CORNER_FLOATS 9
+// corners uploaded together; one flag each in dirty
+#define BLOCK_CORNERS 256
+// blocks per worker pool chunk
+#define UPLOAD_MIN_CHUNK 16
+// faces per worker pool chunk when refilling around moved vertices
+#define REFILL_MIN_CHUNK 1024
+
+PlyRenderer::PlyRenderer(){
+    mesh = NULL;
+    px = py = pz = NULL;
+    normX = normY = normZ = NULL;
+    smoothX = smoothY = smoothZ = NULL;
+    lookX = 0;
+    lookZ = 1;
+    lastUploadRanges = 0;
+    lastUploadBytes = 0;
+    vertexBuffer = indexBuffer = lineBuffer = 0;
+    triangleIndexCount = 0;
+    stale = true;
+    silhouetteEdgeCount = 0;
+    silhouetteLookX = silhouetteLookZ = 0;
+    silhouetteStale = true;
+    markEpoch = 0;
+    drawnSerial = -1;
+    position[0] = position[1] = position[2] = 0;
+    scale[0] = scale[1] = scale[2] = 1;
+}
+
+void PlyRenderer::update(ply* _mesh){
+    VertexStore& vertexList = _mesh->getVertexList();
+    const FaceList& faceList = _mesh->getFaceList();
+    bool smooth = _mesh->getSmoothNormals();
+    update(_mesh, vertexList.px, vertexList.py, vertexList.pz,
+           faceList.normX, faceList.normY, faceList.normZ,
+           smooth ? vertexList.nx : NULL, smooth ? vertexList.ny : NULL,
+           smooth ? vertexList.nz : NULL, _mesh->getUpdatedVertices());
+}
+
+void PlyRenderer::update(const SimSnapshot& snapshot, int instance){
+    static const std::vector<int> none;
+    const SimInstance& copy = snapshot.instances[instance];
+    // what moved up to the snapshot drawn last is in the buffer
+    // already; the instance lists what moved after snapshot base
+    const std::vector<int>* moved = NULL;
+    if (drawnSerial >= copy.changed) {
+        moved = &none;
+    } else if (!copy.allMoved && drawnSerial >= copy.base) {
+        moved = &copy.moved;
+    }
+    drawnSerial = snapshot.serial;
+    bool smoothed = !copy.smoothX.empty();
+    update(copy.mesh, copy.px.data(), copy.py.data(), copy.pz.data(),
+           copy.normX.data(), copy.normY.data(), copy.normZ.data(),
+           smoothed ? copy.smoothX.data() : NULL,
+           smoothed ? copy.smoothY.data() : NULL,
+           smoothed ? copy.smoothZ.data() : NULL, moved);
+    // the mesh's own may be changing on the simulation thread
+    for (int k = 0; k < 3; k++) {
+        position[k] = copy.position[k];
+        scale[k] = copy.scale[k];
+    }
+}
+
+void PlyRenderer::update(ply* _mesh, const float* _px, const float* _py, const float* _pz,
+                         const float* _normX, const float* _normY, const float* _normZ,
+                         const float* _smoothX, const float* _smoothY, const float* _smoothZ,
+                         const std::vector<int>* moved){
+    bool rebuild = stale || vertexBuffer == 0 || _mesh != mesh
+            || corners.size() != (size_t)_mesh->getFaceList().indexCount * CORNER_FLOATS;
+    // turning smooth normals on or off changes the normal of every corner
+    if ((_smoothX != NULL) != (smoothX != NULL)) moved = NULL;
+    mesh = _mesh;
+    px = _px;
+    py = _py;
+    pz = _pz;
+    normX = _normX;
+    normY = _normY;
+    normZ = _normZ;
+    smoothX = _smoothX;
+    smoothY = _smoothY;
+    smoothZ = _smoothZ;
+    position[0] = mesh->getXPosition();
+    position[1] = mesh->getYPosition();
+    position[2] = mesh->getZPosition();
+    scale[0] = mesh->getXScale();
+    scale[1] = mesh->getYScale();
+    scale[2] = mesh->getZScale();
+    if (px == NULL || normX == NULL || mesh->getFaceList().indices == NULL) {
+        return;
+    }
+    if (rebuild) {
+        build();
+    } else {
+        upload(moved);
+    }
+}
+
+void PlyRenderer::invalidate(){
+    stale = true;
+    drawnSerial = -1;
+}
+
+void PlyRenderer::release(){
+    if (vertexBuffer != 0) {
+        glDeleteBuffers(1, &vertexBuffer);
+        glDeleteBuffers(1, &indexBuffer);
+        glDeleteBuffers(1, &lineBuffer);
+        vertexBuffer = indexBuffer = lineBuffer = 0;
+    }
+    invalidate();
+}
+
+void PlyRenderer::fillCorner(int c, float* out){
+    int v = mesh->getFaceList().indices[c];
+    int f = cornerFace[c];
+    out[0] = px[v];
+    out[1] = py[v];
+    out[2] = pz[v];
+    if (smoothX) {
+        out[3] = smoothX[v];
+        out[4] = smoothY[v];
+        out[5] = smoothZ[v];
+    } else {
+        out[3] = normX[f];
+        out[4] = normY[f];
+        out[5] = normZ[f];
+    }
+    out[6] = px[v];
+    out[7] = fabs(py[v]);
+    out[8] = fabs(pz[v]);
+}
+
+/*  ===============================================
+      Desc: Fills both buffers for a mesh drawn for the first time
+      Postcondition: corners and the vertex buffer match the current
+      positions, the element buffer holds every face as a fan of
+      triangles around its first corner
+    =============================================== */
+void PlyRenderer::build(){
+    const FaceList& faceList = mesh->getFaceList();
+    int faceCount = mesh->getFaceCount();
+    int cornerCount = faceList.indexCount;
+
+    cornerFace.resize(cornerCount);
+    std::vector<unsigned int> triangles;
+    for (int i = 0; i < faceCount; i++) {
+        int first = faceList.start(i);
+        int n = faceList.size(i);
+        for (int k = 0; k < n; k++) {
+            cornerFace[first + k] = i;
+        }
+        // GL flat shading takes the normal and color of the last corner
+        // of each triangle, the same one immediate mode drew last
+        for (int k = 1; k + 1 < n; k++) {
+            triangles.push_back(first);
+            triangles.push_back(first + k);
+            triangles.push_back(first + k + 1);
+        }
+    }
+    triangleIndexCount = (int)triangles.size();
+    stale = false;
+
+    // each edge between two faces, with the corners of its vertices
+    // in its first face
+    const edge* edgeList = mesh->getEdgeList();
+    int edgeCount = mesh->getEdgeCount();
+    edgeFaces.clear();
+    edgeCorners.clear();
+    for (int i = 0; i < edgeCount; i++) {
+        //boundary edges only have one face to compare against
+        if (edgeList[i].faces[1] < 0) continue;
+        int f = edgeList[i].faces[0];
+        int first = faceList.start(f);
+        int n = faceList.size(f);
+        for (int j = 0; j < 2; j++) {
+            int k = 0;
+            while (k + 1 < n && faceList.indices[first + k] != edgeList[i].vertices[j]) k++;
+            edgeCorners.push_back(first + k);
+        }
+        edgeFaces.push_back(f);
+        edgeFaces.push_back(edgeList[i].faces[1]);
+    }
+    facing.resize(faceCount);
+    silhouetteStale = true;
+
+    corners.resize((size_t)cornerCount * CORNER_FLOATS);
+    for (int c = 0; c < cornerCount; c++) {
+        fillCorner(c, &corners[(size_t)c * CORNER_FLOATS]);
+    }
+    dirty.assign((cornerCount + BLOCK_CORNERS - 1) / BLOCK_CORNERS, 0);
+    faceMark.assign(faceCount, 0);
+    vertexMark.assign(mesh->getVertexCount(), 0);
+    markEpoch = 0;
+
+    if (vertexBuffer == 0) {
+        glGenBuffers(1, &vertexBuffer);
+        glGenBuffers(1, &indexBuffer);
+        glGenBuffers(1, &lineBuffer);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, corners.size() * sizeof(float),
+                 corners.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, triangles.size() * sizeof(unsigned int),
+                 triangles.data(), GL_STATIC_DRAW);
+    // room for every edge, so a new silhouette never reallocates it
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, edgeCorners.size() * sizeof(unsigned int),
+                 NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    lastUploadRanges = 1;
+    lastUploadBytes = corners.size() * sizeof(float)
+                    + triangles.size() * sizeof(unsigned int);
+}
+
+void PlyRenderer::markFaces(int v){
+    const int* faceStart = mesh->getFaceStart();
+    const int* incidentFaces = mesh->getIncidentFaces();
+    for (int k = faceStart[v]; k < faceStart[v + 1]; k++) {
+        int f = incidentFaces[k];
+        if (faceMark[f] != markEpoch) {
+            faceMark[f] = markEpoch;
+            markedFaces.push_back(f);
+        }
+    }
+}
+
+/*  ===============================================
+      Desc: Refills the corners of the faces around the moved
+      vertices, or every corner if moved is NULL, and sends GL one
+      glBufferSubData per run of blocks holding one.  A deform only
+      touches the faces around the contact, and a mesh at rest sends
+      nothing at all.
+      Precondition: build has been called for this mesh
+    =============================================== */
+void PlyRenderer::upload(const std::vector<int>* moved){
+    const FaceList& faceList = mesh->getFaceList();
+    int cornerCount = faceList.indexCount;
+    int blockCount = (int)dirty.size();
+
+    if (moved == NULL) {
+        // block by block, so each chunk owns its dirty flags
+        mesh->getWorkerPool()->run(blockCount, UPLOAD_MIN_CHUNK, [&](int, int begin, int end) {
+            for (int b = begin; b < end; b++) {
+                int last = (b + 1) * BLOCK_CORNERS;
+                if (last > cornerCount) last = cornerCount;
+                for (int c = b * BLOCK_CORNERS; c < last; c++) {
+                    fillCorner(c, &corners[(size_t)c * CORNER_FLOATS]);
+                }
+                dirty[b] = 1;
+            }
+        });
+    } else if (!moved->empty()) {
+        // a new epoch unmarks every face and vertex without touching them
+        if (++markEpoch == 0) {
+            std::fill(faceMark.begin(), faceMark.end(), 0);
+            std::fill(vertexMark.begin(), vertexMark.end(), 0);
+            markEpoch = 1;
+        }
+        markedFaces.clear();
+        for (size_t i = 0; i < moved->size(); i++) {
+            markFaces((*moved)[i]);
+        }
+        if (smoothX != NULL) {
+            // every vertex of a face with a new normal has a new
+            // smooth normal, on each of its corners
+            markedVertices.clear();
+            size_t changed = markedFaces.size();
+            for (size_t i = 0; i < changed; i++) {
+                const int* face = faceList.vertices(markedFaces[i]);
+                for (int k = 0; k < faceList.size(markedFaces[i]); k++) {
+                    if (vertexMark[face[k]] != markEpoch) {
+                        vertexMark[face[k]] = markEpoch;
+                        markedVertices.push_back(face[k]);
+                    }
+                }
+            }
+            for (size_t i = 0; i < markedVertices.size(); i++) {
+                markFaces(markedVertices[i]);
+            }
+        }
+        int faceCount = (int)markedFaces.size();
+        mesh->getWorkerPool()->run(faceCount, REFILL_MIN_CHUNK, [&](int, int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                int f = markedFaces[i];
+                int first = faceList.start(f);
+                for (int c = first; c < first + faceList.size(f); c++) {
+                    fillCorner(c, &corners[(size_t)c * CORNER_FLOATS]);
+                }
+            }
+        });
+        for (int i = 0; i < faceCount; i++) {
+            int f = markedFaces[i];
+            int first = faceList.start(f);
+            int n = faceList.size(f);
+            for (int b = first / BLOCK_CORNERS; b <= (first + n - 1) / BLOCK_CORNERS && n > 0; b++) {
+                dirty[b] = 1;
+            }
+        }
+    }
+
+    lastUploadRanges = 0;
+    lastUploadBytes = 0;
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    for (int b = 0; b < blockCount; ) {
+        if (!dirty[b]) {
+            b++;
+            continue;
+        }
+        int runStart = b;
+        while (b < blockCount && dirty[b]) dirty[b++] = 0;
+        size_t first = (size_t)runStart * BLOCK_CORNERS;
+        size_t last = (size_t)b * BLOCK_CORNERS;
+        if (last > (size_t)cornerCount) last = cornerCount;
+        size_t offset = first * CORNER_FLOATS * sizeof(float);
+        size_t bytes = (last - first) * CORNER_FLOATS * sizeof(float);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, &corners[first * CORNER_FLOATS]);
+        lastUploadRanges++;
+        lastUploadBytes += bytes;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // moved vertices mean new face normals
+    if (lastUploadRanges > 0) silhouetteStale = true;
+}
+
+/*  ===============================================
+      Desc: Draws a filled 3D object
+      Precondition: update has been called
+      Postcondition: no changes to data
+      Error Condition: If we haven't allocated memory for our
+      faceList or vertexList then do not attempt to render.
+    =============================================== */  
+void PlyRenderer::render(){
+    if(mesh == NULL || vertexBuffer == 0 || triangleIndexCount == 0){
+                return;
+    }
+    const GLsizei stride = CORNER_FLOATS * sizeof(float);
+
+    glPushMatrix();
+    glTranslatef(position[0], position[1], position[2]);
+    glScalef(scale[0], scale[1], scale[2]);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, stride, (const GLvoid*)0);
+    glNormalPointer(GL_FLOAT, stride, (const GLvoid*)(3 * sizeof(float)));
+    glColorPointer(3, GL_FLOAT, stride, (const GLvoid*)(6 * sizeof(float)));
+
+    glDrawElements(GL_TRIANGLES, triangleIndexCount, GL_UNSIGNED_INT, (const GLvoid*)0);
+
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glPopMatrix();
+}
+
+/*  ===============================================
+      Desc: Refills lines and lineBuffer with the edges between a face
+      turned towards the look vector and one turned away from it
+      Precondition: build has been called for this mesh
+    =============================================== */
+void PlyRenderer::findSilhouette(){
+    // the mesh's scale divides its normals, so it divides the look
+    // vector the same way when facing is taken before scaling
+    pickFacing(normX, normZ, mesh->getFaceCount(), lookX / scale[0], lookZ / scale[2],
+               facing.data());
+
+    lines.clear();
+    int count = (int)edgeFaces.size() / 2;
+    const int* faces = edgeFaces.data();
+    const signed char* sign = facing.data();
+    for (int e = 0; e < count; e++) {
+        if (sign[faces[2 * e]] * sign[faces[2 * e + 1]] < 0) {
+            lines.push_back(edgeCorners[2 * e]);
+            lines.push_back(edgeCorners[2 * e + 1]);
+        }
+    }
+    silhouetteEdgeCount = (int)lines.size() / 2;
+
+    if (!lines.empty()) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineBuffer);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, lines.size() * sizeof(unsigned int),
+                        lines.data());
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+
+    silhouetteLookX = lookX;
+    silhouetteLookZ = lookZ;
+    silhouetteStale = false;
+}
+
+/*  ===============================================
+      Desc: Renders the silhouette, finding it again first if the
+      look vector or the positions changed
+      Precondition: update has been called
+    =============================================== */
+void PlyRenderer::renderSilhouette(){
+    if(mesh == NULL || vertexBuffer == 0 || normX == NULL){
+        return;
+    }
+    if (silhouetteStale || lookX != silhouetteLookX || lookZ != silhouetteLookZ) {
+        findSilhouette();
+    }
+    if (silhouetteEdgeCount == 0) return;
+
+    glPushAttrib(GL_ENABLE_BIT);
+    glDisable(GL_LIGHTING);
+    glPushMatrix();
+    glTranslatef(position[0], position[1], position[2]);
+    glScalef(scale[0], scale[1], scale[2]);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lineBuffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, CORNER_FLOATS * sizeof(float), (const GLvoid*)0);
+
+    glDrawElements(GL_LINES, 2 * silhouetteEdgeCount, GL_UNSIGNED_INT, (const GLvoid*)0);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glPopMatrix();
+    glPopAttrib();
+}
+
+SceneRenderer::SceneRenderer(){
+    lookX = 0;
+    lookZ = 1;
+    serial = -1;
+    lastUploadRanges = 0;
+    lastUploadBytes = 0;
+    silhouetteEdgeCount = 0;
+}
+
+void SceneRenderer::update(const SimSnapshot& snapshot){
+    if (snapshot.scene != scene) {
+        // the instances drawn before are gone with their scene
+        for (size_t i = 0; i < renderers.size(); i++) {
+            if (renderers[i]) renderers[i]->release();
+        }
+        renderers.clear();
+        scene = snapshot.scene;
+        serial = -1;
+    }
+    if (snapshot.serial == serial) return;
+    serial = snapshot.serial;
+    if (renderers.size() < snapshot.instances.size()) {
+        renderers.resize(snapshot.instances.size());
+    }
+    visible.assign(snapshot.visible.begin(), snapshot.visible.end());
+    lastUploadRanges = 0;
+    lastUploadBytes = 0;
+    for (size_t k = 0; k < visible.size(); k++) {
+        int i = visible[k];
+        if (!renderers[i]) renderers[i].reset(new PlyRenderer());
+        renderers[i]->update(snapshot, i);
+        lastUploadRanges += renderers[i]->lastUploadRanges;
+        lastUploadBytes += renderers[i]->lastUploadBytes;
+    }
+}
+
+void SceneRenderer::render(){
+    for (size_t k = 0; k < visible.size(); k++) {
+        PlyRenderer& r = *renderers[visible[k]];
+        glShadeModel(r.isSmooth() ? GL_SMOOTH : GL_FLAT);
+        r.render();
+    }
+}
+
+void SceneRenderer::renderSilhouette(){
+    silhouetteEdgeCount = 0;
+    for (size_t k = 0; k < visible.size(); k++) {
+        PlyRenderer& r = *renderers[visible[k]];
+        r.lookX = lookX;
+        r.lookZ = lookZ;
+        r.renderSilhouette();
+        silhouetteEdgeCount += r.silhouetteEdgeCount;
+    }
+}
+
+void SceneRenderer::clear(){
+    renderers.clear();
+    visible.clear();
+    scene.reset();
+    serial = -1;
+}
@@ -0,0 +1,198 @@
+/*  =================== File Information =================
+        File Name: plyrender.h
+        Description: OpenGL drawing of ply meshes from buffer objects
+        Author:
+
+        Purpose: The only part of the mesh code that needs GL.  Each
+                 frame, update() takes the positions and normals to draw
+                 (the mesh's own or an instance in a simulation
+                 snapshot) and sends the
+                 parts of the vertex buffer that changed to GL; render()
+                 and renderSilhouette() then only issue GL calls.  What
+                 changed is told, not searched for: the corners of the
+                 faces around the moved vertices (two rings of faces
+                 with smooth normals, whose vertex normals change too)
+                 are refilled and their blocks of the buffer sent.
+
+                 The vertex buffer holds one position, normal and color
+                 per face corner, in faceList index order, so that flat
+                 shading still gets one normal per face.  The element
+                 buffer holds the fan triangulation of the faces and is
+                 only written when a mesh is first drawn.  With smooth
+                 normals each corner takes its vertex's normal instead.
+
+                 The silhouette is a third buffer of line indices into
+                 the same corners.  It is only rebuilt when the look
+                 vector or the positions change: one vector pass for the
+                 facing sign of every face, then one pass over a packed
+                 table of the two faces and two corners of each edge.  Needs GL 1.5
+                 buffer objects, which Mesa's llvmpipe provides.
+
+                 SceneRenderer draws a simulation's scene: each snapshot
+                 lists the instances in view, and each of those has its
+                 own PlyRenderer, updated from its copy in the snapshot
+                 and drawn at its position and scale.  Instances out of
+                 view cost nothing and keep their buffers for when they
+                 come back.
+        ===================================================== */
+#ifndef PLYRENDER_H
+#define PLYRENDER_H
+
+#include <memory>
+#include <vector>
+#include "ply.h"
+#include "simulation.h"
+
+class PlyRenderer{
+
+public:
+	// GL buffers are made by the first update; they are not deleted
+	// here since the GL context may already be gone
+	PlyRenderer();
+
+	/*  ===============================================
+	      Desc: Draw mesh at these positions, with these face normals
+	            (and per-vertex smooth normals, unless NULL) from now
+	            on, and upload the corners of the faces around the
+	            vertices in moved
+	      Precondition: the arrays stay valid until the next update,
+	            a GL context is current; moved lists every vertex whose
+	            position changed since the last update, or is NULL if
+	            any may have
+	    =============================================== */
+	void update(ply* mesh, const float* px, const float* py, const float* pz,
+	            const float* normX, const float* normY, const float* normZ,
+	            const float* smoothX, const float* smoothY, const float* smoothZ,
+	            const std::vector<int>* moved);
+	// same, with the mesh's current positions and normals; call once
+	// after each updateNormals, whose moved vertices it uploads
+	void update(ply* mesh);
+	/*  ===============================================
+	      Desc: Same, with one instance of a simulation snapshot.
+	            Only what moved since the snapshot this renderer last
+	            drew is uploaded, nothing if the instance has not
+	            changed since.
+	      Precondition: snapshot.instances[instance] is filled in,
+	            that is instance is in snapshot.visible
+	    =============================================== */
+	void update(const SimSnapshot& snapshot, int instance);
+	/*  ===============================================
+	      Desc: Makes the next update refill both buffers from
+	            scratch.  Call after the mesh is reloaded; needs
+	            no GL context.
+	    =============================================== */
+	void invalidate();
+	// Deletes the GL buffers, which the next update makes again;
+	// needs the GL context they were made in
+	void release();
+	// Whether the last update had smooth normals
+	bool isSmooth() const { return smoothX != NULL; }
+
+	// Draws the faces, filled or wireframe as glPolygonMode says
+	void render();
+	// Draws the edges between a face turned towards the look vector
+	// and one turned away from it, unlit
+	void renderSilhouette();
+
+	//components of look vector (changeable by rotation around Y)
+	float lookX;//0.0 when Y-rotation = 0
+	float lookZ;//1.0 when Y-rotation = 0
+
+	// What the last update sent to GL, for profiling
+	int lastUploadRanges;
+	size_t lastUploadBytes;
+	// Edges in the silhouette last drawn
+	int silhouetteEdgeCount;
+
+private:
+	ply* mesh;
+	const float *px, *py, *pz;
+	const float *normX, *normY, *normZ;
+	const float *smoothX, *smoothY, *smoothZ;
+	// where render places the mesh
+	float position[3], scale[3];
+
+	// GL buffer names, 0 until built
+	unsigned int vertexBuffer, indexBuffer, lineBuffer;
+	int triangleIndexCount;
+	// set until build has run for the current mesh
+	bool stale;
+	// copy of the vertex buffer, CORNER_FLOATS per corner
+	std::vector<float> corners;
+	// face of every corner
+	std::vector<int> cornerFace;
+	// one flag per block of corners changed by this update
+	std::vector<unsigned char> dirty;
+	// markEpoch in faceMark / vertexMark marks the faces and vertices
+	// already collected by the current upload
+	std::vector<unsigned> faceMark, vertexMark;
+	unsigned markEpoch;
+	std::vector<int> markedFaces, markedVertices;
+	// serial of the snapshot last drawn
+	long drawnSerial;
+
+	// faces 2e, 2e + 1 and matching corners 2e, 2e + 1 of every
+	// edge between two faces
+	std::vector<int> edgeFaces;
+	std::vector<unsigned int> edgeCorners;
+	// pickFacing of every face for the look vector below
+	std::vector<signed char> facing;
+	// corner pairs of the silhouette in lineBuffer
+	std::vector<unsigned int> lines;
+	float silhouetteLookX, silhouetteLookZ;
+	// set when positions changed since lines was filled
+	bool silhouetteStale;
+	void findSilhouette();
+
+	void build();
+	void upload(const std::vector<int>* moved);
+	// collects the faces around vertex v into markedFaces
+	void markFaces(int v);
+	// the record corner c should hold for the current positions
+	void fillCorner(int c, float* out);
+};
+
+/*  ============== SceneRenderer ==============
+        Draws the instances in view of simulation snapshots, one
+        PlyRenderer and set of GL buffers per instance
+        ==================================== */
+class SceneRenderer{
+
+public:
+	SceneRenderer();
+
+	/*  ===============================================
+	      Desc: Takes the instances in view of snapshot, and uploads
+	            what changed in each; a snapshot already taken does
+	            nothing.  The buffers of a scene no longer drawn are
+	            deleted.
+	      Precondition: a GL context is current
+	    =============================================== */
+	void update(const SimSnapshot& snapshot);
+	// Draws every instance of the last update, as PlyRenderer does
+	void render();
+	void renderSilhouette();
+	// Forgets every instance and the scene without GL calls, for
+	// when the context may already be gone
+	void clear();
+
+	//components of look vector (changeable by rotation around Y)
+	float lookX;
+	float lookZ;
+
+	// What the last update sent to GL, summed over the instances
+	int lastUploadRanges;
+	size_t lastUploadBytes;
+	// Edges in the silhouettes last drawn
+	int silhouetteEdgeCount;
+
+private:
+	// the scene drawn, kept alive while its meshes are
+	std::shared_ptr<Scene> scene;
+	long serial;
+	// one renderer per instance, made the first time it is in view
+	std::vector<std::unique_ptr<PlyRenderer> > renderers;
+	std::vector<int> visible;
+};
+
+#endif
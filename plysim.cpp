@@ -0,0 +1,172 @@
+/*  =================== File Information =================
+        File Name: plysim.cpp
+        Description: Runs the deformation simulation without a window
+        Author:
+
+        Purpose: Command line batch tool, run as
+                 ./plysim [options] file.ply
+                 It drops projectiles onto the mesh the way myMouse
+                 does in drop mode, runs the spring solver every step,
+                 prints timing statistics and can write the final mesh.
+                 Links without any GL, GLUT or GLUI library.
+        ===================================================== */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "ply.h"
+#include "simulation.h"
+
+using namespace std;
+
+typedef chrono::steady_clock simClock;
+
+static double msSince(simClock::time_point start) {
+    return chrono::duration<double, milli>(simClock::now() - start).count();
+}
+
+static void usage() {
+    printf("usage: ./plysim [options] file.ply\n"
+           "  -steps N          simulation steps (1000)\n"
+           "  -every K          drop new projectiles every K steps (100)\n"
+           "  -count N          projectiles per drop, spread over the mesh (1)\n"
+           "  -projectile TYPE  sphere or cube (sphere)\n"
+           "  -radius R         sphere radius / cube edge (0.1)\n"
+           "  -height Y         drop height (3)\n"
+           "  -solver NAME      explicit, implicit, pbd or none (explicit)\n"
+           "  -dt SECONDS       solver time step (0.01)\n"
+           "  -lift             pass w = true to adjustModel\n"
+           "  -threads N        worker threads (PLY_THREADS, or every core)\n"
+           "  -nocache          neither read nor write the mesh cache (PLY_CACHE=0)\n"
+           "  -seed S           seed for the drop positions (1)\n"
+           "  -out FILE         write the final mesh as binary .ply\n");
+}
+
+int main(int argc, char* argv[]) {
+    int steps = 1000;
+    int every = 100;
+    int count = 1;
+    projectileType type = PROJECTILE_SPHERE;
+    float radius = 0.1f;
+    float height = 3;
+    string solver = "explicit";
+    float dt = 0.01f;
+    bool lift = false;
+    int threads = 0;
+    unsigned seed = 1;
+    string input, output;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-steps" && hasValue) steps = atoi(argv[++i]);
+        else if (arg == "-every" && hasValue) every = atoi(argv[++i]);
+        else if (arg == "-count" && hasValue) count = atoi(argv[++i]);
+        else if (arg == "-projectile" && hasValue) {
+            string name = argv[++i];
+            if (name == "cube") type = PROJECTILE_CUBE;
+            else if (name == "sphere") type = PROJECTILE_SPHERE;
+            else { usage(); return 1; }
+        }
+        else if (arg == "-radius" && hasValue) radius = atof(argv[++i]);
+        else if (arg == "-height" && hasValue) height = atof(argv[++i]);
+        else if (arg == "-solver" && hasValue) solver = argv[++i];
+        else if (arg == "-dt" && hasValue) dt = atof(argv[++i]);
+        else if (arg == "-lift") lift = true;
+        else if (arg == "-threads" && hasValue) threads = atoi(argv[++i]);
+        else if (arg == "-nocache") ply::setCacheEnabled(false);
+        else if (arg == "-seed" && hasValue) seed = atoi(argv[++i]);
+        else if (arg == "-out" && hasValue) output = argv[++i];
+        else if (arg[0] != '-' && input.empty()) input = arg;
+        else { usage(); return 1; }
+    }
+    // !(dt > 0) also turns away a dt that is not a number
+    if (input.empty() || steps < 0 || every < 1 || count < 1 || !(dt > 0) || isinf(dt)) {
+        usage();
+        return 1;
+    }
+    if (solver != "explicit" && solver != "implicit" && solver != "pbd" && solver != "none") {
+        usage();
+        return 1;
+    }
+    if (threads > 0) WorkerPool::shared().setThreadCount(threads);
+
+    simClock::time_point start = simClock::now();
+    shared_ptr<ply> mesh = make_shared<ply>(input);
+    double loadMs = msSince(start);
+    if (!mesh->getLoadError().empty()) {
+        printf("%s\n", mesh->getLoadError().c_str());
+        return 1;
+    }
+    printf("%s: %d vertices, %d faces, %d edges, loaded in %.3f ms%s\n", input.c_str(),
+           mesh->getVertexCount(), mesh->getFaceCount(), mesh->getEdgeCount(), loadMs,
+           mesh->loadedFromCache() ? " from cache" : "");
+
+    Simulation simulation(mesh);
+    // the simulation sets the mesh's time step from its step rate
+    simulation.setStepRate(1.0 / dt);
+    simulation.setDrop(true);
+    simulation.setSolver(solver != "none", lift);
+    if (solver == "implicit") simulation.setIntegrator(PLY_IMPLICIT);
+    if (solver == "pbd") simulation.setIntegrator(PLY_PBD);
+
+    // drop positions over the mesh, which scaleAndCenter fit in [-0.5, 0.5]
+    mt19937 random(seed);
+    uniform_real_distribution<float> spread(-0.5f, 0.5f);
+
+    vector<double> stepMs(steps);
+    int drops = 0;
+    int mostInFlight = 0;
+    long contacts = 0;
+    start = simClock::now();
+    for (int s = 0; s < steps; s++) {
+        if (s % every == 0) {
+            for (int k = 0; k < count; k++) {
+                Projectile p;
+                p.type = type;
+                p.radius = radius;
+                p.trajectory = Vectorf(0, -0.005f, 0);
+                float x = spread(random);
+                float z = spread(random);
+                p.position = Pointf(x, height, z);
+                simulation.launch(p);
+                drops++;
+            }
+        }
+        simClock::time_point stepStart = simClock::now();
+        simulation.step();
+        stepMs[s] = msSince(stepStart);
+        mostInFlight = max(mostInFlight, simulation.getProjectileCount());
+        contacts += simulation.getContactCount();
+    }
+    double totalMs = msSince(start);
+
+    printf("  solver           %s, dt %g, %d threads\n", solver.c_str(), dt,
+           WorkerPool::shared().getThreadCount());
+    printf("  steps            %d (%d drops, %.3f s simulated)\n", steps, drops,
+           simulation.getSimulatedTime());
+    printf("  projectiles      %d in flight at most, %ld contacts\n", mostInFlight, contacts);
+    if (steps > 0) {
+        sort(stepMs.begin(), stepMs.end());
+        printf("  total            %10.3f ms (%.1f steps/s)\n", totalMs, steps / totalMs * 1000);
+        printf("  step mean        %10.3f ms\n", totalMs / steps);
+        printf("  step p50         %10.3f ms\n", stepMs[steps / 2]);
+        printf("  step p95         %10.3f ms\n", stepMs[(int)(steps * 0.95)]);
+        printf("  step max         %10.3f ms\n", stepMs[steps - 1]);
+    }
+
+    if (!output.empty()) {
+        if (!mesh->save(output)) {
+            printf("could not write %s\n", output.c_str());
+            return 1;
+        }
+        printf("  wrote            %s\n", output.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*  =================== File Information =================
+        File Name: projectiles.cpp
+        Description: Every projectile in flight, as a structure of arrays
+        Author:
+        ===================================================== */
+#include "projectiles.h"
+
+// speed a projectile that hits nothing gains per step while dropping
+#define PROJECTILE_GRAVITY 0.001f
+// fraction of its speed a cube / sphere keeps when it hits the mesh
+#define CUBE_DAMPING 0.1f
+#define SPHERE_DAMPING 0.01f
+// a sphere slower than this after a hit comes to rest
+#define SPHERE_REST 0.0001
+// projectiles this far from the origin are gone for good; the mesh
+// is scaled to fit in [-0.5, 0.5]
+#define PROJECTILE_RANGE 100.0f
+
+ProjectileSystem::ProjectileSystem(){
+}
+
+void ProjectileSystem::add(const Projectile& p){
+	if (!p.active()) return;
+	px.push_back(p.position[0]);
+	py.push_back(p.position[1]);
+	pz.push_back(p.position[2]);
+	vx.push_back(p.trajectory[0]);
+	vy.push_back(p.trajectory[1]);
+	vz.push_back(p.trajectory[2]);
+	radius.push_back(p.radius);
+	type.push_back((unsigned char)p.type);
+}
+
+void ProjectileSystem::clear(){
+	px.clear();
+	py.clear();
+	pz.clear();
+	vx.clear();
+	vy.clear();
+	vz.clear();
+	radius.clear();
+	type.clear();
+}
+
+Projectile ProjectileSystem::get(int i) const{
+	Projectile p;
+	p.type = (projectileType)type[i];
+	p.position = Pointf(px[i], py[i], pz[i]);
+	p.trajectory = Vectorf(vx[i], vy[i], vz[i]);
+	p.radius = radius[i];
+	return p;
+}
+
+int ProjectileSystem::step(ply& mesh, bool drop){
+	integrate();
+	int hits = collide(mesh);
+	respond(drop);
+	removeStopped();
+	return hits;
+}
+
+void ProjectileSystem::integrate(){
+	int n = size();
+	float *x = px.data(), *y = py.data(), *z = pz.data();
+	const float *dx = vx.data(), *dy = vy.data(), *dz = vz.data();
+	for (int i = 0; i < n; i++) {
+		x[i] += dx[i];
+		y[i] += dy[i];
+		z[i] += dz[i];
+	}
+}
+
+/*  ===============================================
+      Desc: Finds and resolves every contact with the mesh.  One pass
+            over all projectiles keeps those whose box reaches the
+            mesh's bounds; only they query the grid, all against the
+            mesh as it was before the step, and the mesh is then
+            deformed at every contact in a single pass, so the result
+            does not depend on how many are in flight elsewhere.
+    =============================================== */
+int ProjectileSystem::collide(ply& mesh){
+	int n = size();
+	hit.assign(n, 0);
+	candidates.clear();
+	float lo[3], hi[3];
+	if (n == 0 || !mesh.getWorldBounds(lo, hi)) return 0;
+
+	const float *x = px.data(), *y = py.data(), *z = pz.data();
+	unsigned char* near = hit.data();
+	for (int i = 0; i < n; i++) {
+		float r = reach(i);
+		near[i] = (x[i] + r > lo[0]) & (x[i] - r < hi[0])
+		        & (y[i] + r > lo[1]) & (y[i] - r < hi[1])
+		        & (z[i] + r > lo[2]) & (z[i] - r < hi[2]);
+	}
+	for (int i = 0; i < n; i++) {
+		if (near[i]) candidates.push_back(i);
+		near[i] = 0;
+	}
+
+	int hits = 0;
+	for (size_t c = 0; c < candidates.size(); c++) {
+		int i = candidates[c];
+		bool touched = addContact(i, mesh);
+		hit[i] = touched;
+		hits += touched;
+	}
+	mesh.deformContacts();
+	return hits;
+}
+
+bool ProjectileSystem::addContact(int i, ply& mesh){
+	Pointf position(px[i], py[i], pz[i]);
+	Vectorf push = Vectorf(vx[i], vy[i], vz[i]) / 100;
+	if (type[i] == PROJECTILE_CUBE) {
+		float half = radius[i] / 2;
+		Vectorf r(half, half, half);
+		return mesh.addBoxContact(position - r, position + r, push);
+	}
+	return mesh.addSphereContact(position, radius[i], push);
+}
+
+void ProjectileSystem::respond(bool drop){
+	int n = size();
+	hit.resize(n, 0);
+	float *dx = vx.data(), *dy = vy.data(), *dz = vz.data();
+	const unsigned char *shape = type.data(), *touched = hit.data();
+	float gravity = drop ? PROJECTILE_GRAVITY : 0;
+	for (int i = 0; i < n; i++) {
+		float damping = shape[i] == PROJECTILE_SPHERE ? SPHERE_DAMPING : CUBE_DAMPING;
+		float keep = touched[i] ? damping : 1;
+		float fall = touched[i] ? 0 : gravity;
+		dx[i] = dx[i] * keep;
+		dy[i] = dy[i] * keep - fall;
+		dz[i] = dz[i] * keep;
+	}
+}
+
+void ProjectileSystem::removeStopped(){
+	int n = size();
+	hit.resize(n, 0);
+	int kept = 0;
+	for (int i = 0; i < n; i++) {
+		float speed = Vectorf(vx[i], vy[i], vz[i]).length();
+		bool resting = type[i] == PROJECTILE_SPHERE && hit[i] && speed < SPHERE_REST;
+		float distance2 = px[i] * px[i] + py[i] * py[i] + pz[i] * pz[i];
+		if (resting || !(speed > 0) || !(distance2 < PROJECTILE_RANGE * PROJECTILE_RANGE)) continue;
+		px[kept] = px[i];
+		py[kept] = py[i];
+		pz[kept] = pz[i];
+		vx[kept] = vx[i];
+		vy[kept] = vy[i];
+		vz[kept] = vz[i];
+		radius[kept] = radius[i];
+		type[kept] = type[i];
+		kept++;
+	}
+	px.resize(kept);
+	py.resize(kept);
+	pz.resize(kept);
+	vx.resize(kept);
+	vy.resize(kept);
+	vz.resize(kept);
+	radius.resize(kept);
+	type.resize(kept);
+}
@@ -0,0 +1,92 @@
+/*  =================== File Information =================
+        File Name: projectiles.h
+        Description: Every projectile in flight, as a structure of arrays
+        Author:
+
+        Purpose: Keeps any number of cubes and spheres flying at once.
+                 Positions, velocities, sizes and types are each one
+                 array, so moving them all is a single pass over floats
+                 the compiler vectorizes.  Contacts are found in one
+                 batch per step: a vectorized pass tests every projectile
+                 against the bounds of the mesh, only those that reach
+                 it query the mesh's pick grid, and one breadth first
+                 search from all their contacts deforms the mesh, so a
+                 step costs about the number of projectiles plus the
+                 cells and vertices they touch, never projectiles times
+                 vertices.
+        ===================================================== */
+#ifndef PROJECTILES_H
+#define PROJECTILES_H
+
+#include <vector>
+#include "ply.h"
+#include "AlgebraF.h"
+
+enum projectileType { PROJECTILE_CUBE, PROJECTILE_SPHERE };
+
+/*  ============== Projectile ==============
+        A cube or sphere flying through the scene.  It deforms the mesh
+        where it hits and loses most of its speed doing so.
+        ==================================== */
+struct Projectile {
+        projectileType type;
+        Pointf position;
+        Vectorf trajectory;   // distance moved per step
+        float radius;        // sphere radius, or cube edge length
+
+        Projectile() { type = PROJECTILE_CUBE; radius = 0.1f; }
+        bool active() const { return trajectory.length() > 0; }
+};
+
+class ProjectileSystem {
+
+public:
+	ProjectileSystem();
+
+	// Adds p; a projectile that does not move is dropped at once
+	void add(const Projectile& p);
+	void clear();
+	int size() const { return (int)px.size(); }
+	// Projectile i as a single record
+	Projectile get(int i) const;
+
+	/*  ===============================================
+	      Desc: Advances every projectile by one step.  All of them
+	            move first, then every one that reaches the mesh
+	            deforms it by its trajectory / 100 (all contacts are
+	            found before any of them moves the mesh) and loses
+	            most of its speed; the others fall while drop is on.
+	            Projectiles that stopped or left the scene are removed,
+	            the rest keep their order.
+	      Returns: the number of projectiles that hit the mesh
+	    =============================================== */
+	int step(ply& mesh, bool drop);
+
+	// The stages of step, for callers with more than one mesh (Scene):
+	// move all, gather the contacts of each mesh and deform it, apply
+	// the hits and gravity, drop the stopped
+	void integrate();
+	// how far projectile i reaches from its center along each axis;
+	// a cube reaches half its edge
+	float reach(int i) const { return type[i] == PROJECTILE_SPHERE ? radius[i] : radius[i] / 2; }
+	// gathers where projectile i touches mesh, true if it does; the
+	// mesh moves on its deformContacts
+	bool addContact(int i, ply& mesh);
+	void respond(bool drop);
+	void removeStopped();
+
+	// one entry per projectile, read by the renderer
+	std::vector<float> px, py, pz;     // position
+	std::vector<float> vx, vy, vz;     // distance moved per step
+	std::vector<float> radius;         // sphere radius, or cube edge length
+	std::vector<unsigned char> type;   // projectileType
+	std::vector<unsigned char> hit;    // touched a mesh this step
+
+private:
+	// fills hit, returns how many hit
+	int collide(ply& mesh);
+
+	std::vector<int> candidates;       // reach the mesh's bounds
+};
+
+#endif
@@ -0,0 +1,315 @@
+/*  =================== File Information =================
+        File Name: scene.cpp
+        Description: Many placed meshes and the projectiles flying between them
+        Author:
+        ===================================================== */
+#include "scene.h"
+#include <algorithm>
+#include <math.h>
+
+// steps after its last hit that an instance keeps being adjusted;
+// two seconds at 60 steps per second, by which time the
+// spring damping has let the dent settle
+#define SCENE_SLEEP_STEPS 120
+
+using namespace std;
+
+Scene::Scene(WorkerPool* pool){
+	workers = pool;
+	stepCount = 0;
+	pairCount = 0;
+	widestX = 0;
+}
+
+shared_ptr<ply> Scene::getGeometry(const string& path, string* error){
+	map<string, shared_ptr<ply> >::iterator found = geometries.find(path);
+	if (found != geometries.end()) return found->second;
+	shared_ptr<ply> geometry(new ply(path, workers));
+	if (!geometry->getLoadError().empty()) {
+		if (error != NULL) *error = geometry->getLoadError();
+		return shared_ptr<ply>();
+	}
+	geometries[path] = geometry;
+	return geometry;
+}
+
+int Scene::add(shared_ptr<ply> geometry, const Pointf& position, float scale){
+	int i = place(shared_ptr<ply>(new ply(geometry, workers)));
+	instances[i]->setPosition(position[0], position[1], position[2]);
+	instances[i]->setScale(scale, scale, scale);
+	moved(i);
+	return i;
+}
+
+int Scene::insert(shared_ptr<ply> mesh){
+	int i = place(mesh);
+	// a mesh from elsewhere need not be at rest
+	wake(i);
+	return i;
+}
+
+int Scene::place(shared_ptr<ply> mesh){
+	int i = (int)instances.size();
+	instances.push_back(mesh);
+	loX.push_back(0); loY.push_back(0); loZ.push_back(0);
+	hiX.push_back(0); hiY.push_back(0); hiZ.push_back(0);
+	order.push_back(i);
+	isStale.push_back(0);
+	isChanged.push_back(0);
+	lastHit.push_back(0);
+	isAwake.push_back(0);
+	return i;
+}
+
+int Scene::add(const string& path, const Pointf& position, float scale){
+	shared_ptr<ply> geometry = getGeometry(path);
+	if (geometry == NULL) return -1;
+	return add(geometry, position, scale);
+}
+
+void Scene::moved(int i){
+	if (!isChanged[i]) {
+		isChanged[i] = 1;
+		changed.push_back(i);
+	}
+	if (isStale[i]) return;
+	isStale[i] = 1;
+	stale.push_back(i);
+}
+
+void Scene::wake(int i){
+	lastHit[i] = stepCount;
+	moved(i);
+	if (isAwake[i]) return;
+	isAwake[i] = 1;
+	awake.push_back(i);
+}
+
+void Scene::refreshBounds(){
+	if (stale.empty()) return;
+	for (size_t k = 0; k < stale.size(); k++) {
+		int i = stale[k];
+		float lo[3], hi[3];
+		if (!instances[i]->getWorldBounds(lo, hi)) {
+			// an empty mesh overlaps nothing
+			lo[0] = lo[1] = lo[2] = INFINITY;
+			hi[0] = hi[1] = hi[2] = -INFINITY;
+		}
+		loX[i] = lo[0]; loY[i] = lo[1]; loZ[i] = lo[2];
+		hiX[i] = hi[0]; hiY[i] = hi[1]; hiZ[i] = hi[2];
+		isStale[i] = 0;
+	}
+	stale.clear();
+
+	// boxes move little between steps, so the order is nearly sorted
+	// and insertion sort is close to one pass; the same pass finds the
+	// widest box, which bounds how far before a range cull has to look
+	int n = (int)order.size();
+	widestX = 0;
+	for (int k = 0; k < n; k++) {
+		int i = order[k];
+		if (hiX[i] - loX[i] > widestX) widestX = hiX[i] - loX[i];
+	}
+	for (int k = 1; k < n; k++) {
+		int i = order[k];
+		float key = loX[i];
+		int j = k - 1;
+		while (j >= 0 && loX[order[j]] > key) {
+			order[j + 1] = order[j];
+			j--;
+		}
+		order[j + 1] = i;
+	}
+}
+
+/*  ===============================================
+      Desc: Sweep and prune.  The projectiles and the instances are
+            walked together in order of the low x of their boxes.  Each
+            box, when reached, is checked against the boxes of the other
+            kind still open (whose high x is not behind it), which gives
+            every pair overlapping in x exactly once; y and z are tested
+            on those.  Pairs are resolved sorted by projectile, then
+            instance, so the outcome does not depend on the sweep;
+            each instance hit deforms once, at all of its contacts.
+    =============================================== */
+int Scene::step(ProjectileSystem& projectiles, bool drop){
+	stepCount++;
+	projectiles.integrate();
+	int n = projectiles.size();
+	projectiles.hit.assign(n, 0);
+	refreshBounds();
+
+	const float *x = projectiles.px.data(), *y = projectiles.py.data(), *z = projectiles.pz.data();
+	projectileLo.resize(n);
+	sortedProjectiles.resize(n);
+	for (int p = 0; p < n; p++) {
+		projectileLo[p] = x[p] - projectiles.reach(p);
+		sortedProjectiles[p] = p;
+	}
+	const float* pLo = projectileLo.data();
+	sort(sortedProjectiles.begin(), sortedProjectiles.end(),
+	     [pLo](int a, int b) { return pLo[a] < pLo[b] || (pLo[a] == pLo[b] && a < b); });
+
+	pairs.clear();
+	activeProjectiles.clear();
+	activeInstances.clear();
+	int instanceCount = (int)order.size();
+	int pi = 0, ii = 0;
+	while (pi < n || ii < instanceCount) {
+		bool projectileNext = ii == instanceCount
+			|| (pi < n && pLo[sortedProjectiles[pi]] <= loX[order[ii]]);
+		if (projectileNext) {
+			int p = sortedProjectiles[pi++];
+			float r = projectiles.reach(p);
+			for (size_t k = 0; k < activeInstances.size(); ) {
+				int a = activeInstances[k];
+				if (hiX[a] <= pLo[p]) {
+					activeInstances[k] = activeInstances.back();
+					activeInstances.pop_back();
+					continue;
+				}
+				if (y[p] + r > loY[a] && y[p] - r < hiY[a] && z[p] + r > loZ[a] && z[p] - r < hiZ[a]) {
+					pairs.push_back(((long long)p << 32) | a);
+				}
+				k++;
+			}
+			activeProjectiles.push_back(p);
+		} else {
+			int i = order[ii++];
+			for (size_t k = 0; k < activeProjectiles.size(); ) {
+				int a = activeProjectiles[k];
+				float r = projectiles.reach(a);
+				if (x[a] + r <= loX[i]) {
+					activeProjectiles[k] = activeProjectiles.back();
+					activeProjectiles.pop_back();
+					continue;
+				}
+				if (pLo[a] < hiX[i] && y[a] + r > loY[i] && y[a] - r < hiY[i]
+				    && z[a] + r > loZ[i] && z[a] - r < hiZ[i]) {
+					pairs.push_back(((long long)a << 32) | i);
+				}
+				k++;
+			}
+			activeInstances.push_back(i);
+		}
+	}
+	sort(pairs.begin(), pairs.end());
+	pairCount = (int)pairs.size();
+
+	// every instance gathers all of its contacts, then deforms once
+	contacted.clear();
+	for (size_t k = 0; k < pairs.size(); k++) {
+		int p = (int)(pairs[k] >> 32);
+		int i = (int)(pairs[k] & 0xffffffff);
+		if (projectiles.addContact(p, *instances[i])) {
+			projectiles.hit[p] = 1;
+			if (lastHit[i] != stepCount) contacted.push_back(i);
+			wake(i);
+		}
+	}
+	for (size_t k = 0; k < contacted.size(); k++) {
+		instances[contacted[k]]->deformContacts();
+	}
+	int hits = 0;
+	for (int p = 0; p < n; p++) {
+		hits += projectiles.hit[p];
+	}
+	projectiles.respond(drop);
+	projectiles.removeStopped();
+	return hits;
+}
+
+int Scene::adjust(bool lift){
+	if (lift) {
+		for (size_t i = 0; i < instances.size(); i++) {
+			wake((int)i);
+		}
+	}
+	int adjusted = 0;
+	for (size_t k = 0; k < awake.size(); ) {
+		int i = awake[k];
+		if (stepCount - lastHit[i] >= SCENE_SLEEP_STEPS) {
+			isAwake[i] = 0;
+			awake[k] = awake.back();
+			awake.pop_back();
+			continue;
+		}
+		instances[i]->adjustModel(lift);
+		moved(i);
+		adjusted++;
+		k++;
+	}
+	return adjusted;
+}
+
+void Scene::takeChanged(vector<int>& out){
+	out.swap(changed);
+	changed.clear();
+	for (size_t k = 0; k < out.size(); k++) {
+		isChanged[out[k]] = 0;
+	}
+}
+
+// The x range of the eight corners of the view volume bounded by the
+// plane pairs 0 1, 2 3 and 4 5; false if three of them do not meet in
+// a point.  A corner is where three planes n.x + d = 0 meet:
+// x = -(d1 n2 x n3 + d2 n3 x n1 + d3 n1 x n2) / n1.(n2 x n3)
+static bool viewRangeX(const float planes[6][4], float& lo, float& hi){
+	lo = INFINITY;
+	hi = -INFINITY;
+	for (int c = 0; c < 8; c++) {
+		const float* a = planes[c & 1];
+		const float* b = planes[2 + ((c >> 1) & 1)];
+		const float* d = planes[4 + (c >> 2)];
+		float bd[3] = { b[1] * d[2] - b[2] * d[1], b[2] * d[0] - b[0] * d[2], b[0] * d[1] - b[1] * d[0] };
+		float daX = d[1] * a[2] - d[2] * a[1];
+		float abX = a[1] * b[2] - a[2] * b[1];
+		float det = a[0] * bd[0] + a[1] * bd[1] + a[2] * bd[2];
+		float x = -(a[3] * bd[0] + b[3] * daX + d[3] * abX) / det;
+		if (!isfinite(x)) return false;
+		lo = min(lo, x);
+		hi = max(hi, x);
+	}
+	return true;
+}
+
+/*  ===============================================
+      Desc: Culls along the sweep order.  The instances whose box can
+            reach the x range of the view volume lie in one run of
+            order: from the first whose low x is past the view's low x
+            less the widest box, to the last whose low x is before the
+            view's high x.  Two binary searches find it and only the
+            instances in it are tested against the planes.
+    =============================================== */
+const vector<int>& Scene::cull(const float planes[6][4]){
+	refreshBounds();
+	visible.clear();
+	float viewLo, viewHi;
+	if (!viewRangeX(planes, viewLo, viewHi)) {
+		viewLo = -INFINITY;
+		viewHi = INFINITY;
+	}
+	const float* lo = loX.data();
+	const int* sweep = order.data();
+	int n = (int)order.size();
+	int first = (int)(lower_bound(sweep, sweep + n, viewLo - widestX,
+		[lo](int i, float x) { return lo[i] < x; }) - sweep);
+	int last = (int)(upper_bound(sweep + first, sweep + n, viewHi,
+		[lo](float x, int i) { return x < lo[i]; }) - sweep);
+	for (int k = first; k < last; k++) {
+		int i = order[k];
+		if (!(loX[i] <= hiX[i]) || hiX[i] < viewLo) continue;
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++) {
+			// the corner furthest along the plane's normal
+			const float* plane = planes[p];
+			float fx = plane[0] >= 0 ? hiX[i] : loX[i];
+			float fy = plane[1] >= 0 ? hiY[i] : loY[i];
+			float fz = plane[2] >= 0 ? hiZ[i] : loZ[i];
+			inside = plane[0] * fx + plane[1] * fy + plane[2] * fz + plane[3] >= 0;
+		}
+		if (inside) visible.push_back(i);
+	}
+	sort(visible.begin(), visible.end());
+	return visible;
+}
@@ -0,0 +1,146 @@
+/*  =================== File Information =================
+        File Name: scene.h
+        Description: Many placed meshes and the projectiles flying between them
+        Author:
+
+        Purpose: Holds any number of instances of a few loaded meshes.
+                 Each instance is a ply built from a shared geometry: the
+                 faces, edges and adjacency are loaded once per file and
+                 shared, while every instance deforms its own copy of the
+                 vertices, placed in the world by its entity position and
+                 scale.
+
+                 Projectiles are matched to instances by sweep and prune
+                 on the x axis: the instances are kept sorted by the low
+                 end of their world box, the projectiles are sorted the
+                 same way each step, and one walk over both lists finds
+                 every pair whose boxes overlap.  Only those pairs query
+                 an instance's pick grid, and an instance is only handed
+                 to the spring solver while something has hit it lately,
+                 so a step costs the contacts and the instances they
+                 woke, not the size of the scene.  cull does the same for
+                 drawing: a range of the same sorted order holds every
+                 instance that can reach the view, and only those are
+                 tested against its planes.
+        ===================================================== */
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ply.h"
+#include "projectiles.h"
+#include "parallel.h"
+#include "AlgebraF.h"
+
+class Scene {
+
+public:
+	Scene(WorkerPool* pool = NULL);
+
+	/*  ===============================================
+	      Desc: The geometry of the file at path, loaded the first time
+	            it is asked for.  It is the rest pose the instances are
+	            copied from and must not be deformed or stepped itself.
+	      Returns: NULL, with the load error in *error if given, if the
+	            file did not load
+	    =============================================== */
+	std::shared_ptr<ply> getGeometry(const std::string& path, std::string* error = NULL);
+
+	/*  ===============================================
+	      Desc: Places a new instance of geometry at position, scaled by
+	            scale along every axis.  It starts at rest and asleep.
+	      Returns: its index, or -1 if path did not load
+	    =============================================== */
+	int add(std::shared_ptr<ply> geometry, const Pointf& position, float scale = 1);
+	int add(const std::string& path, const Pointf& position, float scale = 1);
+	// Makes mesh itself an instance, placed where its entity already
+	// is; the scene steps and deforms it from then on.  It starts
+	// awake, since it may not be at rest.
+	int insert(std::shared_ptr<ply> mesh);
+
+	int getInstanceCount() const { return (int)instances.size(); }
+	ply& getInstance(int i) { return *instances[i]; }
+	// Call after changing instance i's position, scale or vertices
+	// other than through step and adjust
+	void moved(int i);
+	// Hands over the instances moved (added, stepped, adjusted or
+	// passed to moved) since the last call, each once, in out
+	void takeChanged(std::vector<int>& out);
+
+	/*  ===============================================
+	      Desc: Advances every projectile by one step, as
+	            ProjectileSystem::step does for one mesh: all of them
+	            move, then each deforms every instance it touches, all
+	            contacts found before any instance moves, and is slowed
+	            if it hit anything; the rest fall while drop is on.
+	      Returns: the number of projectiles that hit an instance
+	    =============================================== */
+	int step(ProjectileSystem& projectiles, bool drop);
+
+	/*  ===============================================
+	      Desc: Runs adjustModel(lift) on every awake instance, that is
+	            every one hit in the last SCENE_SLEEP_STEPS steps; the
+	            others are at rest or close enough.  Lift moves every
+	            mesh, so with it on every instance is adjusted.
+	      Returns: the number of instances adjusted
+	    =============================================== */
+	int adjust(bool lift);
+
+	/*  ===============================================
+	      Desc: The instances whose world box reaches the x range of
+	            a view volume and is not entirely outside any of its six
+	            planes; a point is inside plane p when
+	            p[0] x + p[1] y + p[2] z + p[3] >= 0.  The planes come in
+	            opposite pairs, left right, bottom top, near far, as
+	            taken from a projection matrix.
+	      Returns: their indices in increasing order, valid until the
+	            next call
+	    =============================================== */
+	const std::vector<int>& cull(const float planes[6][4]);
+
+	// Box pairs found by the last step, and instances adjust would run
+	int getPairCount() const { return pairCount; }
+	int getAwakeCount() const { return (int)awake.size(); }
+
+private:
+	// adds the per-instance entries of a new instance
+	int place(std::shared_ptr<ply> mesh);
+	// recomputes the world boxes in stale and restores the sort order
+	void refreshBounds();
+	void wake(int i);
+
+	WorkerPool* workers;
+	std::map<std::string, std::shared_ptr<ply> > geometries;
+	std::vector<std::shared_ptr<ply> > instances;
+
+	// world box of every instance
+	std::vector<float> loX, loY, loZ, hiX, hiY, hiZ;
+	// instances by loX, the sweep order, and the widest box along x
+	std::vector<int> order;
+	float widestX;
+	// instances whose box has to be recomputed before it is used
+	std::vector<int> stale;
+	std::vector<unsigned char> isStale;
+	// instances moved since the last takeChanged
+	std::vector<int> changed;
+	std::vector<unsigned char> isChanged;
+	// instances adjust runs, and the step each was last hit in
+	std::vector<int> awake;
+	std::vector<long> lastHit;
+	std::vector<unsigned char> isAwake;
+	long stepCount;
+	int pairCount;
+
+	// scratch of step and cull
+	std::vector<int> sortedProjectiles;
+	std::vector<float> projectileLo;
+	std::vector<int> activeProjectiles, activeInstances;
+	std::vector<long long> pairs;
+	std::vector<int> contacted;   // instances hit this step, each once
+	std::vector<int> visible;
+};
+
+#endif
@@ -0,0 +1,351 @@
+/*  =================== File Information =================
+        File Name: simulation.cpp
+        Description: Fixed time step simulation of a scene and its projectiles
+        Author:
+        ===================================================== */
+#include "simulation.h"
+#include <chrono>
+
+#define SNAPSHOT_FRESH 4
+
+using namespace std;
+
+typedef chrono::steady_clock simClock;
+
+// a scene holding mesh alone, as it is
+static shared_ptr<Scene> sceneOf(shared_ptr<ply> mesh){
+        shared_ptr<Scene> scene(new Scene(mesh->getWorkerPool()));
+        scene->insert(mesh);
+        return scene;
+}
+
+Simulation::Simulation(shared_ptr<ply> mesh)
+        : Simulation(sceneOf(mesh)){
+}
+
+Simulation::Simulation(shared_ptr<Scene> _scene){
+        scene = _scene;
+        stepSeconds = 1.0 / 60;
+        timeScale = 1;
+        maxStepsPerUpdate = 8;
+        accumulator = 0;
+        simTime = 0;
+        stepCount = 0;
+        drop = true;
+        solverEnabled = false;
+        solverLift = false;
+        contacts = 0;
+        pendingDrop = true;
+        pendingSolver = false;
+        pendingLift = false;
+        pendingIntegrator = PLY_EXPLICIT;
+        integratorChanged = false;
+        pendingSmooth = scene->getInstanceCount() > 0 && scene->getInstance(0).getSmoothNormals();
+        smoothChanged = false;
+        viewChanged = false;
+        viewSet = false;
+        refillAll = false;
+        // one step advances every instance by as much time as it adds
+        // to simTime
+        configure(pendingSmooth);
+        shared = 0;
+        writeSlot = 1;
+        readSlot = 2;
+        publishCount = 0;
+        takenSerial = 0;
+        running = false;
+        publish();
+}
+
+Simulation::~Simulation(){
+        stop();
+}
+
+void Simulation::start(){
+        if (running) return;
+        // the scene may have been replaced while stopped
+        swapScene();
+        publish();
+        accumulator = 0;
+        running = true;
+        worker = thread(&Simulation::run, this);
+}
+
+void Simulation::stop(){
+        if (!running) return;
+        running = false;
+        worker.join();
+}
+
+void Simulation::setStepRate(double stepsPerSecond){
+        if (!(stepsPerSecond > 0)) return;
+        stepSeconds = 1 / stepsPerSecond;
+        for (int i = 0; i < scene->getInstanceCount(); i++) {
+                scene->getInstance(i).setTimeStep((float)stepSeconds);
+        }
+}
+
+void Simulation::setTimeScale(double scale){
+        if (scale > 0) timeScale = scale;
+}
+
+void Simulation::setMaxStepsPerUpdate(int steps){
+        if (steps > 0) maxStepsPerUpdate = steps;
+}
+
+void Simulation::launch(const Projectile& p){
+        lock_guard<mutex> guard(requestLock);
+        pendingLaunches.push_back(p);
+}
+
+void Simulation::setDrop(bool _drop){
+        lock_guard<mutex> guard(requestLock);
+        pendingDrop = _drop;
+}
+
+void Simulation::setSolver(bool enabled, bool lift){
+        lock_guard<mutex> guard(requestLock);
+        pendingSolver = enabled;
+        pendingLift = lift;
+}
+
+void Simulation::setIntegrator(plyIntegrator integrator){
+        lock_guard<mutex> guard(requestLock);
+        pendingIntegrator = integrator;
+        integratorChanged = true;
+}
+
+void Simulation::setSmoothNormals(bool smooth){
+        lock_guard<mutex> guard(requestLock);
+        pendingSmooth = smooth;
+        smoothChanged = true;
+}
+
+void Simulation::setView(const float planes[6][4]){
+        lock_guard<mutex> guard(requestLock);
+        for (int p = 0; p < 6; p++) {
+                for (int k = 0; k < 4; k++) {
+                        pendingView[p][k] = planes[p][k];
+                }
+        }
+        viewChanged = true;
+}
+
+void Simulation::setScene(shared_ptr<Scene> next){
+        if (next == NULL) return;
+        atomic_store(&pendingScene, next);
+}
+
+void Simulation::setMesh(shared_ptr<ply> next){
+        if (next == NULL) return;
+        setScene(sceneOf(next));
+}
+
+void Simulation::configure(bool smooth){
+        int n = scene->getInstanceCount();
+        for (int i = 0; i < n; i++) {
+                ply& mesh = scene->getInstance(i);
+                mesh.setIntegrator(pendingIntegrator);
+                mesh.setTimeStep((float)stepSeconds);
+                if (mesh.getSmoothNormals() != smooth) {
+                        // the snapshots need every normal again
+                        mesh.setSmoothNormals(smooth);
+                        scene->moved(i);
+                        refillAll = true;
+                }
+        }
+}
+
+bool Simulation::swapScene(){
+        shared_ptr<Scene> next = atomic_exchange(&pendingScene, shared_ptr<Scene>());
+        if (next == NULL) return false;
+        // the old scene goes once the last snapshot of it is let go
+        scene = next;
+        projectiles.clear();
+        changedSerial.clear();
+        unreadBase.clear();
+        unreadMoved.clear();
+        unreadAllMoved.clear();
+        publishedVisible.clear();
+        // every instance is new to the renderer
+        for (int i = 0; i < scene->getInstanceCount(); i++) {
+                scene->moved(i);
+        }
+        lock_guard<mutex> guard(requestLock);
+        configure(pendingSmooth);
+        return true;
+}
+
+void Simulation::applyRequests(){
+        if (swapScene()) {
+                // the renderer gets the new scene without waiting for a step
+                publish();
+        }
+        lock_guard<mutex> guard(requestLock);
+        for (size_t i = 0; i < pendingLaunches.size(); i++) {
+                projectiles.add(pendingLaunches[i]);
+        }
+        pendingLaunches.clear();
+        drop = pendingDrop;
+        solverEnabled = pendingSolver;
+        solverLift = pendingLift;
+        if (integratorChanged || smoothChanged) {
+                configure(pendingSmooth);
+                integratorChanged = false;
+                smoothChanged = false;
+        }
+        if (viewChanged) {
+                for (int p = 0; p < 6; p++) {
+                        for (int k = 0; k < 4; k++) {
+                                view[p][k] = pendingView[p][k];
+                        }
+                }
+                viewSet = true;
+                viewChanged = false;
+        }
+}
+
+void Simulation::step(){
+        applyRequests();
+        contacts = scene->step(projectiles, drop);
+        if (solverEnabled) {
+                scene->adjust(solverLift);
+        }
+        simTime += stepSeconds;
+        stepCount++;
+}
+
+int Simulation::advance(double realSeconds){
+        accumulator += realSeconds * timeScale;
+        int steps = 0;
+        while (accumulator >= stepSeconds && steps < maxStepsPerUpdate) {
+                step();
+                accumulator -= stepSeconds;
+                steps++;
+        }
+        // when stepping cannot keep up, drop the backlog instead of
+        // trying to catch up with ever longer updates
+        if (accumulator >= stepSeconds) accumulator = 0;
+        return steps;
+}
+
+void Simulation::run(){
+        simClock::time_point last = simClock::now();
+        while (running) {
+                simClock::time_point now = simClock::now();
+                double elapsed = chrono::duration<double>(now - last).count();
+                last = now;
+                if (advance(elapsed) > 0) {
+                        publish();
+                }
+                // sleep until the next step is due
+                double wait = (stepSeconds - accumulator) / timeScale;
+                this_thread::sleep_until(now + chrono::duration_cast<simClock::duration>(
+                                         chrono::duration<double>(wait)));
+        }
+}
+
+void Simulation::publish(){
+        SimSnapshot& s = slots[writeSlot];
+        int n = scene->getInstanceCount();
+        if (s.scene != scene) {
+                // the slot's copies are of another scene
+                s.scene = scene;
+                s.instances.clear();
+        }
+        s.instances.resize(n);
+        changedSerial.resize(n, 0);
+        unreadBase.resize(n, -1);
+        unreadMoved.resize(n);
+        unreadAllMoved.resize(n, 1);
+
+        // if the renderer took the last snapshot, the instances it
+        // showed are drawn up to there and only need what moves next
+        if (!(shared.load() & SNAPSHOT_FRESH) && takenSerial < publishCount) {
+                takenSerial = publishCount;
+                for (size_t k = 0; k < publishedVisible.size(); k++) {
+                        int i = publishedVisible[k];
+                        unreadBase[i] = takenSerial;
+                        unreadMoved[i].clear();
+                        unreadAllMoved[i] = 0;
+                }
+        }
+
+        long serial = ++publishCount;
+        scene->takeChanged(changed);
+        for (size_t k = 0; k < changed.size(); k++) {
+                int i = changed[k];
+                ply& mesh = scene->getInstance(i);
+                // only the faces around what moved since the last
+                // publish are recomputed
+                mesh.updateNormals();
+                const vector<int>* moved = mesh.getUpdatedVertices();
+                vector<int>& unread = unreadMoved[i];
+                if (refillAll || moved == NULL
+                    || unread.size() + moved->size() > (size_t)mesh.getVertexCount()) {
+                        // past this many it is as cheap to send everything
+                        unread.clear();
+                        unreadAllMoved[i] = 1;
+                } else if (!unreadAllMoved[i]) {
+                        unread.insert(unread.end(), moved->begin(), moved->end());
+                }
+                changedSerial[i] = serial;
+        }
+        refillAll = false;
+
+        if (viewSet) {
+                s.visible = scene->cull(view);
+        } else {
+                for (int i = (int)everyInstance.size(); i < n; i++) {
+                        everyInstance.push_back(i);
+                }
+                s.visible.assign(everyInstance.begin(), everyInstance.begin() + n);
+        }
+        // only instances whose copy in this slot is older than their
+        // last change are copied
+        for (size_t k = 0; k < s.visible.size(); k++) {
+                int i = s.visible[k];
+                SimInstance& copy = s.instances[i];
+                if (copy.changed == changedSerial[i]) continue;
+                ply& mesh = scene->getInstance(i);
+                copy.mesh = &mesh;
+                copy.position[0] = mesh.getXPosition();
+                copy.position[1] = mesh.getYPosition();
+                copy.position[2] = mesh.getZPosition();
+                copy.scale[0] = mesh.getXScale();
+                copy.scale[1] = mesh.getYScale();
+                copy.scale[2] = mesh.getZScale();
+                VertexStore& vertices = mesh.getVertexList();
+                copy.vertexCount = mesh.getVertexCount();
+                copy.px.assign(vertices.px, vertices.px + copy.vertexCount);
+                copy.py.assign(vertices.py, vertices.py + copy.vertexCount);
+                copy.pz.assign(vertices.pz, vertices.pz + copy.vertexCount);
+                const FaceList& faces = mesh.getFaceList();
+                int faceCount = faces.normX ? mesh.getFaceCount() : 0;
+                copy.normX.assign(faces.normX, faces.normX + faceCount);
+                copy.normY.assign(faces.normY, faces.normY + faceCount);
+                copy.normZ.assign(faces.normZ, faces.normZ + faceCount);
+                int smoothCount = mesh.getSmoothNormals() ? copy.vertexCount : 0;
+                copy.smoothX.assign(vertices.nx, vertices.nx + smoothCount);
+                copy.smoothY.assign(vertices.ny, vertices.ny + smoothCount);
+                copy.smoothZ.assign(vertices.nz, vertices.nz + smoothCount);
+                copy.changed = changedSerial[i];
+                copy.base = unreadBase[i];
+                copy.allMoved = unreadAllMoved[i] != 0;
+                copy.moved.assign(unreadMoved[i].begin(), unreadMoved[i].end());
+        }
+        publishedVisible.assign(s.visible.begin(), s.visible.end());
+        s.projectiles = projectiles;
+        s.time = simTime;
+        s.steps = stepCount;
+        s.serial = serial;
+        // hand the slot over and take back whichever one was waiting
+        writeSlot = shared.exchange(writeSlot | SNAPSHOT_FRESH) & 3;
+}
+
+const SimSnapshot& Simulation::acquireSnapshot(){
+        if (shared.load() & SNAPSHOT_FRESH) {
+                readSlot = shared.exchange(readSlot) & 3;
+        }
+        return slots[readSlot];
+}
@@ -0,0 +1,261 @@
+/*  =================== File Information =================
+        File Name: simulation.h
+        Description: Fixed time step simulation of a scene and its projectiles
+        Author:
+
+        Purpose: Runs the projectiles, the collision deformation and the
+                 spring solver of a Scene at a fixed rate on its own
+                 thread, away from the GLUT display callback.  Real time
+                 is fed into an accumulator that is spent in whole steps,
+                 so the simulated time stays steady whatever the frame
+                 rate, and a time scale above 1 runs faster than real
+                 time.  After stepping, the instances in view are copied
+                 into a snapshot the renderer picks up without locking:
+                 one slot is being written, one is being drawn and one
+                 holds the latest finished copy, so neither side ever
+                 waits for the other.
+
+                 Publishing costs the instances that changed and are in
+                 view, not the size of the scene: the scene reports which
+                 instances moved, the view set with setView is culled
+                 with the scene's sweep order, and an instance is only
+                 copied into a slot whose copy of it is older than its
+                 last change.  Since the renderer may skip snapshots, and
+                 skips instances out of view, each instance carries the
+                 vertices moved since a given snapshot, so an instance
+                 drawn since then only has to send those to GL.
+
+                 A new scene (or a mesh from MeshLoader, placed alone in
+                 one) is handed over with setScene / setMesh and swapped
+                 in by the simulation thread between two steps.  Every
+                 snapshot holds a reference to the scene it was taken
+                 from, so the old scene is only freed once the last
+                 frame drawing it has let go of its snapshot.
+        ===================================================== */
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ply.h"
+#include "projectiles.h"
+#include "scene.h"
+#include "AlgebraF.h"
+
+/*  ============== SimInstance ==============
+        One instance of a snapshot, as the renderer needs it
+        ==================================== */
+struct SimInstance {
+        // the instance the arrays below belong to, kept alive by the
+        // snapshot's scene
+        ply* mesh;
+        float position[3], scale[3];
+        int vertexCount;
+        std::vector<float> px, py, pz;
+        // face normals, and per-vertex smooth normals (empty unless
+        // the mesh keeps them)
+        std::vector<float> normX, normY, normZ;
+        std::vector<float> smoothX, smoothY, smoothZ;
+        // serial of the last snapshot the instance changed in; the
+        // vertices moved after snapshot base (possibly more), and
+        // whether everything may have moved since
+        long changed;
+        long base;
+        std::vector<int> moved;
+        bool allMoved;
+
+        SimInstance() { mesh = NULL; vertexCount = 0; changed = -1; base = -1; allMoved = true; }
+};
+
+/*  ============== SimSnapshot ==============
+        Everything the renderer needs from one simulation step
+        ==================================== */
+struct SimSnapshot {
+        // the scene the instances belong to, kept alive by the snapshot
+        std::shared_ptr<Scene> scene;
+        // one entry per instance of the scene, but only those listed in
+        // visible are filled in for this snapshot
+        std::vector<SimInstance> instances;
+        std::vector<int> visible;
+        ProjectileSystem projectiles;
+        double time;         // simulated seconds
+        long steps;
+        // counts the snapshots published, so a reader can tell a new
+        // one from one it has seen
+        long serial;
+
+        SimSnapshot() { time = 0; steps = 0; serial = 0; }
+};
+
+class Simulation {
+
+        public:
+                Simulation(std::shared_ptr<Scene> _scene);
+                // a simulation of mesh alone, as the one instance of a scene
+                Simulation(std::shared_ptr<ply> mesh);
+                // stops the thread
+                ~Simulation();
+
+                /*      ===============================================
+                        Desc: Starts / stops stepping on the simulation
+                        thread.  The scene may only be touched by other
+                        threads (deformModel, ...) while stopped; to
+                        change scenes while running use setScene.
+                        =============================================== */
+                void start();
+                void stop();
+                bool isRunning() { return running; }
+
+                /*      ===============================================
+                        Desc: Steps per simulated second, 60 by default.
+                        The simulation owns the step length: every
+                        instance, and those swapped in later, integrates by
+                        exactly 1 / stepsPerSecond each step, which
+                        overrides any ply::setTimeStep.  Only while
+                        stopped.
+                        =============================================== */
+                void setStepRate(double stepsPerSecond);
+                // Simulated seconds per real second, 1 by default
+                void setTimeScale(double scale);
+                // Most steps one update may take before it drops time
+                void setMaxStepsPerUpdate(int steps);
+
+                /*      ===============================================
+                        Desc: Requests that are applied by the simulation
+                        thread at the start of its next step; safe to call
+                        from any thread
+                        =============================================== */
+                // adds p to the projectiles in flight
+                void launch(const Projectile& p);
+                void setDrop(bool drop);
+                // runs Scene::adjust(lift) every step when enabled
+                void setSolver(bool enabled, bool lift);
+                void setIntegrator(plyIntegrator integrator);
+                void setSmoothNormals(bool smooth);
+                /*      ===============================================
+                        Desc: The view the snapshots are culled against:
+                        six planes, as Scene::cull takes them.  Until it
+                        is set every instance is in view.
+                        =============================================== */
+                void setView(const float planes[6][4]);
+                /*      ===============================================
+                        Desc: Switches to scene before the next step, with
+                        the current integrator and smooth normals.  The
+                        projectiles in flight are dropped, and the next
+                        snapshot is of the new scene.  The old scene is
+                        released by the simulation thread and by the
+                        snapshots still holding it, whichever is last.
+                        =============================================== */
+                void setScene(std::shared_ptr<Scene> scene);
+                // setScene with mesh alone
+                void setMesh(std::shared_ptr<ply> mesh);
+                // The scene being stepped; from other threads only while
+                // stopped, the renderer uses the snapshot's
+                Scene* getScene() { return scene.get(); }
+
+                /*      ===============================================
+                        Desc: Advances by exactly one step / by as many
+                        whole steps as fit in realSeconds plus what was
+                        left over before.  Used by the thread, and directly
+                        by tools that run without one.
+                        Returns: advance returns the number of steps taken
+                        =============================================== */
+                void step();
+                int advance(double realSeconds);
+
+                /*      ===============================================
+                        Desc: The most recent finished snapshot.  Stays
+                        valid and unchanged until the next call, and never
+                        blocks.  Call from one (render) thread only.
+                        =============================================== */
+                const SimSnapshot& acquireSnapshot();
+                // copies the current state into a snapshot and hands it over
+                void publish();
+
+                double getSimulatedTime() { return simTime; }
+                long getStepCount() { return stepCount; }
+                // Projectiles in flight and contacts in the last step;
+                // from other threads only while stopped
+                int getProjectileCount() { return projectiles.size(); }
+                int getContactCount() { return contacts; }
+
+        private:
+                // not copyable, it owns a thread
+                Simulation(const Simulation&);
+                Simulation& operator=(const Simulation&);
+
+                void run();
+                void applyRequests();
+                // takes pendingScene, true if there was one
+                bool swapScene();
+                // gives every instance the step length, integrator and
+                // smooth normals asked for
+                void configure(bool smooth);
+
+                std::shared_ptr<Scene> scene;
+                double stepSeconds;
+                double timeScale;
+                int maxStepsPerUpdate;
+                double accumulator;
+                double simTime;
+                long stepCount;
+
+                // owned by the simulation thread
+                ProjectileSystem projectiles;
+                int contacts;
+                bool drop;
+                bool solverEnabled;
+                bool solverLift;
+
+                // requests from other threads, guarded by requestLock
+                std::mutex requestLock;
+                std::vector<Projectile> pendingLaunches;
+                bool pendingDrop;
+                bool pendingSolver;
+                bool pendingLift;
+                plyIntegrator pendingIntegrator;
+                bool integratorChanged;
+                bool pendingSmooth;
+                bool smoothChanged;
+                float pendingView[6][4];
+                bool viewChanged;
+                // next scene, set and taken with atomic shared_ptr swaps
+                std::shared_ptr<Scene> pendingScene;
+
+                // the view publish culls against, owned by the
+                // simulation thread
+                float view[6][4];
+                bool viewSet;
+
+                // three snapshot slots; shared holds the index of the
+                // latest finished one, plus SNAPSHOT_FRESH until it is read
+                SimSnapshot slots[3];
+                std::atomic<int> shared;
+                int writeSlot;
+                int readSlot;
+                long publishCount;
+                // the latest snapshot the renderer is known to have
+                // taken, and the instances in view in the last published
+                long takenSerial;
+                std::vector<int> publishedVisible;
+                // per instance: the snapshot it last changed in, and the
+                // vertices moved after snapshot unreadBase, for the next
+                std::vector<long> changedSerial;
+                std::vector<long> unreadBase;
+                std::vector<std::vector<int> > unreadMoved;
+                std::vector<unsigned char> unreadAllMoved;
+                // set when every vertex has to be sent again, such as
+                // after smooth normals were turned on
+                bool refillAll;
+                // scratch of publish
+                std::vector<int> changed;
+                std::vector<int> everyInstance;
+
+                std::thread worker;
+                std::atomic<bool> running;
+};
+
+#endif
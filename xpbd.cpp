@@ -0,0 +1,359 @@
+/*  =================== File Information =================
+        File Name: xpbd.cpp
+        Description: Extended position based dynamics step
+        Author:
+        ===================================================== */
+#include "xpbd.h"
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+
+// below this many edges or vertices per chunk threads do not pay off
+#define XPBD_MIN_CHUNK 1024
+// colours tracked per vertex, edges that find none free go serial
+#define XPBD_MAX_COLORS 64
+
+XpbdSolver::XpbdSolver(){
+	iterations = 10;
+	edgeCompliance = 1e-4f;
+	volumeCompliance = 0;
+	damping = 1;
+	release();
+}
+
+void XpbdSolver::release(){
+	colorCount = 0;
+	colorStart = NULL;
+	serialColor = -1;
+	edgeV1 = edgeV2 = NULL;
+	restLen = NULL;
+	edgeLambda = NULL;
+	prevX = prevY = prevZ = NULL;
+	faces = NULL;
+	faceStart = incidentFaces = NULL;
+	restVolume = 0;
+	areaX = areaY = areaZ = NULL;
+	gradX = gradY = gradZ = NULL;
+}
+
+size_t XpbdSolver::bytesFor(int edgeCount, int vertexCount, int faceCount){
+	// a colour for every bit of the masks, and the serial one
+	return MeshArena::bytesFor<int>(XPBD_MAX_COLORS + 2)
+		+ 2 * MeshArena::bytesFor<int>(edgeCount)
+		+ MeshArena::bytesFor<float>(edgeCount)
+		+ restoreBytesFor(edgeCount, vertexCount, faceCount);
+}
+
+size_t XpbdSolver::restoreBytesFor(int edgeCount, int vertexCount, int faceCount){
+	return MeshArena::bytesFor<float>(edgeCount)
+		+ 6 * MeshArena::bytesFor<float>(vertexCount)
+		+ 3 * MeshArena::bytesFor<float>(faceCount);
+}
+
+void XpbdSolver::build(const edge* edges, int edgeCount, int vertexCount, MeshArena& arena){
+	// greedy colouring: every edge takes the lowest colour neither
+	// endpoint uses yet
+	std::vector<uint64_t> used(vertexCount, 0);
+	std::vector<int> color(edgeCount);
+	colorCount = 0;
+	serialColor = -1;
+	for (int e = 0; e < edgeCount; e++) {
+		int v1 = edges[e].vertices[0];
+		int v2 = edges[e].vertices[1];
+		uint64_t freeColors = ~(used[v1] | used[v2]);
+		int c = XPBD_MAX_COLORS;
+		if (freeColors != 0) {
+			c = __builtin_ctzll(freeColors);
+			used[v1] |= (uint64_t)1 << c;
+			used[v2] |= (uint64_t)1 << c;
+		} else {
+			serialColor = c;
+		}
+		color[e] = c;
+		if (c + 1 > colorCount) colorCount = c + 1;
+	}
+	if (serialColor >= 0) serialColor = colorCount - 1;
+
+	// pack the edges colour by colour, in edge order inside a colour
+	int* start = arena.allocate<int>(colorCount + 1);
+	std::fill(start, start + colorCount + 1, 0);
+	for (int e = 0; e < edgeCount; e++) start[color[e] + 1]++;
+	for (int c = 0; c < colorCount; c++) start[c + 1] += start[c];
+	std::vector<int> slot(start, start + colorCount);
+	int* v1 = arena.allocate<int>(edgeCount);
+	int* v2 = arena.allocate<int>(edgeCount);
+	float* rest = arena.allocate<float>(edgeCount);
+	for (int e = 0; e < edgeCount; e++) {
+		int s = slot[color[e]]++;
+		v1[s] = edges[e].vertices[0];
+		v2[s] = edges[e].vertices[1];
+		rest[s] = edges[e].len;
+	}
+	colorStart = start;
+	edgeV1 = v1;
+	edgeV2 = v2;
+	restLen = rest;
+	allocateState(edgeCount, vertexCount, arena);
+}
+
+void XpbdSolver::restore(const int* _colorStart, int _colorCount, int _serialColor,
+                         const int* v1, const int* v2, const float* rest,
+                         int edgeCount, int vertexCount, MeshArena& arena){
+	colorCount = _colorCount;
+	colorStart = _colorStart;
+	serialColor = _serialColor;
+	edgeV1 = v1;
+	edgeV2 = v2;
+	restLen = rest;
+	allocateState(edgeCount, vertexCount, arena);
+}
+
+void XpbdSolver::allocateState(int edgeCount, int vertexCount, MeshArena& arena){
+	edgeLambda = arena.allocate<float>(edgeCount);
+	float** perVertex[] = { &prevX, &prevY, &prevZ, &gradX, &gradY, &gradZ };
+	for (int k = 0; k < 6; k++) {
+		*perVertex[k] = arena.allocate<float>(vertexCount);
+	}
+}
+
+void XpbdSolver::triangleAreas(const VertexStore& store, int begin, int end){
+	const float *px = store.px, *py = store.py, *pz = store.pz;
+	for (int f = begin; f < end; f++) {
+		if (faces->size(f) != 3) continue;
+		const int* face = faces->vertices(f);
+		int a = face[0], b = face[1], d = face[2];
+		float bx = px[b] - px[a], by = py[b] - py[a], bz = pz[b] - pz[a];
+		float dx = px[d] - px[a], dy = py[d] - py[a], dz = pz[d] - pz[a];
+		areaX[f] = by * dz - bz * dy;
+		areaY[f] = bz * dx - bx * dz;
+		areaZ[f] = bx * dy - by * dx;
+	}
+}
+
+void XpbdSolver::volumeGradient(const VertexStore& store, int i, float g[3]) const{
+	// Faces are fanned from their first vertex into triangles (a, b, d),
+	// enclosing a . (b x d) / 6 with the origin.  Its gradient at a is
+	// b x d / 6; around a closed surface the terms that differ from
+	// (b - a) x (d - a) / 6 cancel, so every corner of a triangle
+	// takes the same vector.
+	const float *px = store.px, *py = store.py, *pz = store.pz;
+	float gx = 0, gy = 0, gz = 0;
+	auto addFan = [&](const int* face, int t) {
+		int a = face[0], b = face[t], d = face[t + 1];
+		float bx = px[b] - px[a], by = py[b] - py[a], bz = pz[b] - pz[a];
+		float dx = px[d] - px[a], dy = py[d] - py[a], dz = pz[d] - pz[a];
+		gx += by * dz - bz * dy;
+		gy += bz * dx - bx * dz;
+		gz += bx * dy - by * dx;
+	};
+	for (int k = faceStart[i]; k < faceStart[i + 1]; k++) {
+		int f = incidentFaces[k];
+		int size = faces->size(f);
+		if (size == 3) {
+			gx += areaX[f];
+			gy += areaY[f];
+			gz += areaZ[f];
+			continue;
+		}
+		// a polygon: only the triangles of its fan that i is a corner of
+		const int* face = faces->vertices(f);
+		if (face[0] == i) {
+			for (int t = 1; t + 1 < size; t++) addFan(face, t);
+			continue;
+		}
+		int j = 1;
+		while (j < size && face[j] != i) j++;
+		if (j >= 2 && j < size) addFan(face, j - 1);
+		if (j + 1 < size) addFan(face, j);
+	}
+	g[0] = gx;
+	g[1] = gy;
+	g[2] = gz;
+}
+
+void XpbdSolver::setSurface(const FaceList* _faces, const int* _faceStart,
+                            const int* _incidentFaces, const VertexStore& rest,
+                            MeshArena& arena){
+	faces = _faces;
+	faceStart = _faceStart;
+	incidentFaces = _incidentFaces;
+	float** perFace[] = { &areaX, &areaY, &areaZ };
+	for (int k = 0; k < 3; k++) {
+		*perFace[k] = arena.allocate<float>(faces->count);
+	}
+	triangleAreas(rest, 0, faces->count);
+
+	// the volume is homogeneous of degree 3 in the positions, so it is
+	// a third of the sum of position . gradient; taken around the
+	// centroid, as in step
+	int n = rest.count;
+	double sum[3] = { 0, 0, 0 };
+	for (int i = 0; i < n; i++) {
+		sum[0] += rest.px[i];
+		sum[1] += rest.py[i];
+		sum[2] += rest.pz[i];
+	}
+	double c[3] = { 0, 0, 0 };
+	for (int a = 0; a < 3 && n > 0; a++) c[a] = sum[a] / n;
+	double volume = 0;
+	for (int i = 0; i < n; i++) {
+		float g[3];
+		volumeGradient(rest, i, g);
+		volume += (rest.px[i] - c[0]) * g[0] + (rest.py[i] - c[1]) * g[1] + (rest.pz[i] - c[2]) * g[2];
+	}
+	restVolume = (float)(volume / 18);
+}
+
+void XpbdSolver::projectEdges(VertexStore& store, WorkerPool& pool, int color, float alpha, float w){
+	float *px = store.px, *py = store.py, *pz = store.pz;
+	auto project = [&](int, int begin, int end) {
+		for (int s = begin; s < end; s++) {
+			int v1 = edgeV1[s];
+			int v2 = edgeV2[s];
+			float dx = px[v1] - px[v2];
+			float dy = py[v1] - py[v2];
+			float dz = pz[v1] - pz[v2];
+			float l = sqrtf(dx * dx + dy * dy + dz * dz);
+			if (l <= 0) continue;
+			// equal masses: both ends take half of the correction
+			float C = l - restLen[s];
+			float dLambda = (-C - alpha * edgeLambda[s]) / (2 * w + alpha);
+			edgeLambda[s] += dLambda;
+			float k = w * dLambda / l;
+			px[v1] += k * dx;  py[v1] += k * dy;  pz[v1] += k * dz;
+			px[v2] -= k * dx;  py[v2] -= k * dy;  pz[v2] -= k * dz;
+		}
+	};
+	int begin = colorStart[color];
+	int end = colorStart[color + 1];
+	if (color == serialColor) {
+		project(0, begin, end);
+		return;
+	}
+	pool.run(end - begin, XPBD_MIN_CHUNK, [&](int chunk, int b, int e) {
+		project(chunk, begin + b, begin + e);
+	});
+}
+
+void XpbdSolver::step(VertexStore& store, WorkerPool& pool, float h, float mass,
+                      float gravity, const float* lift, vertex& center){
+	int n = store.count;
+	if (n == 0 || h <= 0) return;
+	float *px = store.px, *py = store.py, *pz = store.pz;
+	float *vx = store.vx, *vy = store.vy, *vz = store.vz;
+
+	// predict positions from the external forces, and find the
+	// centroid the volume is measured around
+	int chunks = pool.chunkCount(n, XPBD_MIN_CHUNK);
+	partial.assign(3 * chunks, 0.0);
+	pool.run(n, XPBD_MIN_CHUNK, [&](int chunk, int begin, int end) {
+		double sx = 0, sy = 0, sz = 0;
+		for (int i = begin; i < end; i++) {
+			float ay = (lift != NULL ? lift[i] : 0) - gravity;
+			vy[i] += h * ay / mass;
+			prevX[i] = px[i];
+			prevY[i] = py[i];
+			prevZ[i] = pz[i];
+			px[i] += h * vx[i];
+			py[i] += h * vy[i];
+			pz[i] += h * vz[i];
+			sx += px[i];
+			sy += py[i];
+			sz += pz[i];
+		}
+		partial[3 * chunk] = sx;
+		partial[3 * chunk + 1] = sy;
+		partial[3 * chunk + 2] = sz;
+	});
+	double sum[3] = { 0, 0, 0 };
+	for (int c = 0; c < chunks; c++) {
+		for (int a = 0; a < 3; a++) sum[a] += partial[3 * c + a];
+	}
+	float oldX = center.x, oldY = center.y, oldZ = center.z;
+	center.x = (float)(sum[0] / n);
+	center.y = (float)(sum[1] / n);
+	center.z = (float)(sum[2] / n);
+	center.velocity = Vectorf(center.x - oldX, center.y - oldY, center.z - oldZ) / h;
+
+	// compliance is scaled by 1 / h^2 so stiffness does not depend on h
+	float edgeAlpha = edgeCompliance / (h * h);
+	float volumeAlpha = volumeCompliance / (h * h);
+	std::fill(edgeLambda, edgeLambda + colorStart[colorCount], 0.0f);
+	double volumeLambda = 0;
+	bool keepVolume = faces != NULL && volumeCompliance >= 0;
+	// the volume is measured around the predicted centroid, held fixed
+	// (a closed surface encloses the same volume around any point)
+	const float c[3] = { center.x, center.y, center.z };
+	// every vertex has the same inverse mass
+	float w = 1 / mass;
+
+	for (int it = 0; it < iterations; it++) {
+		for (int color = 0; color < getColorCount(); color++) {
+			projectEdges(store, pool, color, edgeAlpha, w);
+		}
+
+		// the volume and the squared length of its gradient, summed in
+		// chunk order so the result does not depend on thread timing
+		float k = 0;
+		if (keepVolume) {
+			pool.run(faces->count, XPBD_MIN_CHUNK, [&](int, int begin, int end) {
+				triangleAreas(store, begin, end);
+			});
+			partial.assign(2 * chunks, 0.0);
+			pool.run(n, XPBD_MIN_CHUNK, [&](int chunk, int begin, int end) {
+				double volume = 0, norm = 0;
+				for (int i = begin; i < end; i++) {
+					float g[3];
+					volumeGradient(store, i, g);
+					gradX[i] = g[0];
+					gradY[i] = g[1];
+					gradZ[i] = g[2];
+					volume += (double)(px[i] - c[0]) * g[0]
+						+ (double)(py[i] - c[1]) * g[1]
+						+ (double)(pz[i] - c[2]) * g[2];
+					norm += (double)g[0] * g[0] + (double)g[1] * g[1] + (double)g[2] * g[2];
+				}
+				partial[2 * chunk] = volume;
+				partial[2 * chunk + 1] = norm;
+			});
+			double volume = 0, norm = 0;
+			for (int chunk = 0; chunk < chunks; chunk++) {
+				volume += partial[2 * chunk];
+				norm += partial[2 * chunk + 1];
+			}
+			// the gradients above are six times the real ones
+			norm /= 36;
+			if (norm > 0) {
+				double C = volume / 18 - restVolume;
+				double dLambda = (-C - volumeAlpha * volumeLambda) / (w * norm + volumeAlpha);
+				volumeLambda += dLambda;
+				k = (float)(w * dLambda / 6);
+			}
+		}
+
+		pool.run(n, XPBD_MIN_CHUNK, [&](int, int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				if (k != 0) {
+					px[i] += k * gradX[i];
+					py[i] += k * gradY[i];
+					pz[i] += k * gradZ[i];
+				}
+				// floor and ceiling
+				if (py[i] < -1) py[i] = -1;
+				if (py[i] > 1) py[i] = 1;
+			}
+		});
+	}
+
+	// velocities from the corrected positions
+	float keep = 1 - damping * h;
+	if (keep < 0) keep = 0;
+	float invH = 1 / h;
+	pool.run(n, XPBD_MIN_CHUNK, [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			vx[i] = (px[i] - prevX[i]) * invH * keep;
+			vy[i] = (py[i] - prevY[i]) * invH * keep;
+			vz[i] = (pz[i] - prevZ[i]) * invH * keep;
+		}
+	});
+}
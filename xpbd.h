@@ -0,0 +1,131 @@
+/*  =================== File Information =================
+        File Name: xpbd.h
+        Description: Extended position based dynamics step
+        Author:
+
+        Purpose: Moves the mesh by projecting constraints on positions
+                 instead of accumulating spring forces, which stays
+                 stable at any time step.  Every edge keeps its rest
+                 length edge.len, and a closed mesh keeps the volume
+                 it encloses, each with an XPBD compliance (0 is
+                 rigid, larger is softer).  The volume is one global
+                 constraint; on a closed surface its gradient at a
+                 vertex is a sixth of the summed (doubled) area
+                 vectors of the triangles around it, which are found
+                 once per face and gathered per vertex.
+                 Edges are greedily coloured so that no two edges of
+                 one colour share a vertex; a colour is projected in
+                 parallel without locks and gives the same result
+                 for any thread count.
+        ===================================================== */
+#ifndef XPBD_H
+#define XPBD_H
+
+#include <vector>
+#include "geometry.h"
+#include "parallel.h"
+#include "arena.h"
+
+class XpbdSolver{
+
+public:
+	XpbdSolver();
+
+	int iterations;           // constraint passes per step
+	float edgeCompliance;     // of the distance constraints
+	float volumeCompliance;   // of the volume constraint, < 0 turns it off
+	float damping;            // fraction of the velocity lost per second
+
+	/*  ===============================================
+	      Desc: Colours the edges and packs them by colour
+	      Precondition: edges is the edge list of a mesh with
+	            vertexCount vertices
+	      Postcondition: the packed edges and the step state are in
+	            arena, valid until its next reserve
+	    =============================================== */
+	void build(const edge* edges, int edgeCount, int vertexCount, MeshArena& arena);
+	// arena bytes build and setSurface take at most, for adding up
+	// what to reserve
+	static size_t bytesFor(int edgeCount, int vertexCount, int faceCount);
+	int getColorCount() const { return colorCount; }
+
+	/*  ===============================================
+	      Desc: Uses the packed edges of an earlier build over the
+	            same edges (saved with the mesh, see meshcache.h, or
+	            the geometry of an instance) in place instead of
+	            colouring again; only the step state goes in arena
+	      Precondition: colorStart has colorCount + 1 entries and
+	            v1, v2 and rest have edgeCount, and all of them
+	            outlive the solver's use of them
+	    =============================================== */
+	void restore(const int* colorStart, int colorCount, int serialColor,
+	             const int* v1, const int* v2, const float* rest,
+	             int edgeCount, int vertexCount, MeshArena& arena);
+	// arena bytes restore and setSurface take
+	static size_t restoreBytesFor(int edgeCount, int vertexCount, int faceCount);
+	// Forgets the arrays and the surface, for when their arena is reset
+	void release();
+
+	/*  ===============================================
+	      Desc: Gives the volume constraint the surface it keeps the
+	            volume of, and takes the volume it encloses in rest as
+	            the rest volume.  Without a surface (an open mesh)
+	            there is no volume constraint.
+	      Precondition: faces is closed, faceStart and incidentFaces
+	            list the faces around every vertex, and all of them
+	            outlive the solver's use of them
+	      Postcondition: the per-face state is in arena, valid until
+	            its next reserve
+	    =============================================== */
+	void setSurface(const FaceList* faces, const int* faceStart,
+	                const int* incidentFaces, const VertexStore& rest,
+	                MeshArena& arena);
+	float getRestVolume() const { return restVolume; }
+	// The packed edges, for restore
+	int getSerialColor() const { return serialColor; }
+	const int* getColorStart() const { return colorStart; }
+	const int* getEdgeV1() const { return edgeV1; }
+	const int* getEdgeV2() const { return edgeV2; }
+	const float* getRestLen() const { return restLen; }
+
+	/*  ===============================================
+	      Desc: Advances store by h under gravity (and an upward lift
+	            on the vertices in lifted, if not NULL), keeping y
+	            inside the floor and ceiling at -1 and 1.  Every vertex
+	            has mass mass, in the force prediction and in the
+	            inverse masses of the constraint corrections alike.
+	      Postcondition: positions and velocities are updated and
+	            center holds the centroid the step used
+	    =============================================== */
+	void step(VertexStore& store, WorkerPool& pool, float h, float mass,
+	          float gravity, const float* lift, vertex& center);
+
+private:
+	// w is the inverse mass of every vertex
+	void projectEdges(VertexStore& store, WorkerPool& pool, int color, float alpha, float w);
+	// takes the per-edge and per-vertex state after a build or restore
+	void allocateState(int edgeCount, int vertexCount, MeshArena& arena);
+	// (b - a) x (d - a) of the triangles (a, b, d) in [begin, end)
+	void triangleAreas(const VertexStore& store, int begin, int end);
+	// six times the gradient of the enclosed volume at vertex i;
+	// triangleAreas has run
+	void volumeGradient(const VertexStore& store, int i, float g[3]) const;
+
+	int colorCount;
+	const int* colorStart;         // colorCount + 1 offsets into the packed edges
+	int serialColor;               // colour that may share vertices, -1 if none
+	const int *edgeV1, *edgeV2;
+	const float* restLen;
+	float* edgeLambda;
+	float *prevX, *prevY, *prevZ;
+	// the closed surface, NULL for none, and the volume it encloses at rest
+	const FaceList* faces;
+	const int* faceStart;
+	const int* incidentFaces;
+	float restVolume;
+	float *areaX, *areaY, *areaZ;  // per face, unused for polygons
+	float *gradX, *gradY, *gradZ;
+	std::vector<double> partial;   // per-chunk centroid sums
+};
+
+#endif